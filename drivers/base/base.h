@@ -76,6 +76,8 @@ struct driver_private {
  *	binding of drivers which were unable to get all the resources needed by
  *	the device; typically because it depends on another driver getting
  *	probed first.
+ * @deferred_supplier - supplier the device deferred its probe for, or NULL
+ *	if it is not known. Only compared, never dereferenced.
  * @async_driver - pointer to device driver awaiting probe via async_probe
  * @device - pointer back to the struct device that this structure is
  * associated with.
@@ -92,6 +94,7 @@ struct device_private {
 	struct klist_node knode_bus;
 	struct klist_node knode_class;
 	struct list_head deferred_probe;
+	struct device *deferred_supplier;
 	struct device_driver *async_driver;
 	char *deferred_probe_reason;
 	struct device *device;
@@ -139,6 +142,11 @@ extern void device_release_driver_internal(struct device *dev,
 
 extern void driver_detach(struct device_driver *drv);
 extern void driver_deferred_probe_del(struct device *dev);
+extern void driver_deferred_probe_set_supplier(struct device *dev,
+					       struct device *supplier);
+extern void driver_deferred_probe_supplier_gone(struct device *supplier);
+extern void driver_deferred_probe_link_gone(struct device *consumer,
+					    struct device *supplier);
 extern void device_set_deferred_probe_reason(const struct device *dev,
 					     struct va_format *vaf);
 static inline int driver_match_device(struct device_driver *drv,
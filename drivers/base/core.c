@@ -900,6 +900,7 @@ static void __device_link_del(struct kref *kref)
 
 	pm_runtime_drop_link(link);
 
+	driver_deferred_probe_link_gone(link->consumer, link->supplier);
 	device_link_remove_from_lists(link);
 	device_unregister(&link->link_dev);
 }
@@ -1011,6 +1012,8 @@ int device_links_check_suppliers(struct device *dev)
 		dev_err_probe(dev, -EPROBE_DEFER, "wait for supplier %pfwP\n",
 			      sup_fw);
 		mutex_unlock(&fwnode_link_lock);
+		/* The supplier has no device yet, any bind may create it */
+		driver_deferred_probe_set_supplier(dev, NULL);
 		return -EPROBE_DEFER;
 	}
 	mutex_unlock(&fwnode_link_lock);
@@ -1027,12 +1030,15 @@ int device_links_check_suppliers(struct device *dev)
 			dev_err_probe(dev, -EPROBE_DEFER,
 				      "supplier %s not ready\n",
 				      dev_name(link->supplier));
+			driver_deferred_probe_set_supplier(dev, link->supplier);
 			ret = -EPROBE_DEFER;
 			break;
 		}
 		WRITE_ONCE(link->status, DL_STATE_CONSUMER_PROBE);
 	}
 	dev->links.status = DL_DEV_PROBING;
+	if (!ret)
+		driver_deferred_probe_set_supplier(dev, NULL);
 
 	device_links_write_unlock();
 	return ret;
@@ -1172,6 +1178,7 @@ static void device_link_drop_managed(struct device_link *link)
 {
 	link->flags &= ~DL_FLAG_MANAGED;
 	WRITE_ONCE(link->status, DL_STATE_NONE);
+	driver_deferred_probe_link_gone(link->consumer, link->supplier);
 	kref_put(&link->kref, __device_link_del);
 }
 
@@ -1643,6 +1650,7 @@ static void fw_devlink_relax_link(struct device_link *link)
 
 	pm_runtime_drop_link(link);
 	link->flags = DL_FLAG_MANAGED | FW_DEVLINK_FLAGS_PERMISSIVE;
+	driver_deferred_probe_link_gone(link->consumer, link->supplier);
 	dev_dbg(link->consumer, "Relaxing link with %s\n",
 		dev_name(link->supplier));
 }
@@ -3596,6 +3604,7 @@ void device_del(struct device *dev)
 	device_platform_notify_remove(dev);
 	device_remove_properties(dev);
 	device_links_purge(dev);
+	driver_deferred_probe_supplier_gone(dev);
 
 	if (dev->bus)
 		blocking_notifier_call_chain(&dev->bus->p->bus_notifier,
@@ -55,6 +55,12 @@ static DEFINE_MUTEX(deferred_probe_mutex);
 static LIST_HEAD(deferred_probe_pending_list);
 static LIST_HEAD(deferred_probe_active_list);
 static atomic_t deferred_trigger_count = ATOMIC_INIT(0);
+/* Protected by deferred_probe_mutex */
+static unsigned long deferred_probe_triggers;
+static unsigned long deferred_probe_targeted;
+static unsigned long deferred_probe_retries;
+static unsigned long deferred_probe_retries_saved;
+static bool deferred_probe_timed_out;
 static bool initcalls_done;
 
 /* Save the async probe drivers' name from kernel cmdline */
@@ -149,10 +155,61 @@ void driver_deferred_probe_del(struct device *dev)
 		list_del_init(&dev->p->deferred_probe);
 		__device_set_deferred_probe_reason(dev, NULL);
 	}
+	dev->p->deferred_supplier = NULL;
+	mutex_unlock(&deferred_probe_mutex);
+}
+
+/**
+ * driver_deferred_probe_set_supplier() - Record what a device is waiting for
+ * @dev: device whose probe is being deferred
+ * @supplier: supplier device that is not ready, or NULL if unknown
+ *
+ * A device with a known supplier is only retried when that supplier binds
+ * (or goes away), instead of on every successful probe in the system.
+ */
+void driver_deferred_probe_set_supplier(struct device *dev,
+					struct device *supplier)
+{
+	mutex_lock(&deferred_probe_mutex);
+	/* Once the timeout has fired, stop parking devices on a supplier */
+	dev->p->deferred_supplier = deferred_probe_timed_out ? NULL : supplier;
 	mutex_unlock(&deferred_probe_mutex);
 }
 
 static bool driver_deferred_probe_enable = false;
+
+/*
+ * Move pending devices to the active list. With @supplier set, only the
+ * devices waiting for it, or for nothing in particular, are moved.
+ * Must be called with deferred_probe_mutex held.
+ */
+static void __driver_deferred_probe_move(struct device *supplier)
+{
+	struct device_private *p, *n;
+
+	deferred_probe_triggers++;
+	if (!supplier) {
+		list_for_each_entry(p, &deferred_probe_pending_list, deferred_probe) {
+			p->deferred_supplier = NULL;
+			deferred_probe_retries++;
+		}
+		list_splice_tail_init(&deferred_probe_pending_list,
+				      &deferred_probe_active_list);
+		return;
+	}
+
+	deferred_probe_targeted++;
+	list_for_each_entry_safe(p, n, &deferred_probe_pending_list,
+				 deferred_probe) {
+		if (p->deferred_supplier && p->deferred_supplier != supplier) {
+			deferred_probe_retries_saved++;
+			continue;
+		}
+		p->deferred_supplier = NULL;
+		list_move_tail(&p->deferred_probe, &deferred_probe_active_list);
+		deferred_probe_retries++;
+	}
+}
 /**
  * driver_deferred_probe_trigger() - Kick off re-probing deferred devices
  *
@@ -171,20 +228,20 @@ static bool driver_deferred_probe_enable = false;
  * changes in the midst of a probe, then deferred processing should be triggered
  * again.
  */
-static void driver_deferred_probe_trigger(void)
+static void __driver_deferred_probe_trigger(struct device *supplier)
 {
 	if (!driver_deferred_probe_enable)
 		return;
 
 	/*
-	 * A successful probe means that all the devices in the pending list
-	 * should be triggered to be reprobed.  Move all the deferred devices
-	 * into the active list so they can be retried by the workqueue
+	 * A successful probe means that the devices in the pending list that
+	 * may depend on it should be triggered to be reprobed.  Move them into
+	 * the active list so they can be retried by the workqueue.  Devices
+	 * known to wait for a different supplier stay pending.
 	 */
 	mutex_lock(&deferred_probe_mutex);
 	atomic_inc(&deferred_trigger_count);
-	list_splice_tail_init(&deferred_probe_pending_list,
-			      &deferred_probe_active_list);
+	__driver_deferred_probe_move(supplier);
 	mutex_unlock(&deferred_probe_mutex);
 
 	/*
@@ -194,6 +251,72 @@ static void driver_deferred_probe_trigger(void)
 	queue_work(system_unbound_wq, &deferred_probe_work);
 }
 
+static void driver_deferred_probe_trigger(void)
+{
+	__driver_deferred_probe_trigger(NULL);
+}
+
+/**
+ * driver_deferred_probe_supplier_gone() - Retry consumers of a removed device
+ * @supplier: device being deleted
+ *
+ * The device links to @supplier are gone, so consumers parked on it may
+ * be able to probe now.  Also makes sure no stale pointer is left behind.
+ */
+void driver_deferred_probe_supplier_gone(struct device *supplier)
+{
+	struct device_private *p;
+	bool found = false;
+
+	mutex_lock(&deferred_probe_mutex);
+	list_for_each_entry(p, &deferred_probe_pending_list, deferred_probe) {
+		if (p->deferred_supplier == supplier) {
+			found = true;
+			break;
+		}
+	}
+	mutex_unlock(&deferred_probe_mutex);
+
+	if (found)
+		__driver_deferred_probe_trigger(supplier);
+}
+
+/**
+ * driver_deferred_probe_link_gone() - Retry a consumer no longer held back
+ * @consumer: consumer end of the device link
+ * @supplier: supplier end of the device link
+ *
+ * Called when the link between @consumer and @supplier is deleted or stops
+ * being a managed probe dependency.  If @consumer was parked waiting for
+ * @supplier, nothing else would retry it, so make it eligible again.
+ */
+void driver_deferred_probe_link_gone(struct device *consumer,
+				     struct device *supplier)
+{
+	struct device_private *p = consumer->p;
+	bool moved = false;
+
+	if (!p)
+		return;
+
+	mutex_lock(&deferred_probe_mutex);
+	if (p->deferred_supplier == supplier) {
+		p->deferred_supplier = NULL;
+		/* Not deferred yet: the next trigger of any kind retries it */
+		if (!list_empty(&p->deferred_probe)) {
+			list_move_tail(&p->deferred_probe,
+				       &deferred_probe_active_list);
+			atomic_inc(&deferred_trigger_count);
+			deferred_probe_retries++;
+			moved = true;
+		}
+	}
+	mutex_unlock(&deferred_probe_mutex);
+
+	if (moved && driver_deferred_probe_enable)
+		queue_work(system_unbound_wq, &deferred_probe_work);
+}
+
 /**
  * device_block_probing() - Block/defer device's probes
  *
@@ -255,6 +378,23 @@ static int deferred_devs_show(struct seq_file *s, void *data)
 }
 DEFINE_SHOW_ATTRIBUTE(deferred_devs);
 
+/*
+ * deferred_probe_stats_show() - Show how many deferred probe retries were
+ * done, and how many were avoided by only retrying dependent consumers.
+ */
+static int deferred_probe_stats_show(struct seq_file *s, void *data)
+{
+	mutex_lock(&deferred_probe_mutex);
+	seq_printf(s, "triggers: %lu\n", deferred_probe_triggers);
+	seq_printf(s, "targeted_triggers: %lu\n", deferred_probe_targeted);
+	seq_printf(s, "retries: %lu\n", deferred_probe_retries);
+	seq_printf(s, "retries_saved: %lu\n", deferred_probe_retries_saved);
+	mutex_unlock(&deferred_probe_mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(deferred_probe_stats);
+
 int driver_deferred_probe_timeout;
 EXPORT_SYMBOL_GPL(driver_deferred_probe_timeout);
 
@@ -304,6 +444,14 @@ static void deferred_probe_timeout_work_func(struct work_struct *work)
 	fw_devlink_drivers_done();
 
 	driver_deferred_probe_timeout = 0;
+	/*
+	 * Suppliers that have not bound by now may never bind.  Retry every
+	 * pending device, including the ones parked on a supplier, and stop
+	 * parking new ones so nothing stays pending for good.
+	 */
+	mutex_lock(&deferred_probe_mutex);
+	deferred_probe_timed_out = true;
+	mutex_unlock(&deferred_probe_mutex);
 	driver_deferred_probe_trigger();
 	flush_work(&deferred_probe_work);
 
@@ -325,6 +473,8 @@ static int deferred_probe_initcall(void)
 {
 	debugfs_create_file("devices_deferred", 0444, NULL, NULL,
 			    &deferred_devs_fops);
+	debugfs_create_file("deferred_probe_stats", 0444, NULL, NULL,
+			    &deferred_probe_stats_fops);
 
 	driver_deferred_probe_enable = true;
 	driver_deferred_probe_trigger();
@@ -353,6 +503,7 @@ late_initcall(deferred_probe_initcall);
 static void __exit deferred_probe_exit(void)
 {
 	debugfs_lookup_and_remove("devices_deferred", NULL);
+	debugfs_lookup_and_remove("deferred_probe_stats", NULL);
 }
 __exitcall(deferred_probe_exit);
 
@@ -388,10 +539,10 @@ static void driver_bound(struct device *dev)
 
 	/*
 	 * Make sure the device is no longer in one of the deferred lists and
-	 * kick off retrying all pending devices
+	 * kick off retrying the pending devices that may depend on it
 	 */
 	driver_deferred_probe_del(dev);
-	driver_deferred_probe_trigger();
+	__driver_deferred_probe_trigger(dev);
 
 	if (dev->bus)
 		blocking_notifier_call_chain(&dev->bus->p->bus_notifier,
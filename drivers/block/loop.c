@@ -87,6 +87,12 @@
 #include <trace/hooks/loop.h>
 
 #define LOOP_IDLE_WORKER_TIMEOUT (60 * HZ)
+/* Contiguous direct I/O requests submitted as one backing file I/O at most */
+#define LOOP_MAX_BATCH 16
+#define LOOP_MAX_HW_QUEUES 8
+
+/* Shared by all loop devices, dozens of which can be active at once */
+static struct workqueue_struct *loop_wq;
 
 static DEFINE_IDR(loop_index_idr);
 static DEFINE_MUTEX(loop_ctl_mutex);
@@ -496,9 +502,23 @@ static int lo_req_flush(struct loop_device *lo, struct request *rq)
 	return ret;
 }
 
+static void loop_account_rq(struct loop_device *lo, struct loop_cmd *cmd,
+			    struct request *rq)
+{
+	u64 lat = ktime_get_ns() - cmd->start_ns;
+	int rw = op_is_write(req_op(rq));
+
+	this_cpu_inc(lo->stats->ios[rw]);
+	this_cpu_add(lo->stats->lat_ns[rw], lat);
+	/* Racing with an interrupt here at worst loses a maximum */
+	if (lat > this_cpu_read(lo->stats->max_lat_ns[rw]))
+		this_cpu_write(lo->stats->max_lat_ns[rw], lat);
+}
+
 static void lo_complete_rq(struct request *rq)
 {
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
+	struct loop_device *lo = rq->q->queuedata;
 	blk_status_t ret = BLK_STS_OK;
 
 	if (!cmd->use_aio || cmd->ret < 0 || cmd->ret == blk_rq_bytes(rq) ||
@@ -527,6 +547,8 @@ static void lo_complete_rq(struct request *rq)
 		}
 		ret = BLK_STS_IOERR;
 end_io:
+		cmd->no_batch = false;
+		loop_account_rq(lo, cmd, rq);
 		blk_mq_end_request(rq, ret);
 	}
 }
@@ -622,6 +644,138 @@ static int lo_rw_aio(struct loop_device *lo, struct loop_cmd *cmd,
 	return 0;
 }
 
+/*
+ * Several direct I/O requests that continue each other, submitted to the
+ * backing file as a single kiocb.
+ */
+struct loop_batch {
+	struct kiocb iocb;
+	atomic_t ref;
+	int nr_cmds;
+	int nr_bvec;
+	size_t bytes;
+	struct loop_cmd *cmds[LOOP_MAX_BATCH];
+	struct bio_vec bvec[];
+};
+
+static void lo_rw_batch_do_completion(struct loop_batch *batch)
+{
+	int i;
+
+	if (!atomic_dec_and_test(&batch->ref))
+		return;
+
+	for (i = 0; i < batch->nr_cmds; i++) {
+		struct loop_cmd *cmd = batch->cmds[i];
+		struct request *rq = blk_mq_rq_from_pdu(cmd);
+
+		if (cmd->no_batch)
+			blk_mq_requeue_request(rq, true);
+		else if (likely(!blk_should_fake_timeout(rq->q)))
+			blk_mq_complete_request(rq);
+	}
+	kfree(batch);
+}
+
+static void lo_rw_batch_complete(struct kiocb *iocb, long ret, long ret2)
+{
+	struct loop_batch *batch = container_of(iocb, struct loop_batch, iocb);
+	int i;
+
+	/*
+	 * Hand the result out to the requests in order.  lo_complete_rq()
+	 * retries the rest of a short read, but not of a short write, so the
+	 * part of a write that wasn't done has to be failed here.  Requests
+	 * the short transfer didn't reach at all are submitted again on their
+	 * own, so each of them gets the result it would have had unbatched.
+	 */
+	for (i = 0; i < batch->nr_cmds; i++) {
+		struct loop_cmd *cmd = batch->cmds[i];
+		struct request *rq = blk_mq_rq_from_pdu(cmd);
+		long bytes = blk_rq_bytes(rq);
+
+		if (ret < 0) {
+			cmd->ret = ret;
+		} else if (ret >= bytes) {
+			cmd->ret = bytes;
+			ret -= bytes;
+		} else if (ret) {
+			cmd->ret = req_op(rq) == REQ_OP_WRITE ? -EIO : ret;
+			ret = 0;
+		} else {
+			cmd->ret = 0;
+			cmd->no_batch = true;
+		}
+	}
+
+	lo_rw_batch_do_completion(batch);
+}
+
+static struct loop_batch *lo_rw_batch_alloc(struct loop_cmd **cmds,
+					    int nr_cmds)
+{
+	struct loop_batch *batch;
+	struct req_iterator rq_iter;
+	struct bio_vec tmp;
+	int i, nr_bvec = 0;
+
+	for (i = 0; i < nr_cmds; i++)
+		rq_for_each_bvec(tmp, blk_mq_rq_from_pdu(cmds[i]), rq_iter)
+			nr_bvec++;
+
+	batch = kmalloc(struct_size(batch, bvec, nr_bvec), GFP_NOIO);
+	if (!batch)
+		return NULL;
+
+	/* As in lo_rw_aio(), the bios may start in the middle of a bvec */
+	batch->nr_bvec = 0;
+	batch->bytes = 0;
+	for (i = 0; i < nr_cmds; i++) {
+		struct request *rq = blk_mq_rq_from_pdu(cmds[i]);
+
+		rq_for_each_bvec(tmp, rq, rq_iter)
+			batch->bvec[batch->nr_bvec++] = tmp;
+		batch->bytes += blk_rq_bytes(rq);
+		batch->cmds[i] = cmds[i];
+	}
+	batch->nr_cmds = nr_cmds;
+
+	return batch;
+}
+
+static void lo_rw_batch(struct loop_device *lo, struct loop_batch *batch)
+{
+	struct request *rq = blk_mq_rq_from_pdu(batch->cmds[0]);
+	struct file *file = lo->lo_backing_file;
+	bool rw = req_op(rq) == REQ_OP_WRITE ? WRITE : READ;
+	struct iov_iter iter;
+	int ret;
+
+	atomic_set(&batch->ref, 2);
+
+	iov_iter_bvec(&iter, rw, batch->bvec, batch->nr_bvec, batch->bytes);
+
+	batch->iocb.ki_pos = ((loff_t) blk_rq_pos(rq) << 9) + lo->lo_offset;
+	batch->iocb.ki_filp = file;
+	batch->iocb.ki_complete = lo_rw_batch_complete;
+	batch->iocb.ki_flags = IOCB_DIRECT;
+	batch->iocb.ki_ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
+
+	trace_android_vh_loop_prepare_cmd(rq->bio, &batch->iocb);
+
+	this_cpu_add(lo->stats->batched, batch->nr_cmds);
+
+	if (rw == WRITE)
+		ret = call_write_iter(file, &batch->iocb, &iter);
+	else
+		ret = call_read_iter(file, &batch->iocb, &iter);
+
+	lo_rw_batch_do_completion(batch);
+
+	if (ret != -EIOCBQUEUED)
+		batch->iocb.ki_complete(&batch->iocb, ret, 0);
+}
+
 static int do_req_filebacked(struct loop_device *lo, struct request *rq)
 {
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
@@ -885,12 +1039,44 @@ static ssize_t loop_attr_dio_show(struct loop_device *lo, char *buf)
 	return sysfs_emit(buf, "%s\n", dio ? "1" : "0");
 }
 
+/*
+ * Requests completed, their average and maximum latency in microseconds,
+ * for reads and then writes, and the number of requests that were submitted
+ * to the backing file together with others.
+ */
+static ssize_t loop_attr_stats_show(struct loop_device *lo, char *buf)
+{
+	u64 ios[2] = {}, lat[2] = {}, max_lat[2] = {}, batched = 0;
+	int cpu, rw;
+
+	for_each_possible_cpu(cpu) {
+		struct loop_stats *stats = per_cpu_ptr(lo->stats, cpu);
+
+		for (rw = 0; rw < 2; rw++) {
+			ios[rw] += stats->ios[rw];
+			lat[rw] += stats->lat_ns[rw];
+			max_lat[rw] = max(max_lat[rw], stats->max_lat_ns[rw]);
+		}
+		batched += stats->batched;
+	}
+
+	for (rw = 0; rw < 2; rw++)
+		lat[rw] = ios[rw] ? div64_u64(lat[rw], ios[rw]) : 0;
+
+	return sysfs_emit(buf, "%llu %llu %llu %llu %llu %llu %llu\n",
+			  ios[0], div_u64(lat[0], NSEC_PER_USEC),
+			  div_u64(max_lat[0], NSEC_PER_USEC),
+			  ios[1], div_u64(lat[1], NSEC_PER_USEC),
+			  div_u64(max_lat[1], NSEC_PER_USEC), batched);
+}
+
 LOOP_ATTR_RO(backing_file);
 LOOP_ATTR_RO(offset);
 LOOP_ATTR_RO(sizelimit);
 LOOP_ATTR_RO(autoclear);
 LOOP_ATTR_RO(partscan);
 LOOP_ATTR_RO(dio);
+LOOP_ATTR_RO(stats);
 
 static struct attribute *loop_attrs[] = {
 	&loop_attr_backing_file.attr,
@@ -899,6 +1085,7 @@ static struct attribute *loop_attrs[] = {
 	&loop_attr_autoclear.attr,
 	&loop_attr_partscan.attr,
 	&loop_attr_dio.attr,
+	&loop_attr_stats.attr,
 	NULL,
 };
 
@@ -981,12 +1168,12 @@ struct loop_worker {
 	struct list_head cmd_list;
 	struct list_head idle_list;
 	struct loop_device *lo;
+	struct loop_hctx *lh;
 	struct cgroup_subsys_state *blkcg_css;
 	unsigned long last_ran_at;
 };
 
 static void loop_workfn(struct work_struct *work);
-static void loop_rootcg_workfn(struct work_struct *work);
 static void loop_free_idle_workers(struct timer_list *timer);
 
 #ifdef CONFIG_BLK_CGROUP
@@ -1001,27 +1188,33 @@ static inline int queue_on_root_worker(struct cgroup_subsys_state *css)
 }
 #endif
 
-static void loop_queue_work(struct loop_device *lo, struct loop_cmd *cmd)
+/*
+ * Workers are per blkcg and hardware queue, so that a cgroup's commands
+ * submitted through different queues are handled in parallel too.
+ */
+static void loop_queue_work(struct loop_device *lo, struct loop_hctx *lh,
+			    struct loop_cmd *cmd)
 {
-	struct rb_node **node = &(lo->worker_tree.rb_node), *parent = NULL;
+	struct rb_node **node, *parent = NULL;
 	struct loop_worker *cur_worker, *worker = NULL;
-	struct work_struct *work;
-	struct list_head *cmd_list;
-
-	spin_lock_irq(&lo->lo_work_lock);
 
 	if (queue_on_root_worker(cmd->blkcg_css))
-		goto queue_work;
+		goto queue_root;
+
+	spin_lock_irq(&lo->lo_work_lock);
 
 	node = &lo->worker_tree.rb_node;
 
 	while (*node) {
 		parent = *node;
 		cur_worker = container_of(*node, struct loop_worker, rb_node);
-		if (cur_worker->blkcg_css == cmd->blkcg_css) {
+		if (cur_worker->blkcg_css == cmd->blkcg_css &&
+		    cur_worker->lh == lh) {
 			worker = cur_worker;
 			break;
-		} else if ((long)cur_worker->blkcg_css < (long)cmd->blkcg_css) {
+		} else if ((long)cur_worker->blkcg_css < (long)cmd->blkcg_css ||
+			   (cur_worker->blkcg_css == cmd->blkcg_css &&
+			    (long)cur_worker->lh < (long)lh)) {
 			node = &(*node)->rb_left;
 		} else {
 			node = &(*node)->rb_right;
@@ -1036,11 +1229,12 @@ static void loop_queue_work(struct loop_device *lo, struct loop_cmd *cmd)
 	 * rootcg worker and issue the I/O as the rootcg
 	 */
 	if (!worker) {
+		spin_unlock_irq(&lo->lo_work_lock);
 		cmd->blkcg_css = NULL;
 		if (cmd->memcg_css)
 			css_put(cmd->memcg_css);
 		cmd->memcg_css = NULL;
-		goto queue_work;
+		goto queue_root;
 	}
 
 	worker->blkcg_css = cmd->blkcg_css;
@@ -1049,26 +1243,27 @@ static void loop_queue_work(struct loop_device *lo, struct loop_cmd *cmd)
 	INIT_LIST_HEAD(&worker->cmd_list);
 	INIT_LIST_HEAD(&worker->idle_list);
 	worker->lo = lo;
+	worker->lh = lh;
 	rb_link_node(&worker->rb_node, parent, node);
 	rb_insert_color(&worker->rb_node, &lo->worker_tree);
 queue_work:
-	if (worker) {
-		/*
-		 * We need to remove from the idle list here while
-		 * holding the lock so that the idle timer doesn't
-		 * free the worker
-		 */
-		if (!list_empty(&worker->idle_list))
-			list_del_init(&worker->idle_list);
-		work = &worker->work;
-		cmd_list = &worker->cmd_list;
-	} else {
-		work = &lo->rootcg_work;
-		cmd_list = &lo->rootcg_cmd_list;
-	}
-	list_add_tail(&cmd->list_entry, cmd_list);
-	queue_work(lo->workqueue, work);
+	/*
+	 * We need to remove from the idle list here while
+	 * holding the lock so that the idle timer doesn't
+	 * free the worker
+	 */
+	if (!list_empty(&worker->idle_list))
+		list_del_init(&worker->idle_list);
+	list_add_tail(&cmd->list_entry, &worker->cmd_list);
+	queue_work(loop_wq, &worker->work);
 	spin_unlock_irq(&lo->lo_work_lock);
+	return;
+
+queue_root:
+	spin_lock_irq(&lh->lock);
+	list_add_tail(&cmd->list_entry, &lh->cmd_list);
+	queue_work(loop_wq, &lh->work);
+	spin_unlock_irq(&lh->lock);
 }
 
 static void loop_update_rotational(struct loop_device *lo)
@@ -1207,6 +1402,7 @@ static int loop_configure(struct loop_device *lo, fmode_t mode,
 	bool partscan;
 	unsigned short bsize;
 	bool is_loop;
+	int cpu;
 
 	if (!file)
 		return -EBADF;
@@ -1259,14 +1455,8 @@ static int loop_configure(struct loop_device *lo, fmode_t mode,
 	    !file->f_op->write_iter)
 		lo->lo_flags |= LO_FLAGS_READ_ONLY;
 
-	lo->workqueue = alloc_workqueue("loop%d",
-					WQ_UNBOUND | WQ_FREEZABLE,
-					0,
-					lo->lo_number);
-	if (!lo->workqueue) {
-		error = -ENOMEM;
-		goto out_unlock;
-	}
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(lo->stats, cpu), 0, sizeof(struct loop_stats));
 
 	/* suppress uevents while reconfiguring the device */
 	dev_set_uevent_suppress(disk_to_dev(lo->lo_disk), 1);
@@ -1274,8 +1464,6 @@ static int loop_configure(struct loop_device *lo, fmode_t mode,
 	disk_force_media_change(lo->lo_disk, DISK_EVENT_MEDIA_CHANGE);
 	set_disk_ro(lo->lo_disk, (lo->lo_flags & LO_FLAGS_READ_ONLY) != 0);
 
-	INIT_WORK(&lo->rootcg_work, loop_rootcg_workfn);
-	INIT_LIST_HEAD(&lo->rootcg_cmd_list);
 	INIT_LIST_HEAD(&lo->idle_worker_list);
 	lo->worker_tree = RB_ROOT;
 	timer_setup(&lo->timer, loop_free_idle_workers,
@@ -1343,6 +1531,33 @@ out_putf:
 	return error;
 }
 
+/*
+ * Waits for the work items of a frozen device to finish.  The workqueue is
+ * shared, so it can't just be destroyed, and flushing all of it would wait
+ * for other loop devices, possibly ones stacked on top of this one.
+ */
+static void loop_flush_work(struct loop_device *lo)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct loop_worker *worker;
+	struct rb_node *node;
+	int i;
+
+	/*
+	 * With the queue frozen no worker is added.  A worker finishing here
+	 * may re-arm the idle timer, but it only frees workers that have been
+	 * idle for LOOP_IDLE_WORKER_TIMEOUT, so the tree can be walked
+	 * unlocked.
+	 */
+	del_timer_sync(&lo->timer);
+	queue_for_each_hw_ctx(lo->lo_queue, hctx, i)
+		flush_work(&((struct loop_hctx *)hctx->driver_data)->work);
+	for (node = rb_first(&lo->worker_tree); node; node = rb_next(node)) {
+		worker = rb_entry(node, struct loop_worker, rb_node);
+		flush_work(&worker->work);
+	}
+}
+
 static int __loop_clr_fd(struct loop_device *lo, bool release)
 {
 	struct file *filp = NULL;
@@ -1383,7 +1598,7 @@ static int __loop_clr_fd(struct loop_device *lo, bool release)
 	/* freeze request queue during the transition */
 	blk_mq_freeze_queue(lo->lo_queue);
 
-	destroy_workqueue(lo->workqueue);
+	loop_flush_work(lo);
 	spin_lock_irq(&lo->lo_work_lock);
 	list_for_each_entry_safe(worker, pos, &lo->idle_worker_list,
 				idle_list) {
@@ -2125,6 +2340,9 @@ module_param(max_loop, int, 0444);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, 0444);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+static unsigned int hw_queues;
+module_param(hw_queues, uint, 0444);
+MODULE_PARM_DESC(hw_queues, "Hardware queues per loop device (default: one per CPU, up to 8, at most one per possible CPU)");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -2172,6 +2390,7 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
 	struct loop_device *lo = rq->q->queuedata;
 
+	cmd->start_ns = ktime_get_ns();
 	blk_mq_start_request(rq);
 
 	if (lo->lo_state != Lo_bound)
@@ -2201,7 +2420,7 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 #endif
 	}
 #endif
-	loop_queue_work(lo, cmd);
+	loop_queue_work(lo, hctx->driver_data, cmd);
 
 	return BLK_STS_OK;
 }
@@ -2255,29 +2474,117 @@ static void loop_handle_cmd(struct loop_cmd *cmd)
 	}
 }
 
+/*
+ * blk-mq only merges bios into requests that haven't been dispatched yet.
+ * Requests that continue each other but were dispatched separately, e.g.
+ * readahead issued from several CPUs, are still submitted to the backing
+ * file as one direct I/O.
+ */
+static bool loop_can_batch(struct loop_device *lo, struct loop_cmd *prev,
+			   struct loop_cmd *next)
+{
+	struct request *prev_rq = blk_mq_rq_from_pdu(prev);
+	struct request *next_rq = blk_mq_rq_from_pdu(next);
+
+	if (!prev->use_aio || !next->use_aio || lo->transfer)
+		return false;
+	if (prev->no_batch || next->no_batch)
+		return false;
+	if (req_op(prev_rq) != req_op(next_rq))
+		return false;
+	if (req_op(prev_rq) == REQ_OP_WRITE &&
+	    (lo->lo_flags & LO_FLAGS_READ_ONLY))
+		return false;
+	if (prev->blkcg_css != next->blkcg_css ||
+	    prev->memcg_css != next->memcg_css)
+		return false;
+
+	return blk_rq_pos(prev_rq) + blk_rq_sectors(prev_rq) ==
+		blk_rq_pos(next_rq);
+}
+
+static void loop_handle_batch(struct loop_cmd **cmds, int nr_cmds)
+{
+	struct cgroup_subsys_state *cmd_blkcg_css = cmds[0]->blkcg_css;
+	struct cgroup_subsys_state *cmd_memcg_css = cmds[0]->memcg_css;
+	struct loop_device *lo = blk_mq_rq_from_pdu(cmds[0])->q->queuedata;
+	struct mem_cgroup *old_memcg = NULL;
+	struct loop_batch *batch;
+	int i;
+
+	batch = lo_rw_batch_alloc(cmds, nr_cmds);
+	if (!batch) {
+		for (i = 0; i < nr_cmds; i++)
+			loop_handle_cmd(cmds[i]);
+		return;
+	}
+
+	if (cmd_blkcg_css)
+		kthread_associate_blkcg(cmd_blkcg_css);
+	if (cmd_memcg_css)
+		old_memcg = set_active_memcg(
+			mem_cgroup_from_css(cmd_memcg_css));
+
+	/* As in loop_handle_cmd(), the cmds may be gone once this returns */
+	lo_rw_batch(lo, batch);
+
+	if (cmd_blkcg_css)
+		kthread_associate_blkcg(NULL);
+
+	if (cmd_memcg_css) {
+		set_active_memcg(old_memcg);
+		/* Every cmd held a reference */
+		for (i = 0; i < nr_cmds; i++)
+			css_put(cmd_memcg_css);
+	}
+}
+
 static void loop_set_timer(struct loop_device *lo)
 {
 	timer_reduce(&lo->timer, jiffies + LOOP_IDLE_WORKER_TIMEOUT);
 }
 
+/*
+ * @lock protects @cmd_list, and is lo_work_lock when @worker is set, as
+ * that also protects the idle worker list.
+ */
 static void loop_process_work(struct loop_worker *worker,
-			struct list_head *cmd_list, struct loop_device *lo)
+			struct list_head *cmd_list, spinlock_t *lock,
+			struct loop_device *lo)
 {
 	int orig_flags = current->flags;
+	struct loop_cmd *cmds[LOOP_MAX_BATCH];
 	struct loop_cmd *cmd;
+	struct blk_plug plug;
+	int nr_cmds;
 
 	current->flags |= PF_LOCAL_THROTTLE | PF_MEMALLOC_NOIO;
-	spin_lock_irq(&lo->lo_work_lock);
+	/* Lets the backing device merge the I/O of consecutive cmds too */
+	blk_start_plug(&plug);
+	spin_lock_irq(lock);
 	while (!list_empty(cmd_list)) {
 		cmd = container_of(
 			cmd_list->next, struct loop_cmd, list_entry);
 		list_del(cmd_list->next);
-		spin_unlock_irq(&lo->lo_work_lock);
+		cmds[0] = cmd;
+		nr_cmds = 1;
+		while (nr_cmds < LOOP_MAX_BATCH && !list_empty(cmd_list)) {
+			cmd = list_first_entry(cmd_list, struct loop_cmd,
+					       list_entry);
+			if (!loop_can_batch(lo, cmds[nr_cmds - 1], cmd))
+				break;
+			list_del(&cmd->list_entry);
+			cmds[nr_cmds++] = cmd;
+		}
+		spin_unlock_irq(lock);
 
-		loop_handle_cmd(cmd);
+		if (nr_cmds > 1)
+			loop_handle_batch(cmds, nr_cmds);
+		else
+			loop_handle_cmd(cmds[0]);
 		cond_resched();
 
-		spin_lock_irq(&lo->lo_work_lock);
+		spin_lock_irq(lock);
 	}
 
 	/*
@@ -2290,7 +2597,8 @@ static void loop_process_work(struct loop_worker *worker,
 		list_add_tail(&worker->idle_list, &lo->idle_worker_list);
 		loop_set_timer(lo);
 	}
-	spin_unlock_irq(&lo->lo_work_lock);
+	spin_unlock_irq(lock);
+	blk_finish_plug(&plug);
 	current->flags = orig_flags;
 }
 
@@ -2298,14 +2606,15 @@ static void loop_workfn(struct work_struct *work)
 {
 	struct loop_worker *worker =
 		container_of(work, struct loop_worker, work);
-	loop_process_work(worker, &worker->cmd_list, worker->lo);
+	loop_process_work(worker, &worker->cmd_list, &worker->lo->lo_work_lock,
+			  worker->lo);
 }
 
-static void loop_rootcg_workfn(struct work_struct *work)
+static void loop_hctx_workfn(struct work_struct *work)
 {
-	struct loop_device *lo =
-		container_of(work, struct loop_device, rootcg_work);
-	loop_process_work(NULL, &lo->rootcg_cmd_list, lo);
+	struct loop_hctx *lh = container_of(work, struct loop_hctx, work);
+
+	loop_process_work(NULL, &lh->cmd_list, &lh->lock, lh->lo);
 }
 
 static void loop_free_idle_workers(struct timer_list *timer)
@@ -2329,9 +2638,33 @@ static void loop_free_idle_workers(struct timer_list *timer)
 	spin_unlock_irq(&lo->lo_work_lock);
 }
 
+static int loop_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			  unsigned int hctx_idx)
+{
+	struct loop_hctx *lh;
+
+	lh = kzalloc_node(sizeof(*lh), GFP_KERNEL, hctx->numa_node);
+	if (!lh)
+		return -ENOMEM;
+
+	lh->lo = data;
+	spin_lock_init(&lh->lock);
+	INIT_WORK(&lh->work, loop_hctx_workfn);
+	INIT_LIST_HEAD(&lh->cmd_list);
+	hctx->driver_data = lh;
+	return 0;
+}
+
+static void loop_exit_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
+{
+	kfree(hctx->driver_data);
+}
+
 static const struct blk_mq_ops loop_mq_ops = {
 	.queue_rq       = loop_queue_rq,
 	.complete	= lo_complete_rq,
+	.init_hctx	= loop_init_hctx,
+	.exit_hctx	= loop_exit_hctx,
 };
 
 static int loop_add(int i)
@@ -2364,9 +2697,21 @@ static int loop_add(int i)
 	i = err;
 
 	err = -ENOMEM;
+	lo->stats = alloc_percpu(struct loop_stats);
+	if (!lo->stats)
+		goto out_free_idr;
+
+	/*
+	 * Spread a device over several hardware queues.  Each queue has its
+	 * own tags, command lists and workers, so that CPUs mapped to
+	 * different queues neither contend on them nor wait for each other's
+	 * commands to be handled.
+	 */
 	lo->tag_set.ops = &loop_mq_ops;
-	lo->tag_set.nr_hw_queues = 1;
-	lo->tag_set.queue_depth = 128;
+	lo->tag_set.nr_hw_queues = hw_queues ?
+		min_t(unsigned int, hw_queues, nr_cpu_ids) :
+		min_t(unsigned int, num_online_cpus(), LOOP_MAX_HW_QUEUES);
+	lo->tag_set.queue_depth = max(128U / lo->tag_set.nr_hw_queues, 32U);
 	lo->tag_set.numa_node = NUMA_NO_NODE;
 	lo->tag_set.cmd_size = sizeof(struct loop_cmd);
 	lo->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_STACKING |
@@ -2375,7 +2720,7 @@ static int loop_add(int i)
 
 	err = blk_mq_alloc_tag_set(&lo->tag_set);
 	if (err)
-		goto out_free_idr;
+		goto out_free_stats;
 
 	disk = lo->lo_disk = blk_mq_alloc_disk(&lo->tag_set, lo);
 	if (IS_ERR(disk)) {
@@ -2439,6 +2784,8 @@ static int loop_add(int i)
 
 out_cleanup_tags:
 	blk_mq_free_tag_set(&lo->tag_set);
+out_free_stats:
+	free_percpu(lo->stats);
 out_free_idr:
 	mutex_lock(&loop_ctl_mutex);
 	idr_remove(&loop_index_idr, i);
@@ -2455,6 +2802,7 @@ static void loop_remove(struct loop_device *lo)
 	del_gendisk(lo->lo_disk);
 	blk_cleanup_disk(lo->lo_disk);
 	blk_mq_free_tag_set(&lo->tag_set);
+	free_percpu(lo->stats);
 	mutex_lock(&loop_ctl_mutex);
 	idr_remove(&loop_index_idr, lo->lo_number);
 	mutex_unlock(&loop_ctl_mutex);
@@ -2602,9 +2950,15 @@ static int __init loop_init(void)
 		goto err_out;
 	}
 
+	loop_wq = alloc_workqueue("loop", WQ_UNBOUND | WQ_FREEZABLE, 0);
+	if (!loop_wq) {
+		err = -ENOMEM;
+		goto err_out;
+	}
+
 	err = misc_register(&loop_misc);
 	if (err < 0)
-		goto err_out;
+		goto wq_out;
 
 
 	if (__register_blkdev(LOOP_MAJOR, "loop", loop_probe)) {
@@ -2621,6 +2975,8 @@ static int __init loop_init(void)
 
 misc_out:
 	misc_deregister(&loop_misc);
+wq_out:
+	destroy_workqueue(loop_wq);
 err_out:
 	return err;
 }
@@ -2643,6 +2999,7 @@ static void __exit loop_exit(void)
 		loop_remove(lo);
 
 	idr_destroy(&loop_index_idr);
+	destroy_workqueue(loop_wq);
 }
 
 module_init(loop_init);
@@ -26,6 +26,26 @@ enum {
 
 struct loop_func_table;
 
+/* Per-CPU I/O statistics of a loop device, indexed by op_is_write() */
+struct loop_stats {
+	u64		ios[2];
+	u64		lat_ns[2];
+	u64		max_lat_ns[2];
+	u64		batched;
+};
+
+/*
+ * Commands of the root blkcg queued on one hardware queue.  Every hardware
+ * queue has its own list and work item, so that commands submitted from
+ * CPUs mapped to different queues are handled in parallel.
+ */
+struct loop_hctx {
+	struct loop_device	*lo;
+	spinlock_t		lock;		/* protects cmd_list */
+	struct work_struct	work;
+	struct list_head	cmd_list;
+};
+
 struct loop_device {
 	int		lo_number;
 	atomic_t	lo_refcnt;
@@ -55,14 +75,12 @@ struct loop_device {
 	spinlock_t		lo_lock;
 	int			lo_state;
 	spinlock_t              lo_work_lock;
-	struct workqueue_struct *workqueue;
-	struct work_struct      rootcg_work;
-	struct list_head        rootcg_cmd_list;
 	struct list_head        idle_worker_list;
 	struct rb_root          worker_tree;
 	struct timer_list       timer;
 	bool			use_dio;
 	bool			sysfs_inited;
+	struct loop_stats __percpu *stats;
 
 	struct request_queue	*lo_queue;
 	struct blk_mq_tag_set	tag_set;
@@ -74,12 +92,14 @@ struct loop_device {
 struct loop_cmd {
 	struct list_head list_entry;
 	bool use_aio; /* use AIO interface to handle I/O */
+	bool no_batch; /* resubmit alone, a batch came up short before it */
 	atomic_t ref; /* only for aio */
 	long ret;
 	struct kiocb iocb;
 	struct bio_vec *bvec;
 	struct cgroup_subsys_state *blkcg_css;
 	struct cgroup_subsys_state *memcg_css;
+	u64 start_ns;
 };
 
 /* Support for loadable transfer modules */
@@ -3728,6 +3728,10 @@ static int zram_add(void)
 
 	register_trace_android_vh_show_mem(zram_show_mem, zram);
 	register_trace_android_vh_meminfo_proc_show(zram_meminfo, zram);
+
+	zram->swap_stat.pages_stored = &zram->stats.pages_stored;
+	zram->swap_stat.compr_size = &zram->stats.compr_data_size;
+	swap_register_compressed_stat(&zram->swap_stat);
 	return device_id;
 
 out_free_idr:
@@ -3749,6 +3753,7 @@ static int zram_remove(struct zram *zram)
 
 	unregister_trace_android_vh_show_mem(zram_show_mem, zram);
 	unregister_trace_android_vh_meminfo_proc_show(zram_meminfo, zram);
+	swap_unregister_compressed_stat(&zram->swap_stat);
 
 	zram->claim = true;
 	mutex_unlock(&bdev->bd_disk->open_mutex);
@@ -19,6 +19,7 @@
 #include <linux/zsmalloc.h>
 #include <linux/crypto.h>
 #include <linux/mm.h>
+#include <linux/swap.h>
 
 #include "zcomp.h"
 
@@ -171,6 +172,7 @@ struct zram {
 	unsigned long limit_pages;
 
 	struct zram_stats stats;
+	struct swap_compressed_stat swap_stat;
 	/*
 	 * This is the limit on amount of *uncompressed* worth of data
 	 * we can store in a disk.
@@ -0,0 +1,399 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * wakeup.c - wakeup source aware cpuidle governor
+ *
+ * On phones a large share of the idle periods is ended by periodic device
+ * interrupts (modem and Wi-Fi DMA, touch, display vsync) rather than by
+ * timers. A governor that only looks at the next timer picks a deep state,
+ * and one that only looks at recent idle durations cannot tell which of
+ * the interleaved periodic sources will fire next.
+ *
+ * This governor keeps, per CPU, the period of the interrupts handled on it
+ * and predicts the end of the idle period as the earliest of the next
+ * timer, the next occurrence of any interrupt that has been firing at a
+ * stable period, and the next wakeup hinted by a driver through
+ * cpuidle_wakeup_hint(). Predictions that are not timer based keep the
+ * tick running, so a wrong guess costs at most one tick of shallow idle,
+ * never wakeup latency. Interrupts are only tracked while the governor is
+ * in use.
+ *
+ * How often the predictions are wrong is reported per CPU and idle state
+ * in debugfs, in cpuidle_wakeup/mispredict.
+ */
+
+#define pr_fmt(fmt) "cpuidle wakeup: " fmt
+
+#include <linux/cpuidle.h>
+#include <linux/debugfs.h>
+#include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/sched/clock.h>
+#include <linux/tick.h>
+#include <trace/events/irq.h>
+
+/* Interrupts tracked per CPU */
+#define WAKEUP_IRQ_SLOTS	8
+/* Consecutive matching intervals before an interrupt is trusted */
+#define WAKEUP_MIN_HITS		3
+#define WAKEUP_MAX_HITS		16
+/* Intervals within period / 2^WAKEUP_TOLERANCE_SHIFT are a match */
+#define WAKEUP_TOLERANCE_SHIFT	3
+/* Longer periods are left to the timer based prediction */
+#define WAKEUP_MAX_PERIOD_NS	NSEC_PER_SEC
+/* A source that skipped more occurrences than this is not trusted */
+#define WAKEUP_MAX_MISSED	2
+
+enum wakeup_source_type {
+	WAKEUP_SRC_TIMER,
+	WAKEUP_SRC_IRQ,
+	WAKEUP_SRC_HINT,
+};
+
+/**
+ * struct wakeup_irq - periodic behaviour of one interrupt on a CPU
+ * @irq:	interrupt number, 0 for an unused slot
+ * @last_ns:	local_clock() at its last occurrence
+ * @period_ns:	running average of the interval between occurrences
+ * @hits:	number of consecutive intervals that matched @period_ns
+ */
+struct wakeup_irq {
+	int irq;
+	u64 last_ns;
+	u64 period_ns;
+	unsigned int hits;
+};
+
+/**
+ * struct wakeup_gov_cpu - per-CPU governor state
+ * @irqs:	interrupts recently handled on the CPU
+ * @hint_ns:	local_clock() time of the next wakeup hinted by a driver
+ * @predicted_ns:	predicted duration of the current idle period
+ * @source:	what @predicted_ns is based on
+ * @slot:	index in @irqs of the interrupt the prediction is based on
+ * @mispredict_early:	per state, woken up well before the prediction
+ * @mispredict_late:	per state, slept well past the prediction while a
+ *			deeper state would have fit
+ */
+struct wakeup_gov_cpu {
+	struct wakeup_irq irqs[WAKEUP_IRQ_SLOTS];
+	u64 hint_ns;
+	u64 predicted_ns;
+	enum wakeup_source_type source;
+	int slot;
+	u64 mispredict_early[CPUIDLE_STATE_MAX];
+	u64 mispredict_late[CPUIDLE_STATE_MAX];
+};
+
+static DEFINE_PER_CPU(struct wakeup_gov_cpu, wakeup_gov_cpus);
+
+/* Devices the governor is enabled on, the tracepoint is attached if any */
+static DEFINE_MUTEX(wakeup_lock);
+static unsigned int wakeup_nr_devices;
+
+static void wakeup_irq_entry(void *unused, int irq, struct irqaction *action)
+{
+	struct wakeup_gov_cpu *data = this_cpu_ptr(&wakeup_gov_cpus);
+	struct wakeup_irq *wi, *victim = &data->irqs[0];
+	u64 now = local_clock(), interval;
+	int i;
+
+	for (i = 0; i < WAKEUP_IRQ_SLOTS; i++) {
+		wi = &data->irqs[i];
+		if (wi->irq == irq)
+			goto found;
+		/* Replace the least periodic, then the least recent, slot */
+		if (wi->hits < victim->hits ||
+		    (wi->hits == victim->hits && wi->last_ns < victim->last_ns))
+			victim = wi;
+	}
+
+	victim->irq = irq;
+	victim->last_ns = now;
+	victim->period_ns = 0;
+	victim->hits = 0;
+	return;
+
+found:
+	interval = now - wi->last_ns;
+	wi->last_ns = now;
+
+	if (interval > WAKEUP_MAX_PERIOD_NS) {
+		wi->period_ns = 0;
+		wi->hits = 0;
+		return;
+	}
+
+	if (wi->period_ns &&
+	    interval + (wi->period_ns >> WAKEUP_TOLERANCE_SHIFT) >= wi->period_ns &&
+	    interval <= wi->period_ns + (wi->period_ns >> WAKEUP_TOLERANCE_SHIFT)) {
+		wi->period_ns = (7 * wi->period_ns + interval) / 8;
+		if (wi->hits < WAKEUP_MAX_HITS)
+			wi->hits++;
+	} else {
+		wi->period_ns = interval;
+		wi->hits = 0;
+	}
+}
+
+/**
+ * cpuidle_wakeup_hint() - tell the idle governor when a CPU will be woken
+ * @cpu:	CPU that will handle the wakeup
+ * @delay_ns:	time from now until the expected wakeup
+ *
+ * Drivers that know when their next interrupt will arrive, e.g. a modem
+ * whose DMA completes at a steady rate, can call this so that @cpu does
+ * not enter an idle state it would have to leave right away. Only the
+ * latest hint per CPU is kept, and it is ignored once it has passed.
+ */
+void cpuidle_wakeup_hint(int cpu, u64 delay_ns)
+{
+	WRITE_ONCE(per_cpu(wakeup_gov_cpus, cpu).hint_ns,
+		   local_clock() + delay_ns);
+}
+EXPORT_SYMBOL_GPL(cpuidle_wakeup_hint);
+
+/*
+ * Time until the earliest expected occurrence of a periodic interrupt or
+ * of a hinted wakeup, U64_MAX if there is none.
+ */
+static u64 wakeup_predict(struct wakeup_gov_cpu *data, u64 now)
+{
+	u64 best = U64_MAX, hint;
+	int i;
+
+	data->source = WAKEUP_SRC_TIMER;
+	data->slot = -1;
+
+	for (i = 0; i < WAKEUP_IRQ_SLOTS; i++) {
+		struct wakeup_irq *wi = &data->irqs[i];
+		u64 n, next;
+
+		if (!wi->irq || wi->hits < WAKEUP_MIN_HITS || !wi->period_ns)
+			continue;
+
+		n = div64_u64(now - wi->last_ns, wi->period_ns) + 1;
+		if (n > WAKEUP_MAX_MISSED + 1)
+			continue;
+
+		next = wi->last_ns + n * wi->period_ns;
+		if (next - now < best) {
+			best = next - now;
+			data->source = WAKEUP_SRC_IRQ;
+			data->slot = i;
+		}
+	}
+
+	hint = READ_ONCE(data->hint_ns);
+	if (hint > now && hint - now < best) {
+		best = hint - now;
+		data->source = WAKEUP_SRC_HINT;
+		data->slot = -1;
+	}
+
+	return best;
+}
+
+/**
+ * wakeup_select() - select the next idle state to enter
+ * @drv: cpuidle driver containing state data
+ * @dev: the CPU
+ * @stop_tick: indication on whether or not to stop the tick
+ */
+static int wakeup_select(struct cpuidle_driver *drv, struct cpuidle_device *dev,
+			 bool *stop_tick)
+{
+	struct wakeup_gov_cpu *data = this_cpu_ptr(&wakeup_gov_cpus);
+	s64 latency_req = cpuidle_governor_latency_req(dev->cpu);
+	ktime_t delta_tick;
+	s64 predicted_ns, delta_next;
+	int i, idx = -1;
+
+	delta_next = tick_nohz_get_sleep_length(&delta_tick);
+	predicted_ns = min_t(u64, delta_next,
+			     wakeup_predict(data, local_clock()));
+	if (predicted_ns == delta_next)
+		data->source = WAKEUP_SRC_TIMER;
+	data->predicted_ns = predicted_ns;
+
+	if (unlikely(drv->state_count <= 1 || latency_req == 0)) {
+		*stop_tick = !(drv->states[0].flags & CPUIDLE_FLAG_POLLING);
+		return 0;
+	}
+
+	for (i = 0; i < drv->state_count; i++) {
+		struct cpuidle_state *s = &drv->states[i];
+
+		if (dev->states_usage[i].disable)
+			continue;
+
+		if (idx < 0)
+			idx = i;
+
+		if (s->target_residency_ns > predicted_ns ||
+		    s->exit_latency_ns > latency_req)
+			break;
+
+		idx = i;
+	}
+
+	if (idx < 0)
+		idx = 0;
+
+	/*
+	 * Keep the tick running when the wakeup is expected before it, or is
+	 * only expected from a non-timer source, so that a wrong prediction
+	 * is corrected on the next tick. If the tick is kept, the state must
+	 * not be deeper than the time left until it.
+	 */
+	if (((drv->states[idx].flags & CPUIDLE_FLAG_POLLING) ||
+	     predicted_ns < TICK_NSEC || data->source != WAKEUP_SRC_TIMER) &&
+	    !tick_nohz_tick_stopped()) {
+		*stop_tick = false;
+
+		if (idx > 0 && drv->states[idx].target_residency_ns > delta_tick) {
+			for (i = idx - 1; i >= 0; i--) {
+				if (dev->states_usage[i].disable)
+					continue;
+
+				idx = i;
+				if (drv->states[i].target_residency_ns <= delta_tick)
+					break;
+			}
+		}
+	}
+
+	return idx;
+}
+
+/**
+ * wakeup_reflect() - account for the outcome of the last idle period
+ * @dev: the CPU
+ * @index: the index of the state that was entered
+ *
+ * A wakeup well before the predicted time is an early mispredict. Sleeping
+ * well past it is a late one if a deeper state would have fit, and then
+ * the interrupt the prediction was based on stops being trusted until it
+ * shows a stable period again.
+ */
+static void wakeup_reflect(struct cpuidle_device *dev, int index)
+{
+	struct wakeup_gov_cpu *data = this_cpu_ptr(&wakeup_gov_cpus);
+	struct cpuidle_driver *drv = cpuidle_get_cpu_driver(dev);
+	u64 measured = dev->last_residency_ns;
+	u64 predicted = data->predicted_ns;
+	u64 margin = predicted >> WAKEUP_TOLERANCE_SHIFT;
+
+	if (index < 0 || !drv)
+		return;
+
+	if (measured + margin < predicted) {
+		data->mispredict_early[index]++;
+	} else if (measured > predicted + margin &&
+		   index + 1 < drv->state_count &&
+		   measured >= drv->states[index + 1].target_residency_ns) {
+		data->mispredict_late[index]++;
+		if (data->source == WAKEUP_SRC_IRQ && data->slot >= 0)
+			data->irqs[data->slot].hits = 0;
+	}
+}
+
+/**
+ * wakeup_enable_device() - initialize the governor's data for the CPU
+ * @drv: cpuidle driver
+ * @dev: the CPU
+ *
+ * The first CPU the governor is enabled on starts the interrupt tracking.
+ */
+static int wakeup_enable_device(struct cpuidle_driver *drv,
+				struct cpuidle_device *dev)
+{
+	struct wakeup_gov_cpu *data = &per_cpu(wakeup_gov_cpus, dev->cpu);
+	int ret = 0;
+
+	memset(data, 0, sizeof(*data));
+	data->slot = -1;
+
+	mutex_lock(&wakeup_lock);
+	if (!wakeup_nr_devices) {
+		ret = register_trace_irq_handler_entry(wakeup_irq_entry, NULL);
+		if (ret)
+			pr_err("failed to track interrupts: %d\n", ret);
+	}
+	if (!ret)
+		wakeup_nr_devices++;
+	mutex_unlock(&wakeup_lock);
+
+	return ret;
+}
+
+/**
+ * wakeup_disable_device() - stop using the governor on the CPU
+ * @drv: cpuidle driver
+ * @dev: the CPU
+ *
+ * The last CPU the governor is disabled on stops the interrupt tracking.
+ */
+static void wakeup_disable_device(struct cpuidle_driver *drv,
+				  struct cpuidle_device *dev)
+{
+	mutex_lock(&wakeup_lock);
+	if (!WARN_ON(!wakeup_nr_devices) && !--wakeup_nr_devices)
+		unregister_trace_irq_handler_entry(wakeup_irq_entry, NULL);
+	mutex_unlock(&wakeup_lock);
+}
+
+static int wakeup_mispredict_show(struct seq_file *m, void *unused)
+{
+	struct cpuidle_driver *drv;
+	struct wakeup_gov_cpu *data;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		drv = cpuidle_get_cpu_driver(per_cpu(cpuidle_devices, cpu));
+		if (!drv)
+			continue;
+
+		data = &per_cpu(wakeup_gov_cpus, cpu);
+		seq_printf(m, "cpu%d:", cpu);
+		for (i = 0; i < drv->state_count; i++)
+			seq_printf(m, " %s %llu/%llu", drv->states[i].name,
+				   READ_ONCE(data->mispredict_early[i]),
+				   READ_ONCE(data->mispredict_late[i]));
+		seq_putc(m, '\n');
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wakeup_mispredict);
+
+static struct cpuidle_governor wakeup_governor = {
+	.name =		"wakeup",
+	.rating =	15,
+	.enable =	wakeup_enable_device,
+	.disable =	wakeup_disable_device,
+	.select =	wakeup_select,
+	.reflect =	wakeup_reflect,
+};
+
+static int __init init_wakeup(void)
+{
+	struct dentry *dir;
+	int ret;
+
+	ret = cpuidle_register_governor(&wakeup_governor);
+	if (ret)
+		return ret;
+
+	/* early/late counts, reset when the governor is enabled on the CPU */
+	dir = debugfs_create_dir("cpuidle_wakeup", NULL);
+	debugfs_create_file("mispredict", 0444, dir, NULL,
+			    &wakeup_mispredict_fops);
+
+	return 0;
+}
+
+postcore_initcall(init_wakeup);
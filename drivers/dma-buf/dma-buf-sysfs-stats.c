@@ -5,20 +5,33 @@
  * Copyright (C) 2021 Google LLC.
  */
 
+#include <linux/bsearch.h>
 #include <linux/dma-buf.h>
 #include <linux/dma-resv.h>
+#include <linux/fdtable.h>
 #include <linux/kobject.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
 #include <linux/printk.h>
+#include <linux/proc_fs.h>
+#include <linux/sched/signal.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/sysfs.h>
 #include <linux/workqueue.h>
 
+#include <uapi/linux/dma-buf.h>
+
 #include <trace/hooks/dmabuf.h>
 
 #include "dma-buf-sysfs-stats.h"
 
 #define to_dma_buf_entry_from_kobj(x) container_of(x, struct dma_buf_sysfs_entry, kobj)
 
+static bool per_buffer = IS_ENABLED(CONFIG_DMABUF_SYSFS_STATS_PER_BUFFER);
+module_param(per_buffer, bool, 0444);
+MODULE_PARM_DESC(per_buffer, "Create a sysfs directory for every dma-buf");
+
 /**
  * DOC: overview
  *
@@ -49,6 +62,19 @@
  * or other important events to provide a snapshot of DMA-BUF usage.
  * It can also be collected periodically by telemetry to monitor various metrics.
  *
+ * Creating a kobject for every buffer is expensive for pipelines which export
+ * and release buffers at a high rate, and readers walking the tree pay one
+ * open and read per attribute. The per-buffer directories can be disabled
+ * with ``CONFIG_DMABUF_SYSFS_STATS_PER_BUFFER=n`` or the
+ * ``dma_buf_sysfs_stats.per_buffer=0`` boot parameter.
+ *
+ * ``/proc/dmabuf_stats`` provides the same information for all buffers in one
+ * read, whether or not the per-buffer directories exist. The snapshot is
+ * taken when the file is opened and consists of a struct dma_buf_stats_header
+ * followed by one struct dma_buf_stats_record per buffer, which also carries
+ * the number of attached devices and the processes holding an fd of the
+ * buffer. See include/uapi/linux/dma-buf.h.
+ *
  * Detailed documentation about the interface is present in
  * Documentation/ABI/testing/sysfs-kernel-dmabuf-buffers.
  */
@@ -148,6 +174,184 @@ static const struct kset_uevent_ops dmabuf_sysfs_no_uevent_ops = {
 	.filter = dmabuf_sysfs_uevent_filter,
 };
 
+struct dma_buf_stats_snapshot {
+	size_t len;
+	struct dma_buf_stats_header hdr;
+	struct dma_buf_stats_record rec[];
+};
+
+struct dma_buf_stats_fill {
+	struct dma_buf_stats_snapshot *snap;
+	u32 max;
+};
+
+struct dma_buf_stats_owner {
+	struct dma_buf_stats_snapshot *snap;
+	pid_t *last_pid;
+	pid_t pid;
+};
+
+static int dma_buf_stats_count(const struct dma_buf *dmabuf, void *private)
+{
+	(*(u32 *)private)++;
+
+	return 0;
+}
+
+static int dma_buf_stats_fill_one(const struct dma_buf *dmabuf, void *private)
+{
+	struct dma_buf_stats_fill *fill = private;
+	struct dma_buf_stats_record *rec;
+	struct dma_buf_attachment *attach;
+	int ret;
+
+	if (fill->snap->hdr.nr_records == fill->max)
+		return 0;
+
+	ret = dma_resv_lock_interruptible(dmabuf->resv, NULL);
+	if (ret)
+		return ret;
+
+	rec = &fill->snap->rec[fill->snap->hdr.nr_records++];
+	rec->inode = file_inode(dmabuf->file)->i_ino;
+	rec->size = dmabuf->size;
+	list_for_each_entry(attach, &dmabuf->attachments, node)
+		rec->attach_count++;
+	dma_resv_unlock(dmabuf->resv);
+
+	if (dmabuf->exp_name)
+		strscpy(rec->exp_name, dmabuf->exp_name, sizeof(rec->exp_name));
+
+	return 0;
+}
+
+static int dma_buf_stats_cmp_inode(const void *a, const void *b)
+{
+	const struct dma_buf_stats_record *ra = a, *rb = b;
+
+	if (ra->inode == rb->inode)
+		return 0;
+
+	return ra->inode < rb->inode ? -1 : 1;
+}
+
+static int dma_buf_stats_match_fd(const void *p, struct file *file, unsigned int fd)
+{
+	struct dma_buf_stats_owner *owner = (void *)p;
+	struct dma_buf_stats_snapshot *snap = owner->snap;
+	struct dma_buf_stats_record key, *rec;
+	size_t idx;
+
+	if (!is_dma_buf_file(file))
+		return 0;
+
+	key.inode = file_inode(file)->i_ino;
+	rec = bsearch(&key, snap->rec, snap->hdr.nr_records, sizeof(*rec),
+		      dma_buf_stats_cmp_inode);
+	if (!rec)
+		return 0;
+
+	/* Count a process once however many fds of the buffer it holds */
+	idx = rec - snap->rec;
+	if (owner->last_pid[idx] == owner->pid)
+		return 0;
+	owner->last_pid[idx] = owner->pid;
+
+	if (rec->nr_pids < DMA_BUF_STATS_MAX_PIDS)
+		rec->pids[rec->nr_pids] = owner->pid;
+	rec->nr_pids++;
+
+	return 0;
+}
+
+static void dma_buf_stats_find_owners(struct dma_buf_stats_snapshot *snap)
+{
+	struct dma_buf_stats_owner owner = { .snap = snap };
+	struct task_struct *p;
+
+	if (!snap->hdr.nr_records)
+		return;
+
+	owner.last_pid = kvcalloc(snap->hdr.nr_records, sizeof(pid_t), GFP_KERNEL);
+	if (!owner.last_pid)
+		return;
+
+	rcu_read_lock();
+	for_each_process(p) {
+		if (p->flags & PF_KTHREAD)
+			continue;
+
+		task_lock(p);
+		if (p->files) {
+			owner.pid = task_tgid_nr(p);
+			iterate_fd(p->files, 0, dma_buf_stats_match_fd, &owner);
+		}
+		task_unlock(p);
+	}
+	rcu_read_unlock();
+
+	kvfree(owner.last_pid);
+}
+
+static int dma_buf_stats_open(struct inode *inode, struct file *file)
+{
+	struct dma_buf_stats_snapshot *snap;
+	struct dma_buf_stats_fill fill = { };
+	u32 count = 0;
+	int ret;
+
+	ret = get_each_dmabuf(dma_buf_stats_count, &count);
+	if (ret)
+		return ret;
+
+	/* Leave room for buffers exported between the two walks */
+	fill.max = count + count / 8 + 16;
+	snap = kvzalloc(struct_size(snap, rec, fill.max), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	fill.snap = snap;
+	ret = get_each_dmabuf(dma_buf_stats_fill_one, &fill);
+	if (ret) {
+		kvfree(snap);
+		return ret;
+	}
+
+	sort(snap->rec, snap->hdr.nr_records, sizeof(snap->rec[0]),
+	     dma_buf_stats_cmp_inode, NULL);
+	dma_buf_stats_find_owners(snap);
+
+	snap->hdr.version = DMA_BUF_STATS_VERSION;
+	snap->hdr.record_size = sizeof(snap->rec[0]);
+	snap->len = sizeof(snap->hdr) +
+		    snap->hdr.nr_records * sizeof(snap->rec[0]);
+	file->private_data = snap;
+
+	return 0;
+}
+
+static ssize_t dma_buf_stats_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct dma_buf_stats_snapshot *snap = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, &snap->hdr, snap->len);
+}
+
+static int dma_buf_stats_release(struct inode *inode, struct file *file)
+{
+	kvfree(file->private_data);
+
+	return 0;
+}
+
+static const struct proc_ops dma_buf_stats_proc_ops = {
+	.proc_open	= dma_buf_stats_open,
+	.proc_read	= dma_buf_stats_read,
+	.proc_lseek	= default_llseek,
+	.proc_release	= dma_buf_stats_release,
+};
+
 static struct kset *dma_buf_stats_kset;
 static struct kset *dma_buf_per_buffer_stats_kset;
 int dma_buf_init_sysfs_statistics(void)
@@ -166,11 +370,15 @@ int dma_buf_init_sysfs_statistics(void)
 		return -ENOMEM;
 	}
 
+	if (!proc_create("dmabuf_stats", 0440, NULL, &dma_buf_stats_proc_ops))
+		pr_warn("failed to create /proc/dmabuf_stats\n");
+
 	return 0;
 }
 
 void dma_buf_uninit_sysfs_statistics(void)
 {
+	remove_proc_entry("dmabuf_stats", NULL);
 	kset_unregister(dma_buf_per_buffer_stats_kset);
 	kset_unregister(dma_buf_stats_kset);
 }
@@ -224,6 +432,9 @@ int dma_buf_stats_setup(struct dma_buf *dmabuf)
 		return -EINVAL;
 	}
 
+	if (!per_buffer)
+		return 0;
+
 	sysfs_entry = kmalloc(sizeof(struct dma_buf_sysfs_entry), GFP_KERNEL);
 	if (!sysfs_entry)
 		return -ENOMEM;
@@ -23,9 +23,46 @@
 #include <linux/major.h>
 #include <linux/device.h>
 #include <linux/cdev.h>
+#include <linux/debugfs.h>
 #include "input-compat.h"
 #include <trace/hooks/evdev.h>
 
+#if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
+#define EVDEV_IB_MAX_EDGES	16
+#define EVDEV_IB_MAX_SLOTS	BITS_PER_LONG
+#define EVDEV_IB_MOTION_IDLE_MS	100
+
+/* One change of the boost state of a device */
+struct evdev_ib_edge {
+	u16 type;
+	u16 code;
+	s32 value;
+	int slot;	/* MT slot of a contact change, -1 otherwise */
+};
+
+/*
+ * Boost state of a device. Events are run through it and only real changes
+ * are recorded: a key pressed or released, a contact starting or ending in
+ * an MT slot, and relative motion starting or stopping. One delayed work per
+ * device delivers the recorded changes to the input booster. While the
+ * device is in motion the work is armed again to notice the end of it.
+ */
+struct evdev_ib {
+	struct delayed_work work;
+	spinlock_t lock;	/* protects the fields below */
+	bool queued;		/* an immediate run of @work is pending */
+	int slot;		/* current MT slot */
+	unsigned long contacts;	/* slots with a contact */
+	int ids[EVDEV_IB_MAX_SLOTS];	/* tracking IDs of the contacts */
+	bool moving;
+	u16 motion_code;	/* REL code that started the motion */
+	ktime_t last_motion;
+	unsigned int nr_edges;
+	ktime_t first_edge;	/* event time of the oldest pending edge */
+	struct evdev_ib_edge edges[EVDEV_IB_MAX_EDGES];
+};
+#endif
+
 struct evdev {
 	int open;
 	struct input_handle handle;
@@ -36,7 +73,32 @@ struct evdev {
 	struct device dev;
 	struct cdev cdev;
 	bool exist;
+#if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
+	struct evdev_ib ib;
+#endif
+#if IS_ENABLED(CONFIG_INPUT_EVDEV_LATENCY_STATS)
+	struct dentry *debugfs;
+#endif
+};
+
+#if IS_ENABLED(CONFIG_INPUT_EVDEV_LATENCY_STATS)
+/* log2 buckets of read latency: <1us, <2us, ... <16ms, >=16ms */
+#define EVDEV_LAT_BUCKETS	16
+
+/* Per client statistics, protected by the client's buffer_lock */
+struct evdev_client_stats {
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	u64 events;		/* events read */
+	u64 lat_sum;		/* from event time to read, in us */
+	u32 lat_max;
+	unsigned long lat_hist[EVDEV_LAT_BUCKETS];
+	unsigned int max_used;	/* buffer high-water mark */
+	unsigned long overflows;
+	unsigned long lost;	/* unread events dropped by overflows */
+	unsigned long syn_dropped;
 };
+#endif
 
 struct evdev_client {
 	unsigned int head;
@@ -50,18 +112,28 @@ struct evdev_client {
 	enum input_clock_type clk_type;
 	bool revoked;
 	unsigned long *evmasks[EV_CNT];
+#if IS_ENABLED(CONFIG_INPUT_EVDEV_LATENCY_STATS)
+	struct evdev_client_stats stats;
+#endif
 	unsigned int bufsize;
 	struct input_event buffer[];
 };
 
+static struct dentry *evdev_debugfs_root;
+
 #if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
 #include <linux/notifier.h>
 #include <linux/input/input_booster.h>
 
 struct workqueue_struct *ib_unbound_highwq;
-spinlock_t ib_idx_lock;
-struct ib_event_work *ib_evt_work;
-int ib_work_cnt;
+
+static struct {
+	atomic64_t edges;	/* state changes seen */
+	atomic64_t overflows;	/* state changes dropped before delivery */
+	atomic64_t signals;	/* notifier chain calls */
+	atomic64_t lat_sum;	/* event to notifier call, in ns */
+	atomic64_t lat_max;
+} ib_stats;
 
 static BLOCKING_NOTIFIER_HEAD(ib_notifier_list);
 
@@ -171,6 +243,110 @@ static void __evdev_flush_queue(struct evdev_client *client, unsigned int type)
 	client->head = head;
 }
 
+#if IS_ENABLED(CONFIG_INPUT_EVDEV_LATENCY_STATS)
+static ktime_t evdev_client_now(struct evdev_client *client)
+{
+	switch (client->clk_type) {
+	case INPUT_CLK_REAL:
+		return ktime_get_real();
+	case INPUT_CLK_BOOT:
+		return ktime_get_boottime();
+	default:
+		return ktime_get();
+	}
+}
+
+/* Called with buffer_lock held after an event was queued */
+static void evdev_stats_queued(struct evdev_client *client, bool overflow)
+{
+	struct evdev_client_stats *stats = &client->stats;
+	unsigned int used;
+
+	if (unlikely(overflow)) {
+		stats->overflows++;
+		stats->syn_dropped++;
+		/* everything but SYN_DROPPED and the new event */
+		stats->lost += client->bufsize - 1;
+	}
+
+	used = (client->head - client->tail) & (client->bufsize - 1);
+	if (used > stats->max_used)
+		stats->max_used = used;
+}
+
+/* Called with buffer_lock held for every event handed to the reader */
+static void evdev_stats_read(struct evdev_client *client,
+			     const struct input_event *event, ktime_t now)
+{
+	struct evdev_client_stats *stats = &client->stats;
+	ktime_t stamp = ktime_set(event->input_event_sec,
+				  event->input_event_usec * NSEC_PER_USEC);
+	s64 lat = ktime_us_delta(now, stamp);
+	u32 lat_us = clamp_t(s64, lat, 0, U32_MAX);
+
+	stats->events++;
+	stats->lat_sum += lat_us;
+	if (lat_us > stats->lat_max)
+		stats->lat_max = lat_us;
+	stats->lat_hist[min_t(int, fls(lat_us), EVDEV_LAT_BUCKETS - 1)]++;
+}
+
+static int evdev_stats_show(struct seq_file *m, void *unused)
+{
+	struct evdev *evdev = m->private;
+	struct evdev_client_stats stats;
+	struct evdev_client *client;
+	unsigned int bufsize;
+	int i;
+
+	seq_printf(m, "%s\n", evdev->handle.dev->name);
+
+	spin_lock(&evdev->client_lock);
+	list_for_each_entry(client, &evdev->client_list, node) {
+		spin_lock_irq(&client->buffer_lock);
+		stats = client->stats;
+		spin_unlock_irq(&client->buffer_lock);
+		bufsize = client->bufsize;
+
+		seq_printf(m, "client %d (%s):\n", stats.pid, stats.comm);
+		seq_printf(m, "  events: %llu\n", stats.events);
+		seq_printf(m, "  avg_latency_us: %llu\n", stats.events ?
+			   div64_u64(stats.lat_sum, stats.events) : 0);
+		seq_printf(m, "  max_latency_us: %u\n", stats.lat_max);
+		seq_puts(m, "  latency_us:");
+		for (i = 0; i < EVDEV_LAT_BUCKETS - 1; i++)
+			seq_printf(m, " <%u:%lu", 1U << i, stats.lat_hist[i]);
+		seq_printf(m, " >=%u:%lu\n", 1U << (EVDEV_LAT_BUCKETS - 2),
+			   stats.lat_hist[EVDEV_LAT_BUCKETS - 1]);
+		seq_printf(m, "  buffer: %u/%u max used\n", stats.max_used,
+			   bufsize);
+		seq_printf(m, "  overflows: %lu (%lu events lost)\n",
+			   stats.overflows, stats.lost);
+		seq_printf(m, "  syn_dropped: %lu\n", stats.syn_dropped);
+	}
+	spin_unlock(&evdev->client_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(evdev_stats);
+#else
+static inline ktime_t evdev_client_now(struct evdev_client *client)
+{
+	return 0;
+}
+
+static inline void evdev_stats_queued(struct evdev_client *client,
+				      bool overflow)
+{
+}
+
+static inline void evdev_stats_read(struct evdev_client *client,
+				    const struct input_event *event,
+				    ktime_t now)
+{
+}
+#endif
+
 static void __evdev_queue_syn_dropped(struct evdev_client *client)
 {
 	ktime_t *ev_time = input_get_timestamp(client->evdev->handle.dev);
@@ -191,6 +367,10 @@ static void __evdev_queue_syn_dropped(struct evdev_client *client)
 		client->tail = (client->head - 1) & (client->bufsize - 1);
 		client->packet_head = client->tail;
 	}
+
+#if IS_ENABLED(CONFIG_INPUT_EVDEV_LATENCY_STATS)
+	client->stats.syn_dropped++;
+#endif
 }
 
 static void evdev_queue_syn_dropped(struct evdev_client *client)
@@ -245,13 +425,16 @@ static int evdev_set_clk_type(struct evdev_client *client, unsigned int clkid)
 static void __pass_event(struct evdev_client *client,
 			 const struct input_event *event)
 {
+	bool overflow;
+
 	trace_android_vh_pass_input_event(client->head, client->tail, client->bufsize,
 		event->type, event->code, event->value);
 
 	client->buffer[client->head++] = *event;
 	client->head &= client->bufsize - 1;
 
-	if (unlikely(client->head == client->tail)) {
+	overflow = client->head == client->tail;
+	if (unlikely(overflow)) {
 		/*
 		 * This effectively "drops" all unconsumed events, leaving
 		 * EV_SYN/SYN_DROPPED plus the newest event in the queue.
@@ -269,6 +452,8 @@ static void __pass_event(struct evdev_client *client,
 		client->packet_head = client->tail;
 	}
 
+	evdev_stats_queued(client, overflow);
+
 	if (event->type == EV_SYN && event->code == SYN_REPORT) {
 		client->packet_head = client->head;
 		kill_fasync(&client->fasync, SIGIO, POLL_IN);
@@ -320,15 +505,207 @@ static void evdev_pass_values(struct evdev_client *client,
 }
 
 #if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
-static void evdev_ib_trigger(struct work_struct* work)
+/* Called with ib->lock held */
+static void evdev_ib_record(struct evdev_ib *ib, u16 type, u16 code,
+			    s32 value, int slot, ktime_t ev_time)
 {
-	struct ib_event_work *ib_work = container_of(work, struct ib_event_work, evdev_work);
+	struct evdev_ib_edge *edge;
+
+	if (ib->nr_edges == EVDEV_IB_MAX_EDGES) {
+		/* Keep the newest changes, the booster acts on the current state */
+		memmove(ib->edges, ib->edges + 1,
+			sizeof(ib->edges[0]) * (EVDEV_IB_MAX_EDGES - 1));
+		ib->nr_edges--;
+		atomic64_inc(&ib_stats.overflows);
+	}
+	if (!ib->nr_edges)
+		ib->first_edge = ev_time;
+
+	edge = &ib->edges[ib->nr_edges++];
+	edge->type = type;
+	edge->code = code;
+	edge->value = value;
+	edge->slot = slot;
+	atomic64_inc(&ib_stats.edges);
+}
+
+/* Track the contact of the current slot, returns true if it changed */
+static bool evdev_ib_contact(struct evdev_ib *ib, int id, ktime_t ev_time)
+{
+	int slot = ib->slot;
+	bool active;
+
+	if (slot < 0 || slot >= EVDEV_IB_MAX_SLOTS)
+		return false;
+
+	active = test_bit(slot, &ib->contacts);
+	if (active == (id >= 0) && (!active || ib->ids[slot] == id))
+		return false;
+
+	/* Ended, or replaced by a new contact without a release */
+	if (active) {
+		__clear_bit(slot, &ib->contacts);
+		evdev_ib_record(ib, EV_ABS, ABS_MT_TRACKING_ID, -1, slot,
+				ev_time);
+	}
+	if (id >= 0) {
+		__set_bit(slot, &ib->contacts);
+		ib->ids[slot] = id;
+		evdev_ib_record(ib, EV_ABS, ABS_MT_TRACKING_ID, id, slot,
+				ev_time);
+	}
+
+	return true;
+}
+
+static void evdev_ib_trigger(struct work_struct *work)
+{
+	struct evdev_ib *ib = container_of(to_delayed_work(work),
+					   struct evdev_ib, work);
+	struct evdev_ib_edge edges[EVDEV_IB_MAX_EDGES];
+	struct input_value vals[2 * EVDEV_IB_MAX_EDGES + 1];
 	struct ib_event_data ib_data;
+	unsigned int i, nr_edges, count = 0;
+	unsigned long rearm = 0;
+	ktime_t now = ktime_get();
+	ktime_t first_edge;
+	s64 lat, max;
+
+	spin_lock_irq(&ib->lock);
+	ib->queued = false;
+	if (ib->moving) {
+		s64 idle = ktime_ms_delta(now, ib->last_motion);
+
+		if (idle >= EVDEV_IB_MOTION_IDLE_MS) {
+			ib->moving = false;
+			evdev_ib_record(ib, EV_REL, ib->motion_code, 0, -1,
+					now);
+		} else {
+			rearm = msecs_to_jiffies(EVDEV_IB_MOTION_IDLE_MS - idle);
+		}
+	}
+	nr_edges = ib->nr_edges;
+	memcpy(edges, ib->edges, sizeof(*edges) * nr_edges);
+	first_edge = ib->first_edge;
+	ib->nr_edges = 0;
+	spin_unlock_irq(&ib->lock);
+
+	if (rearm)
+		queue_delayed_work(ib_unbound_highwq, &ib->work, rearm);
+
+	if (!nr_edges)
+		return;
+
+	/* Boosters parse frames, hand them the changes as one with their slots */
+	for (i = 0; i < nr_edges; i++) {
+		if (edges[i].slot >= 0) {
+			vals[count].type = EV_ABS;
+			vals[count].code = ABS_MT_SLOT;
+			vals[count].value = edges[i].slot;
+			count++;
+		}
+		vals[count].type = edges[i].type;
+		vals[count].code = edges[i].code;
+		vals[count].value = edges[i].value;
+		count++;
+	}
+	vals[count].type = EV_SYN;
+	vals[count].code = SYN_REPORT;
+	vals[count].value = 0;
+	count++;
+
+	lat = ktime_to_ns(ktime_sub(now, first_edge));
+	atomic64_inc(&ib_stats.signals);
+	atomic64_add(lat, &ib_stats.lat_sum);
+	max = atomic64_read(&ib_stats.lat_max);
+	while (lat > max) {
+		s64 old = atomic64_cmpxchg(&ib_stats.lat_max, max, lat);
+
+		if (old == max)
+			break;
+		max = old;
+	}
+
+	ib_data.evt_cnt = count;
+	ib_data.vals = vals;
+	ib_notifier_call_chain(IB_EVENT_TOUCH_BOOSTER, &ib_data);
+}
+
+/*
+ * Called for every frame with the device event lock held. Most frames of
+ * a touch move or of a mouse motion change nothing and only update the
+ * state. The work is queued only for a change and only when it is not
+ * already pending.
+ */
+static void evdev_ib_events(struct evdev *evdev,
+			    const struct input_value *vals, unsigned int count,
+			    ktime_t ev_time)
+{
+	struct evdev_ib *ib = &evdev->ib;
+	const struct input_value *v;
+	bool changed = false;
+	bool motion = false;
+
+	spin_lock(&ib->lock);
 
-	ib_data.evt_cnt = ib_work->evt_cnt;
-	ib_data.vals = ib_work->vals;
-	ib_notifier_call_chain(IB_EVENT_TOUCH_BOOSTER, &(ib_data));
+	for (v = vals; v != vals + count; v++) {
+		switch (v->type) {
+		case EV_KEY:
+			/* autorepeat does not change the boost state */
+			if (v->value == 2)
+				break;
+			evdev_ib_record(ib, EV_KEY, v->code, v->value, -1,
+					ev_time);
+			changed = true;
+			break;
+		case EV_ABS:
+			if (v->code == ABS_MT_SLOT)
+				ib->slot = v->value;
+			else if (v->code == ABS_MT_TRACKING_ID)
+				changed |= evdev_ib_contact(ib, v->value,
+							    ev_time);
+			break;
+		case EV_REL:
+			motion = true;
+			if (ib->moving)
+				break;
+			ib->moving = true;
+			ib->motion_code = v->code;
+			evdev_ib_record(ib, EV_REL, v->code, v->value, -1,
+					ev_time);
+			changed = true;
+			break;
+		}
+	}
+
+	if (motion)
+		ib->last_motion = ev_time;
+
+	if (changed && !ib->queued && ib_unbound_highwq) {
+		ib->queued = true;
+		mod_delayed_work(ib_unbound_highwq, &ib->work, 0);
+	}
+
+	spin_unlock(&ib->lock);
+}
+
+static int evdev_ib_stats_show(struct seq_file *m, void *unused)
+{
+	s64 signals = atomic64_read(&ib_stats.signals);
+
+	seq_printf(m, "edges: %lld\n", atomic64_read(&ib_stats.edges));
+	seq_printf(m, "overflows: %lld\n", atomic64_read(&ib_stats.overflows));
+	seq_printf(m, "signals: %lld\n", signals);
+	seq_printf(m, "latency_sum_us: %lld\n",
+		   div64_s64(atomic64_read(&ib_stats.lat_sum), NSEC_PER_USEC));
+	seq_printf(m, "avg_latency_us: %lld\n", signals ?
+		   div64_s64(atomic64_read(&ib_stats.lat_sum),
+			     signals * NSEC_PER_USEC) : 0);
+	seq_printf(m, "max_latency_us: %lld\n",
+		   div64_s64(atomic64_read(&ib_stats.lat_max), NSEC_PER_USEC));
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(evdev_ib_stats);
 #endif
 
 /*
@@ -339,25 +716,10 @@ static void evdev_events(struct input_handle *handle,
 {
 	struct evdev *evdev = handle->private;
 	struct evdev_client *client;
-#if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
-	int cur_ib_idx;
-#endif
 	ktime_t *ev_time = input_get_timestamp(handle->dev);
 
 #if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
-	spin_lock(&ib_idx_lock);
-	cur_ib_idx = ib_work_cnt++;
-	if (ib_work_cnt >= MAX_IB_COUNT) {
-		pr_info("[Input Booster] Ib_Work_Cnt(%d), Event_Cnt(%d)", ib_work_cnt, count);
-		ib_work_cnt = 0;
-	}
-
-	if (ib_evt_work != NULL) {
-		ib_evt_work[cur_ib_idx].evt_cnt = count;
-		memcpy(ib_evt_work[cur_ib_idx].vals, vals, sizeof(struct input_value) * count);
-		queue_work(ib_unbound_highwq, &(ib_evt_work[cur_ib_idx].evdev_work));
-	}
-	spin_unlock(&ib_idx_lock);
+	evdev_ib_events(evdev, vals, count, ev_time[INPUT_CLK_MONO]);
 #endif
 
 	rcu_read_lock();
@@ -547,6 +909,10 @@ static int evdev_open(struct inode *inode, struct file *file)
 	client->bufsize = bufsize;
 	spin_lock_init(&client->buffer_lock);
 	client->evdev = evdev;
+#if IS_ENABLED(CONFIG_INPUT_EVDEV_LATENCY_STATS)
+	client->stats.pid = task_tgid_vnr(current);
+	get_task_comm(client->stats.comm, current);
+#endif
 	evdev_attach_client(evdev, client);
 
 	error = evdev_open_device(evdev);
@@ -603,7 +969,7 @@ static ssize_t evdev_write(struct file *file, const char __user *buffer,
 }
 
 static int evdev_fetch_next_event(struct evdev_client *client,
-				  struct input_event *event)
+				  struct input_event *event, ktime_t now)
 {
 	int have_event;
 
@@ -613,6 +979,7 @@ static int evdev_fetch_next_event(struct evdev_client *client,
 	if (have_event) {
 		*event = client->buffer[client->tail++];
 		client->tail &= client->bufsize - 1;
+		evdev_stats_read(client, event, now);
 	}
 
 	spin_unlock_irq(&client->buffer_lock);
@@ -627,6 +994,7 @@ static ssize_t evdev_read(struct file *file, char __user *buffer,
 	struct evdev *evdev = client->evdev;
 	struct input_event event;
 	size_t read = 0;
+	ktime_t now;
 	int error;
 
 	if (count != 0 && count < input_event_size())
@@ -647,8 +1015,9 @@ static ssize_t evdev_read(struct file *file, char __user *buffer,
 		if (count == 0)
 			break;
 
+		now = evdev_client_now(client);
 		while (read + input_event_size() <= count &&
-		       evdev_fetch_next_event(client, &event)) {
+		       evdev_fetch_next_event(client, &event, now)) {
 
 			if (input_event_to_user(buffer + read, &event))
 				return -EFAULT;
@@ -1424,6 +1793,12 @@ static int evdev_connect(struct input_handler *handler, struct input_dev *dev,
 	spin_lock_init(&evdev->client_lock);
 	mutex_init(&evdev->mutex);
 	evdev->exist = true;
+#if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
+	INIT_DELAYED_WORK(&evdev->ib.work, evdev_ib_trigger);
+	spin_lock_init(&evdev->ib.lock);
+	if (dev->absinfo)
+		evdev->ib.slot = input_abs_get_val(dev, ABS_MT_SLOT);
+#endif
 
 	dev_no = minor;
 	/* Normalize device number if it falls into legacy range */
@@ -1452,6 +1827,12 @@ static int evdev_connect(struct input_handler *handler, struct input_dev *dev,
 	if (error)
 		goto err_cleanup_evdev;
 
+#if IS_ENABLED(CONFIG_INPUT_EVDEV_LATENCY_STATS)
+	evdev->debugfs = debugfs_create_file(dev_name(&evdev->dev), 0400,
+					     evdev_debugfs_root, evdev,
+					     &evdev_stats_fops);
+#endif
+
 	return 0;
 
  err_cleanup_evdev:
@@ -1468,10 +1849,16 @@ static void evdev_disconnect(struct input_handle *handle)
 {
 	struct evdev *evdev = handle->private;
 
+#if IS_ENABLED(CONFIG_INPUT_EVDEV_LATENCY_STATS)
+	debugfs_remove(evdev->debugfs);
+#endif
 	cdev_device_del(&evdev->cdev, &evdev->dev);
 	evdev_cleanup(evdev);
 	input_free_minor(MINOR(evdev->dev.devt));
 	input_unregister_handle(handle);
+#if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
+	cancel_delayed_work_sync(&evdev->ib.work);
+#endif
 	put_device(&evdev->dev);
 }
 
@@ -1495,17 +1882,12 @@ static struct input_handler evdev_handler = {
 
 static int __init evdev_init(void)
 {
+	evdev_debugfs_root = debugfs_create_dir("evdev", NULL);
 #if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
-	int i;
-	ib_evt_work = kmalloc(sizeof(struct ib_event_work) * MAX_IB_COUNT, GFP_KERNEL);
-	if (ib_evt_work != NULL) {
-		for (i = 0; i < MAX_IB_COUNT; i++)
-			INIT_WORK(&(ib_evt_work[i].evdev_work), evdev_ib_trigger);
-	}
-	ib_work_cnt = 0;
-	spin_lock_init(&ib_idx_lock);
 	ib_unbound_highwq =
 		alloc_ordered_workqueue("ib_unbound_highwq", WQ_HIGHPRI);
+	debugfs_create_file("input_booster", 0444, evdev_debugfs_root, NULL,
+			    &evdev_ib_stats_fops);
 #endif
 	return input_register_handler(&evdev_handler);
 }
@@ -1513,6 +1895,11 @@ static int __init evdev_init(void)
 static void __exit evdev_exit(void)
 {
 	input_unregister_handler(&evdev_handler);
+	debugfs_remove_recursive(evdev_debugfs_root);
+#if IS_ENABLED(CONFIG_SEC_INPUT_BOOSTER)
+	if (ib_unbound_highwq)
+		destroy_workqueue(ib_unbound_highwq);
+#endif
 }
 
 module_init(evdev_init);
@@ -61,6 +61,42 @@ static inline void pgtable_flush(void *vastart, void *vaend)
 			DMA_TO_DEVICE);
 }
 
+/*
+ * lv2 entries written by a batch of mappings but not yet flushed to memory.
+ * Adjacent entries are merged so that a batch costs one flush per lv2 table.
+ */
+struct lv2_flush_range {
+	sysmmu_pte_t *start;
+	sysmmu_pte_t *end;
+};
+
+static void lv2_flush_range_add(struct lv2_flush_range *fr,
+				sysmmu_pte_t *start, sysmmu_pte_t *end)
+{
+	if (!fr) {
+		pgtable_flush(start, end);
+		return;
+	}
+
+	if (fr->end == start) {
+		fr->end = end;
+		return;
+	}
+
+	if (fr->start)
+		pgtable_flush(fr->start, fr->end);
+	fr->start = start;
+	fr->end = end;
+}
+
+static void lv2_flush_range_commit(struct lv2_flush_range *fr)
+{
+	if (fr->start)
+		pgtable_flush(fr->start, fr->end);
+	fr->start = NULL;
+	fr->end = NULL;
+}
+
 static void __sysmmu_tlb_invalidate_all(void __iomem *sfrbase,
 			enum pcie_sysmmu_vid pcie_vid)
 {
@@ -1227,7 +1263,7 @@ err:
 
 #if IS_ENABLED(CONFIG_PCIE_IOMMU_MAP_ONCE)
 static int exynos_iommu_map_once(unsigned long l_iova, phys_addr_t paddr,
-		size_t size, int prot, int domain_num)
+		size_t size, int prot, int domain_num, struct lv2_flush_range *fr)
 {
 	struct exynos_iommu_domain *domain = g_sysmmu_drvdata->domain[domain_num];
 	sysmmu_pte_t *entry, *pent;
@@ -1272,7 +1308,7 @@ static int exynos_iommu_map_once(unsigned long l_iova, phys_addr_t paddr,
 			set_lv2ent_shareable(pent);
 		paddr += SZ_4K;
 	}
-	pgtable_flush(pent - cnt, pent);
+	lv2_flush_range_add(fr, pent - cnt, pent);
 	atomic_sub(cnt, pgcnt);
 
 
@@ -1360,18 +1396,21 @@ static inline int check_memory_validation(phys_addr_t paddr)
 	return 0;
 }
 
-int pcie_iommu_map(unsigned long iova, phys_addr_t paddr, size_t size,
-		int prot, int pcie_channel)
+/*
+ * Map @size bytes at @iova with the page table lock held. TLB invalidation is
+ * left to the caller. On failure, *@mapped tells how much has to be unrolled.
+ */
+static int __pcie_iommu_map(unsigned long iova, phys_addr_t paddr, size_t size,
+		int prot, int pcie_channel, struct lv2_flush_range *fr,
+		size_t *mapped)
 {
 	struct exynos_iommu_domain *domain = g_sysmmu_drvdata->domain[pcie_channel];
-	unsigned long orig_iova = iova;
+	unsigned long __maybe_unused orig_iova = iova;
 	unsigned int min_pagesz;
 	size_t orig_size = size;
 	phys_addr_t __maybe_unused orig_paddr = paddr;
 	int ret = 0;
 	unsigned long changed_iova, changed_size;
-	unsigned long flags;
-	enum pcie_sysmmu_vid pcie_vid = pcie_channel + SYSMMU_PCIE_VID_OFFSET;
 
 	/* Make sure start address align least 4KB */
 	if ((iova & SYSMMU_4KB_MASK) != 0) {
@@ -1397,16 +1436,16 @@ int pcie_iommu_map(unsigned long iova, phys_addr_t paddr, size_t size,
 	 * the size of the mapping, must be aligned (at least) to the
 	 * size of the smallest page supported by the hardware
 	 */
+	*mapped = 0;
 	if (!IS_ALIGNED(iova | paddr | size, min_pagesz)) {
 		pr_err("unaligned: iova 0x%lx pa %p sz 0x%zx min_pagesz 0x%x\n",
 		       iova, &paddr, size, min_pagesz);
 		return -EINVAL;
 	}
 
-	spin_lock_irqsave(&domain->pgtablelock, flags);
 #if IS_ENABLED(CONFIG_PCIE_IOMMU_MAP_ONCE)
 	if (size < SZ_64K) { /* This code assume that there are no LARGE Pages(64KB) */
-		ret = exynos_iommu_map_once(iova, paddr, size, prot, pcie_channel);
+		ret = exynos_iommu_map_once(iova, paddr, size, prot, pcie_channel, fr);
 		if (ret == 0)
 			goto end_map;
 	}
@@ -1434,26 +1473,100 @@ int pcie_iommu_map(unsigned long iova, phys_addr_t paddr, size_t size,
 		paddr += pgsize;
 		size -= pgsize;
 	}
+
+	if (ret) {
+		*mapped = orig_size - size;
+		return ret;
+	}
+
 #if IS_ENABLED(CONFIG_PCIE_IOMMU_MAP_ONCE)
 end_map:
 #endif
-	exynos_sysmmu_tlb_invalidate(orig_iova, orig_size, pcie_vid);
+	*mapped = orig_size;
+
+	pr_debug("mapped: req 0x%lx(org : 0x%lx)  size 0x%zx(0x%zx)\n",
+			changed_iova, orig_iova, changed_size, orig_size);
+
+	return 0;
+}
+
+int pcie_iommu_map(unsigned long iova, phys_addr_t paddr, size_t size,
+		int prot, int pcie_channel)
+{
+	struct exynos_iommu_domain *domain = g_sysmmu_drvdata->domain[pcie_channel];
+	enum pcie_sysmmu_vid pcie_vid = pcie_channel + SYSMMU_PCIE_VID_OFFSET;
+	unsigned long flags;
+	size_t mapped;
+	int ret;
+
+	spin_lock_irqsave(&domain->pgtablelock, flags);
+	ret = __pcie_iommu_map(iova, paddr, size, prot, pcie_channel, NULL, &mapped);
+	exynos_sysmmu_tlb_invalidate(iova, size, pcie_vid);
 	spin_unlock_irqrestore(&domain->pgtablelock, flags);
 
 	/* unroll mapping in case something went wrong */
 	if (ret) {
 		pr_err("PCIe SysMMU mapping Error!\n");
-		pcie_iommu_unmap(orig_iova, orig_size - size, pcie_channel);
+		if (mapped)
+			pcie_iommu_unmap(iova, mapped, pcie_channel);
 	}
 
-	pr_debug("mapped: req 0x%lx(org : 0x%lx)  size 0x%zx(0x%zx)\n",
-			changed_iova, orig_iova, changed_size, orig_size);
-
 	return ret;
 }
 EXPORT_SYMBOL_GPL(pcie_iommu_map);
 
-size_t pcie_iommu_unmap(unsigned long iova, size_t size, int pcie_channel)
+/*
+ * Map several ranges under one page table lock. lv2 entries of adjacent
+ * ranges are flushed together and the TLB is invalidated once over the span
+ * of the whole batch. Either all ranges are mapped or none.
+ */
+int pcie_iommu_map_batch(const struct pcie_iommu_map_req *req, int nr,
+		int prot, int pcie_channel)
+{
+	struct exynos_iommu_domain *domain = g_sysmmu_drvdata->domain[pcie_channel];
+	enum pcie_sysmmu_vid pcie_vid = pcie_channel + SYSMMU_PCIE_VID_OFFSET;
+	struct lv2_flush_range fr = { };
+	unsigned long start = ULONG_MAX, end = 0;
+	unsigned long flags;
+	size_t mapped = 0;
+	int i, ret = 0;
+
+	if (nr <= 0)
+		return 0;
+
+	spin_lock_irqsave(&domain->pgtablelock, flags);
+	for (i = 0; i < nr; i++) {
+		ret = __pcie_iommu_map(req[i].iova, req[i].paddr, req[i].size,
+				       prot, pcie_channel, &fr, &mapped);
+		if (ret)
+			break;
+
+		start = min(start, req[i].iova);
+		end = max(end, req[i].iova + req[i].size);
+	}
+	lv2_flush_range_commit(&fr);
+	if (mapped && ret) {
+		start = min(start, req[i].iova);
+		end = max(end, req[i].iova + mapped);
+	}
+	if (end)
+		exynos_sysmmu_tlb_invalidate(start, end - start, pcie_vid);
+	spin_unlock_irqrestore(&domain->pgtablelock, flags);
+
+	if (ret) {
+		pr_err("PCIe SysMMU batch mapping Error! (%d/%d)\n", i, nr);
+		if (mapped)
+			pcie_iommu_unmap(req[i].iova, mapped, pcie_channel);
+		while (i--)
+			pcie_iommu_unmap(req[i].iova, req[i].size, pcie_channel);
+	}
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(pcie_iommu_map_batch);
+
+/* Unmap with the page table lock held. TLB invalidation is left to the caller */
+static size_t __pcie_iommu_unmap(unsigned long iova, size_t size, int pcie_channel)
 {
 	struct exynos_iommu_domain *domain = g_sysmmu_drvdata->domain[pcie_channel];
 	size_t unmapped_page, unmapped = 0;
@@ -1461,8 +1574,6 @@ size_t pcie_iommu_unmap(unsigned long iova, size_t size, int pcie_channel)
 	unsigned long __maybe_unused orig_iova = iova;
 	unsigned long __maybe_unused changed_iova;
 	size_t __maybe_unused orig_size = size;
-	unsigned long flags;
-	enum pcie_sysmmu_vid pcie_vid = pcie_channel + SYSMMU_PCIE_VID_OFFSET;
 
 	/* Make sure start address align least 4KB */
 	if ((iova & SYSMMU_4KB_MASK) != 0) {
@@ -1493,7 +1604,6 @@ size_t pcie_iommu_unmap(unsigned long iova, size_t size, int pcie_channel)
 
 	pr_debug("unmap this: iova 0x%lx size 0x%zx\n", iova, size);
 
-	spin_lock_irqsave(&domain->pgtablelock, flags);
 #if IS_ENABLED(CONFIG_PCIE_IOMMU_MAP_ONCE)
 	if (size < SZ_64K) { /* This code assume that there are no LARGE Pages(64KB) */
 		unmapped = exynos_iommu_unmap_once(iova, size, pcie_channel);
@@ -1529,16 +1639,77 @@ size_t pcie_iommu_unmap(unsigned long iova, size_t size, int pcie_channel)
 #if IS_ENABLED(CONFIG_PCIE_IOMMU_MAP_ONCE)
 end_unmap:
 #endif
-	exynos_sysmmu_tlb_invalidate(orig_iova, orig_size, pcie_vid);
-	spin_unlock_irqrestore(&domain->pgtablelock, flags);
-
 	pr_debug("UNMAPPED : req 0x%lx(0x%lx) size 0x%zx(0x%zx)\n",
 				changed_iova, orig_iova, size, orig_size);
 
 	return unmapped;
 }
+
+size_t pcie_iommu_unmap(unsigned long iova, size_t size, int pcie_channel)
+{
+	struct exynos_iommu_domain *domain = g_sysmmu_drvdata->domain[pcie_channel];
+	enum pcie_sysmmu_vid pcie_vid = pcie_channel + SYSMMU_PCIE_VID_OFFSET;
+	unsigned long flags;
+	size_t unmapped;
+
+	spin_lock_irqsave(&domain->pgtablelock, flags);
+	unmapped = __pcie_iommu_unmap(iova, size, pcie_channel);
+	exynos_sysmmu_tlb_invalidate(iova, size, pcie_vid);
+	spin_unlock_irqrestore(&domain->pgtablelock, flags);
+
+	return unmapped;
+}
 EXPORT_SYMBOL_GPL(pcie_iommu_unmap);
 
+/*
+ * Unmap without invalidating the TLB. The range is merged into the pending
+ * range of the channel, which pcie_iommu_tlb_sync() invalidates at once.
+ * The caller must not let the device access the range until then. Mapping
+ * a range again invalidates it by itself.
+ */
+size_t pcie_iommu_unmap_deferred(unsigned long iova, size_t size, int pcie_channel)
+{
+	struct exynos_iommu_domain *domain = g_sysmmu_drvdata->domain[pcie_channel];
+	unsigned long flags;
+	size_t unmapped;
+
+	spin_lock_irqsave(&domain->pgtablelock, flags);
+	unmapped = __pcie_iommu_unmap(iova, size, pcie_channel);
+	if (!domain->deferred_end) {
+		domain->deferred_start = iova;
+		domain->deferred_end = iova + size;
+	} else {
+		domain->deferred_start = min(domain->deferred_start, iova);
+		domain->deferred_end = max(domain->deferred_end, iova + size);
+	}
+	spin_unlock_irqrestore(&domain->pgtablelock, flags);
+
+	return unmapped;
+}
+EXPORT_SYMBOL_GPL(pcie_iommu_unmap_deferred);
+
+/* Returns true if a TLB invalidation was issued */
+bool pcie_iommu_tlb_sync(int pcie_channel)
+{
+	struct exynos_iommu_domain *domain = g_sysmmu_drvdata->domain[pcie_channel];
+	enum pcie_sysmmu_vid pcie_vid = pcie_channel + SYSMMU_PCIE_VID_OFFSET;
+	unsigned long flags;
+	bool synced = false;
+
+	spin_lock_irqsave(&domain->pgtablelock, flags);
+	if (domain->deferred_end) {
+		exynos_sysmmu_tlb_invalidate(domain->deferred_start,
+				domain->deferred_end - domain->deferred_start, pcie_vid);
+		domain->deferred_start = 0;
+		domain->deferred_end = 0;
+		synced = true;
+	}
+	spin_unlock_irqrestore(&domain->pgtablelock, flags);
+
+	return synced;
+}
+EXPORT_SYMBOL_GPL(pcie_iommu_tlb_sync);
+
 static int sysmmu_parse_dt(struct device *sysmmu,
 				struct sysmmu_drvdata *drvdata)
 {
@@ -449,6 +449,9 @@ struct exynos_iommu_domain {
 	atomic_t *lv2entcnt;	/* free lv2 entry counter for each section */
 	spinlock_t lock;		/* lock for modifying clients_list */
 	unsigned long pgsize_bitmap;
+	/* range unmapped but not yet invalidated in TLB, under pgtablelock */
+	unsigned long deferred_start;
+	unsigned long deferred_end;
 #ifdef USE_DYNAMIC_MEM_ALLOC
 	struct ext_buff ext_buff[MAX_EXT_BUFF_NUM];
 #endif
@@ -17,6 +17,7 @@
 #include <linux/shrinker.h>
 #include <linux/module.h>
 #include <linux/rbtree.h>
+#include <linux/rhashtable.h>
 #include <linux/stacktrace.h>
 
 #include <trace/hooks/mm.h>
@@ -70,6 +71,13 @@
  * Linking of buffers:
  *	All buffers are linked to buffer_tree with their node field.
  *
+ *	Buffers that can be handed out without the client lock are also
+ *	linked to buffer_hash with their hash_node field.  Lookups in it are
+ *	protected by RCU and take a hold with atomic_inc_unless_negative(),
+ *	so a buffer is only unlinked after its hold_count has been switched
+ *	from 0 to -1 by __claim_buffer().  Unlinked buffers keep a hold_count
+ *	of -1 until they are linked again.
+ *
  *	Clean buffers that are not being written (B_WRITING not set)
  *	are linked to lru[LIST_CLEAN] with their lru_list field.
  *
@@ -103,7 +111,9 @@ struct dm_bufio_client {
 	unsigned minimum_buffers;
 
 	struct rb_root buffer_tree;
+	struct rhashtable buffer_hash;
 	wait_queue_head_t free_buffer_wait;
+	atomic_t free_waiters;
 
 	sector_t start;
 
@@ -137,6 +147,7 @@ enum data_mode {
 
 struct dm_buffer {
 	struct rb_node node;
+	struct rhash_head hash_node;
 	struct list_head lru_list;
 	struct list_head global_list;
 	sector_t block;
@@ -146,7 +157,9 @@ struct dm_buffer {
 	blk_status_t read_error;
 	blk_status_t write_error;
 	unsigned accessed;
-	unsigned hold_count;
+	unsigned char referenced;
+	bool hashed;
+	atomic_t hold_count;
 	unsigned long state;
 	unsigned long last_accessed;
 	unsigned dirty_start;
@@ -156,6 +169,7 @@ struct dm_buffer {
 	struct dm_bufio_client *c;
 	struct list_head write_list;
 	void (*end_io)(struct dm_buffer *, blk_status_t);
+	struct rcu_head rcu;
 #ifdef CONFIG_DM_DEBUG_BLOCK_STACK_TRACING
 #define MAX_STACK 10
 	unsigned int stack_len;
@@ -317,6 +331,40 @@ static void __remove(struct dm_bufio_client *c, struct dm_buffer *b)
 	rb_erase(&b->node, &c->buffer_tree);
 }
 
+static const struct rhashtable_params dm_buffer_hash_params = {
+	.key_len = sizeof(sector_t),
+	.key_offset = offsetof(struct dm_buffer, block),
+	.head_offset = offsetof(struct dm_buffer, hash_node),
+	.automatic_shrinking = true,
+};
+
+/*
+ * Make a linked buffer visible to lockless lookups.  If the hash table
+ * can't grow the buffer is only found with the lock held.
+ */
+static void __hash_buffer(struct dm_buffer *b)
+{
+	b->hashed = !rhashtable_insert_fast(&b->c->buffer_hash, &b->hash_node,
+					    dm_buffer_hash_params);
+}
+
+static void __unhash_buffer(struct dm_buffer *b)
+{
+	if (b->hashed)
+		rhashtable_remove_fast(&b->c->buffer_hash, &b->hash_node,
+				       dm_buffer_hash_params);
+	b->hashed = false;
+}
+
+/*
+ * Take the buffer away from lockless lookups before unlinking it.  Fails if
+ * anyone holds the buffer.
+ */
+static bool __claim_buffer(struct dm_buffer *b)
+{
+	return atomic_cmpxchg(&b->hold_count, 0, -1) == 0;
+}
+
 /*----------------------------------------------------------------*/
 
 static void adjust_total_allocated(struct dm_buffer *b, bool unlink)
@@ -475,6 +523,8 @@ static struct dm_buffer *alloc_buffer(struct dm_bufio_client *c, gfp_t gfp_mask)
 		return NULL;
 
 	b->c = c;
+	atomic_set(&b->hold_count, -1);
+	b->hashed = false;
 
 	b->data = alloc_buffer_data(c, gfp_mask, &b->data_mode);
 	if (!b->data) {
@@ -488,15 +538,23 @@ static struct dm_buffer *alloc_buffer(struct dm_bufio_client *c, gfp_t gfp_mask)
 	return b;
 }
 
+static void free_buffer_rcu(struct rcu_head *rcu)
+{
+	struct dm_buffer *b = container_of(rcu, struct dm_buffer, rcu);
+
+	kmem_cache_free(b->c->slab_buffer, b);
+}
+
 /*
- * Free buffer and its data.
+ * Free buffer and its data.  Lockless lookups may still look at the
+ * buffer itself, but never at its data once it has been claimed.
  */
 static void free_buffer(struct dm_buffer *b)
 {
 	struct dm_bufio_client *c = b->c;
 
 	free_buffer_data(c, b->data, b->data_mode);
-	kmem_cache_free(c->slab_buffer, b);
+	call_rcu(&b->rcu, free_buffer_rcu);
 }
 
 /*
@@ -526,6 +584,7 @@ static void __unlink_buffer(struct dm_buffer *b)
 	BUG_ON(!c->n_buffers[b->list_mode]);
 
 	c->n_buffers[b->list_mode]--;
+	__unhash_buffer(b);
 	__remove(b->c, b);
 	list_del(&b->lru_list);
 
@@ -540,6 +599,7 @@ static void __relink_lru(struct dm_buffer *b, int dirty)
 	struct dm_bufio_client *c = b->c;
 
 	b->accessed = 1;
+	WRITE_ONCE(b->referenced, 0);
 
 	BUG_ON(!c->n_buffers[b->list_mode]);
 
@@ -550,6 +610,21 @@ static void __relink_lru(struct dm_buffer *b, int dirty)
 	b->last_accessed = jiffies;
 }
 
+/*
+ * Lockless lookups only mark the buffer as referenced instead of moving it
+ * in the LRU, which needs the lock.  Scans from the cold end of a list give
+ * such buffers the promotion they missed and pass over them.
+ */
+static bool __lru_promote_lazy(struct dm_buffer *b)
+{
+	if (likely(!READ_ONCE(b->referenced)))
+		return false;
+
+	WRITE_ONCE(b->referenced, 0);
+	list_move(&b->lru_list, &b->c->lru[b->list_mode]);
+	return true;
+}
+
 /*----------------------------------------------------------------
  * Submit I/O on the buffer.
  *
@@ -783,7 +858,7 @@ static void __flush_write_list(struct list_head *write_list)
  */
 static void __make_buffer_clean(struct dm_buffer *b)
 {
-	BUG_ON(b->hold_count);
+	BUG_ON(atomic_read(&b->hold_count) != -1);
 
 	if (!b->state)	/* fast case */
 		return;
@@ -799,13 +874,16 @@ static void __make_buffer_clean(struct dm_buffer *b)
  */
 static struct dm_buffer *__get_unclaimed_buffer(struct dm_bufio_client *c)
 {
-	struct dm_buffer *b;
+	struct dm_buffer *b, *tmp;
 
-	list_for_each_entry_reverse(b, &c->lru[LIST_CLEAN], lru_list) {
+	list_for_each_entry_safe_reverse(b, tmp, &c->lru[LIST_CLEAN], lru_list) {
 		BUG_ON(test_bit(B_WRITING, &b->state));
 		BUG_ON(test_bit(B_DIRTY, &b->state));
 
-		if (!b->hold_count) {
+		if (__lru_promote_lazy(b))
+			continue;
+
+		if (__claim_buffer(b)) {
 			__make_buffer_clean(b);
 			__unlink_buffer(b);
 			return b;
@@ -813,10 +891,13 @@ static struct dm_buffer *__get_unclaimed_buffer(struct dm_bufio_client *c)
 		cond_resched();
 	}
 
-	list_for_each_entry_reverse(b, &c->lru[LIST_DIRTY], lru_list) {
+	list_for_each_entry_safe_reverse(b, tmp, &c->lru[LIST_DIRTY], lru_list) {
 		BUG_ON(test_bit(B_READING, &b->state));
 
-		if (!b->hold_count) {
+		if (__lru_promote_lazy(b))
+			continue;
+
+		if (__claim_buffer(b)) {
 			__make_buffer_clean(b);
 			__unlink_buffer(b);
 			return b;
@@ -908,11 +989,22 @@ static struct dm_buffer *__alloc_buffer_wait_no_callback(struct dm_bufio_client
 			return b;
 		}
 
+		/*
+		 * dm_bufio_release() drops holds without the lock, and only
+		 * takes it to wake us if it sees free_waiters set.  Pairs with
+		 * the barrier in its atomic_dec_return().
+		 */
+		atomic_inc(&c->free_waiters);
+		smp_mb__after_atomic();
+
 		b = __get_unclaimed_buffer(c);
-		if (b)
+		if (b) {
+			atomic_dec(&c->free_waiters);
 			return b;
+		}
 
 		__wait_for_free_buffer(c);
+		atomic_dec(&c->free_waiters);
 	}
 }
 
@@ -1016,18 +1108,17 @@ static struct dm_buffer *__bufio_new(struct dm_bufio_client *c, sector_t block,
 	__check_watermark(c, write_list);
 
 	b = new_b;
-	b->hold_count = 1;
 	b->read_error = 0;
 	b->write_error = 0;
+	b->referenced = 0;
+	b->state = nf == NF_FRESH ? 0 : 1 << B_READING;
 	__link_buffer(b, block, LIST_CLEAN);
+	__hash_buffer(b);
+	/* Lockless lookups see the new block and state once they can hold it */
+	atomic_set_release(&b->hold_count, 1);
 
-	if (nf == NF_FRESH) {
-		b->state = 0;
-		return b;
-	}
-
-	b->state = 1 << B_READING;
-	*need_submit = 1;
+	if (nf != NF_FRESH)
+		*need_submit = 1;
 
 	return b;
 
@@ -1044,7 +1135,7 @@ found_buffer:
 	if (nf == NF_GET && unlikely(test_bit(B_READING, &b->state)))
 		return NULL;
 
-	b->hold_count++;
+	atomic_inc(&b->hold_count);
 	__relink_lru(b, test_bit(B_DIRTY, &b->state) ||
 		     test_bit(B_WRITING, &b->state));
 	return b;
@@ -1067,6 +1158,44 @@ static void read_endio(struct dm_buffer *b, blk_status_t status)
 	wake_up_bit(&b->state, B_READING);
 }
 
+/*
+ * Look up a buffer without taking the client lock, for the common case of
+ * reading a block that is cached, valid and clean.  Everything else, and a
+ * buffer reused for another block before the hold was taken, is left to
+ * __bufio_new().
+ */
+static struct dm_buffer *dm_bufio_try_get(struct dm_bufio_client *c,
+					  sector_t block)
+{
+	struct dm_buffer *b;
+
+	rcu_read_lock();
+	b = rhashtable_lookup(&c->buffer_hash, &block, dm_buffer_hash_params);
+	if (b && !atomic_inc_unless_negative(&b->hold_count))
+		b = NULL;
+	rcu_read_unlock();
+
+	if (!b)
+		return NULL;
+
+	/*
+	 * Pairs with the barrier before clear_bit() in read_endio(), so that
+	 * read_error and the data are not read from before the I/O completed.
+	 */
+	if (unlikely(READ_ONCE(b->block) != block ||
+		     smp_load_acquire(&b->state) ||
+		     b->read_error || b->write_error)) {
+		dm_bufio_release(b);
+		return NULL;
+	}
+
+	WRITE_ONCE(b->accessed, 1);
+	WRITE_ONCE(b->referenced, 1);
+	WRITE_ONCE(b->last_accessed, jiffies);
+
+	return b;
+}
+
 /*
  * A common routine for dm_bufio_new and dm_bufio_read.  Operation of these
  * functions is similar except that dm_bufio_new doesn't read the
@@ -1081,10 +1210,18 @@ static void *new_read(struct dm_bufio_client *c, sector_t block,
 
 	LIST_HEAD(write_list);
 
+	if (nf == NF_GET || nf == NF_READ) {
+		b = dm_bufio_try_get(c, block);
+		if (b) {
+			*bp = b;
+			return b->data;
+		}
+	}
+
 	dm_bufio_lock(c);
 	b = __bufio_new(c, block, nf, &need_submit, &write_list);
 #ifdef CONFIG_DM_DEBUG_BLOCK_STACK_TRACING
-	if (b && b->hold_count == 1)
+	if (b && atomic_read(&b->hold_count) == 1)
 		buffer_record_stack(b);
 #endif
 	dm_bufio_unlock(c);
@@ -1187,12 +1324,29 @@ void dm_bufio_release(struct dm_buffer *b)
 {
 	struct dm_bufio_client *c = b->c;
 
+	/*
+	 * A buffer without errors stays cached, so the hold can be dropped
+	 * without the lock.  The lock is only needed to wake threads waiting
+	 * for a free buffer, see __alloc_buffer_wait_no_callback().
+	 */
+	if (likely(!b->read_error && !b->write_error)) {
+		int count = atomic_dec_return(&b->hold_count);
+
+		BUG_ON(count < 0);
+		if (count || !atomic_read(&c->free_waiters))
+			return;
+
+		dm_bufio_lock(c);
+		wake_up(&c->free_buffer_wait);
+		dm_bufio_unlock(c);
+		return;
+	}
+
 	dm_bufio_lock(c);
 
-	BUG_ON(!b->hold_count);
+	BUG_ON(atomic_read(&b->hold_count) <= 0);
 
-	b->hold_count--;
-	if (!b->hold_count) {
+	if (atomic_dec_and_test(&b->hold_count)) {
 		wake_up(&c->free_buffer_wait);
 
 		/*
@@ -1203,7 +1357,8 @@ void dm_bufio_release(struct dm_buffer *b)
 		if ((b->read_error || b->write_error) &&
 		    !test_bit(B_READING, &b->state) &&
 		    !test_bit(B_WRITING, &b->state) &&
-		    !test_bit(B_DIRTY, &b->state)) {
+		    !test_bit(B_DIRTY, &b->state) &&
+		    __claim_buffer(b)) {
 			__unlink_buffer(b);
 			__free_buffer_wake(b);
 		}
@@ -1292,12 +1447,12 @@ again:
 		if (test_bit(B_WRITING, &b->state)) {
 			if (buffers_processed < c->n_buffers[LIST_DIRTY]) {
 				dropped_lock = 1;
-				b->hold_count++;
+				atomic_inc(&b->hold_count);
 				dm_bufio_unlock(c);
 				wait_on_bit_io(&b->state, B_WRITING,
 					       TASK_UNINTERRUPTIBLE);
 				dm_bufio_lock(c);
-				b->hold_count--;
+				atomic_dec(&b->hold_count);
 			} else
 				wait_on_bit_io(&b->state, B_WRITING,
 					       TASK_UNINTERRUPTIBLE);
@@ -1407,10 +1562,13 @@ void dm_bufio_release_move(struct dm_buffer *b, sector_t new_block)
 
 	dm_bufio_lock(c);
 
+	/* See __alloc_buffer_wait_no_callback() */
+	atomic_inc(&c->free_waiters);
+	smp_mb__after_atomic();
 retry:
 	new = __find(c, new_block);
 	if (new) {
-		if (new->hold_count) {
+		if (!__claim_buffer(new)) {
 			__wait_for_free_buffer(c);
 			goto retry;
 		}
@@ -1423,12 +1581,14 @@ retry:
 		__unlink_buffer(new);
 		__free_buffer_wake(new);
 	}
+	atomic_dec(&c->free_waiters);
 
-	BUG_ON(!b->hold_count);
+	BUG_ON(atomic_read(&b->hold_count) <= 0);
 	BUG_ON(test_bit(B_READING, &b->state));
 
 	__write_dirty_buffer(b, NULL);
-	if (b->hold_count == 1) {
+	/* Keep lockless lookups away while the buffer changes blocks */
+	if (atomic_cmpxchg(&b->hold_count, 1, -1) == 1) {
 		wait_on_bit_io(&b->state, B_WRITING,
 			       TASK_UNINTERRUPTIBLE);
 		set_bit(B_DIRTY, &b->state);
@@ -1436,6 +1596,8 @@ retry:
 		b->dirty_end = c->block_size;
 		__unlink_buffer(b);
 		__link_buffer(b, new_block, LIST_DIRTY);
+		__hash_buffer(b);
+		atomic_set_release(&b->hold_count, 1);
 	} else {
 		sector_t old_block;
 		wait_on_bit_lock_io(&b->state, B_WRITING,
@@ -1455,6 +1617,7 @@ retry:
 			       TASK_UNINTERRUPTIBLE);
 		__unlink_buffer(b);
 		__link_buffer(b, old_block, b->list_mode);
+		__hash_buffer(b);
 	}
 
 	dm_bufio_unlock(c);
@@ -1464,7 +1627,7 @@ EXPORT_SYMBOL_GPL(dm_bufio_release_move);
 
 static void forget_buffer_locked(struct dm_buffer *b)
 {
-	if (likely(!b->hold_count) && likely(!b->state)) {
+	if (likely(!b->state) && likely(__claim_buffer(b))) {
 		__unlink_buffer(b);
 		__free_buffer_wake(b);
 	}
@@ -1592,12 +1755,13 @@ static void drop_buffers(struct dm_bufio_client *c)
 		list_for_each_entry(b, &c->lru[i], lru_list) {
 			WARN_ON(!warned);
 			warned = true;
-			DMERR("leaked buffer %llx, hold count %u, list %d",
-			      (unsigned long long)b->block, b->hold_count, i);
+			DMERR("leaked buffer %llx, hold count %d, list %d",
+			      (unsigned long long)b->block,
+			      atomic_read(&b->hold_count), i);
 #ifdef CONFIG_DM_DEBUG_BLOCK_STACK_TRACING
 			stack_trace_print(b->stack_entries, b->stack_len, 1);
 			/* mark unclaimed to avoid BUG_ON below */
-			b->hold_count = 0;
+			atomic_set(&b->hold_count, 0);
 #endif
 		}
 
@@ -1629,7 +1793,7 @@ static bool __try_evict_buffer(struct dm_buffer *b, gfp_t gfp)
 			return false;
 	}
 
-	if (b->hold_count)
+	if (!__claim_buffer(b))
 		return false;
 
 	__make_buffer_clean(b);
@@ -1664,6 +1828,8 @@ static void __scan(struct dm_bufio_client *c)
 				atomic_long_set(&c->need_shrink, 0);
 			if (!atomic_long_read(&c->need_shrink))
 				return;
+			if (__lru_promote_lazy(b))
+				continue;
 			if (__try_evict_buffer(b, GFP_KERNEL)) {
 				atomic_long_dec(&c->need_shrink);
 				freed++;
@@ -1746,6 +1912,9 @@ struct dm_bufio_client *dm_bufio_client_create(struct block_device *bdev, unsign
 		goto bad_client;
 	}
 	c->buffer_tree = RB_ROOT;
+	r = rhashtable_init(&c->buffer_hash, &dm_buffer_hash_params);
+	if (r)
+		goto bad_hash;
 
 	c->bdev = bdev;
 	c->block_size = block_size;
@@ -1769,6 +1938,7 @@ struct dm_bufio_client *dm_bufio_client_create(struct block_device *bdev, unsign
 	dm_bufio_set_minimum_buffers(c, DM_BUFIO_MIN_BUFFERS);
 
 	init_waitqueue_head(&c->free_buffer_wait);
+	atomic_set(&c->free_waiters, 0);
 	c->async_write_error = 0;
 
 	c->dm_io = dm_io_client_create();
@@ -1835,11 +2005,15 @@ bad:
 		list_del(&b->lru_list);
 		free_buffer(b);
 	}
+	/* Wait for free_buffer_rcu() */
+	rcu_barrier();
 	kmem_cache_destroy(c->slab_cache);
 	kmem_cache_destroy(c->slab_buffer);
 	dm_io_client_destroy(c->dm_io);
 bad_dm_io:
 	mutex_destroy(&c->lock);
+	rhashtable_destroy(&c->buffer_hash);
+bad_hash:
 	kfree(c);
 bad_client:
 	return ERR_PTR(r);
@@ -1884,10 +2058,13 @@ void dm_bufio_client_destroy(struct dm_bufio_client *c)
 	for (i = 0; i < LIST_SIZE; i++)
 		BUG_ON(c->n_buffers[i]);
 
+	/* Wait for free_buffer_rcu() */
+	rcu_barrier();
 	kmem_cache_destroy(c->slab_cache);
 	kmem_cache_destroy(c->slab_buffer);
 	dm_io_client_destroy(c->dm_io);
 	mutex_destroy(&c->lock);
+	rhashtable_destroy(&c->buffer_hash);
 	kfree(c);
 }
 EXPORT_SYMBOL_GPL(dm_bufio_client_destroy);
@@ -1934,6 +2111,9 @@ static void __evict_old_buffers(struct dm_bufio_client *c, unsigned long age_hz)
 		if (count <= retain_target)
 			break;
 
+		if (__lru_promote_lazy(b))
+			continue;
+
 		if (!older_than(b, age_hz))
 			break;
 
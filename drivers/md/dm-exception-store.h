@@ -81,13 +81,18 @@ struct dm_exception_store_type {
 	 * *last_old_chunk and *last_new_chunk to the most recent
 	 * still-to-be-merged chunk and returns the number of
 	 * consecutive previous ones.
+	 *
+	 * nr_merging skips that many of the most recent exceptions, which
+	 * have already been returned for the current batch.  Returns 0 if
+	 * the batch can't be extended before the next commit_merge.
 	 */
-	int (*prepare_merge) (struct dm_exception_store *store,
+	int (*prepare_merge) (struct dm_exception_store *store, int nr_merging,
 			      chunk_t *last_old_chunk, chunk_t *last_new_chunk);
 
 	/*
 	 * Clear the last n exceptions.
-	 * nr_merged must be <= the value returned by prepare_merge.
+	 * nr_merged must be <= the total returned by prepare_merge for
+	 * the current batch.
 	 */
 	int (*commit_merge) (struct dm_exception_store *store, int nr_merged);
 
@@ -756,19 +756,25 @@ static void persistent_commit_exception(struct dm_exception_store *store,
 }
 
 static int persistent_prepare_merge(struct dm_exception_store *store,
+				    int nr_merging,
 				    chunk_t *last_old_chunk,
 				    chunk_t *last_new_chunk)
 {
 	struct pstore *ps = get_info(store);
 	struct core_exception ce;
-	int nr_consecutive;
+	int nr_consecutive, nr_left;
 	int r;
 
 	/*
-	 * When current area is empty, move back to preceding area.
+	 * A batch ends with the current area, as commit_merge() only
+	 * writes that one.
 	 */
-	if (!ps->current_committed) {
+	if (nr_merging) {
+		if (nr_merging >= ps->current_committed)
+			return 0;
+	} else if (!ps->current_committed) {
 		/*
+		 * When current area is empty, move back to preceding area.
 		 * Have we finished?
 		 */
 		if (!ps->current_area)
@@ -781,7 +787,8 @@ static int persistent_prepare_merge(struct dm_exception_store *store,
 		ps->current_committed = ps->exceptions_per_area;
 	}
 
-	read_exception(ps, ps->area, ps->current_committed - 1, &ce);
+	nr_left = ps->current_committed - nr_merging;
+	read_exception(ps, ps->area, nr_left - 1, &ce);
 	*last_old_chunk = ce.old_chunk;
 	*last_new_chunk = ce.new_chunk;
 
@@ -789,10 +796,8 @@ static int persistent_prepare_merge(struct dm_exception_store *store,
 	 * Find number of consecutive chunks within the current area,
 	 * working backwards.
 	 */
-	for (nr_consecutive = 1; nr_consecutive < ps->current_committed;
-	     nr_consecutive++) {
-		read_exception(ps, ps->area,
-			       ps->current_committed - 1 - nr_consecutive, &ce);
+	for (nr_consecutive = 1; nr_consecutive < nr_left; nr_consecutive++) {
+		read_exception(ps, ps->area, nr_left - 1 - nr_consecutive, &ce);
 		if (ce.old_chunk != *last_old_chunk - nr_consecutive ||
 		    ce.new_chunk != *last_new_chunk - nr_consecutive)
 			break;
@@ -14,6 +14,7 @@
 #include <linux/list_bl.h>
 #include <linux/mempool.h>
 #include <linux/module.h>
+#include <linux/sched/mm.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/log2.h>
@@ -39,10 +40,33 @@ static const char dm_snapshot_merge_target_name[] = "snapshot-merge";
 #define DM_TRACKED_CHUNK_HASH(x)	((unsigned long)(x) & \
 					 (DM_TRACKED_CHUNK_HASH_SIZE - 1))
 
+/*
+ * The completed exception table is resized to keep about
+ * DM_EXCEPTION_TABLE_LOAD exceptions per bucket.
+ */
+#define DM_EXCEPTION_TABLE_LOAD		4
+#define DM_EXCEPTION_TABLE_MAX_BUCKETS	\
+	((64 * 1024 * 1024) / sizeof(struct hlist_bl_head))
+
 struct dm_exception_table {
 	uint32_t hash_mask;
 	unsigned hash_shift;
 	struct hlist_bl_head *table;
+	atomic_long_t count;
+	/* The table never shrinks below its initial size */
+	uint32_t min_size;
+};
+
+/*
+ * Up to DM_MERGE_MAX_RUNS runs of consecutive chunks are copied before
+ * the exception store metadata is committed once for all of them.
+ */
+#define DM_MERGE_MAX_RUNS	32
+
+struct dm_merge_run {
+	chunk_t old_chunk;
+	chunk_t new_chunk;
+	int nr_chunks;
 };
 
 struct dm_snapshot {
@@ -114,10 +138,22 @@ struct dm_snapshot {
 	/* Wait for events based on state_bits */
 	unsigned long state_bits;
 
-	/* Range of chunks currently being merged. */
-	chunk_t first_merging_chunk;
+	/* Runs of chunks currently being merged. */
+	struct dm_merge_run merge_runs[DM_MERGE_MAX_RUNS];
+	int nr_merge_runs;
 	int num_merging_chunks;
 
+	/* Copies of the current merge batch still in flight */
+	atomic_t merge_copies_pending;
+	int merge_read_err;
+	unsigned long merge_write_err;
+
+	/* Merge progress, reported by the snapshot-merge target */
+	u64 merged_chunks;
+	u64 merge_commits;
+	unsigned long merge_jiffies;
+	unsigned long merge_start;
+
 	/*
 	 * The merge operation failed if this flag is set.
 	 * Failure modes are handled as follows:
@@ -663,6 +699,8 @@ static int dm_exception_table_init(struct dm_exception_table *et,
 
 	et->hash_shift = hash_shift;
 	et->hash_mask = size - 1;
+	atomic_long_set(&et->count, 0);
+	et->min_size = size;
 	et->table = kvmalloc_array(size, sizeof(struct hlist_bl_head),
 				   GFP_KERNEL);
 	if (!et->table)
@@ -698,9 +736,11 @@ static uint32_t exception_hash(struct dm_exception_table *et, chunk_t chunk)
 	return (chunk >> et->hash_shift) & et->hash_mask;
 }
 
-static void dm_remove_exception(struct dm_exception *e)
+static void dm_remove_exception(struct dm_exception_table *et,
+				struct dm_exception *e)
 {
 	hlist_bl_del(&e->hash_list);
+	atomic_long_dec(&et->count);
 }
 
 /*
@@ -799,6 +839,7 @@ static void dm_insert_exception(struct dm_exception_table *eh,
 	}
 
 out:
+	atomic_long_inc(&eh->count);
 	if (!e) {
 		/*
 		 * Either the table doesn't support consecutive chunks or slot
@@ -814,6 +855,111 @@ out:
 	}
 }
 
+/*
+ * Insert an exception that is already in the table being resized into
+ * the new one, keeping the slot ordered by old_chunk.
+ */
+static void dm_rehash_exception(struct dm_exception_table *et,
+				struct dm_exception *new_e)
+{
+	struct hlist_bl_head *l;
+	struct hlist_bl_node *pos;
+	struct dm_exception *e, *last = NULL;
+
+	l = &et->table[exception_hash(et, new_e->old_chunk)];
+
+	hlist_bl_lock(l);
+	hlist_bl_for_each_entry(e, pos, l, hash_list) {
+		if (new_e->old_chunk < e->old_chunk) {
+			hlist_bl_add_before(&new_e->hash_list, &e->hash_list);
+			goto out;
+		}
+		last = e;
+	}
+
+	if (last)
+		hlist_bl_add_behind(&new_e->hash_list, &last->hash_list);
+	else
+		hlist_bl_add_head(&new_e->hash_list, l);
+out:
+	hlist_bl_unlock(l);
+}
+
+static uint32_t dm_exception_table_target_size(struct dm_exception_table *et)
+{
+	unsigned long count = atomic_long_read(&et->count);
+	uint32_t size = READ_ONCE(et->hash_mask) + 1;
+
+	while (count > (unsigned long)size * DM_EXCEPTION_TABLE_LOAD &&
+	       size < DM_EXCEPTION_TABLE_MAX_BUCKETS)
+		size <<= 1;
+
+	/* Shrink with some hysteresis so the table doesn't flip-flop */
+	while (count * DM_EXCEPTION_TABLE_LOAD < size && size > et->min_size)
+		size >>= 1;
+
+	return size;
+}
+
+/*
+ * Rehash the table into one of the given size.  If the new table can't
+ * be allocated the old one is kept, it only gets slower.
+ */
+static void dm_exception_table_resize(struct dm_exception_table *et,
+				      uint32_t size)
+{
+	struct hlist_bl_head *old_table = et->table, *table;
+	uint32_t i, old_size = et->hash_mask + 1;
+	struct hlist_bl_node *pos, *n;
+	struct dm_exception *e;
+	unsigned int noio_flag;
+
+	/* Called in the I/O path, so don't recurse into it */
+	noio_flag = memalloc_noio_save();
+	table = kvmalloc_array(size, sizeof(struct hlist_bl_head), GFP_KERNEL);
+	memalloc_noio_restore(noio_flag);
+	if (!table)
+		return;
+
+	for (i = 0; i < size; i++)
+		INIT_HLIST_BL_HEAD(table + i);
+
+	et->table = table;
+	WRITE_ONCE(et->hash_mask, size - 1);
+
+	for (i = 0; i < old_size; i++)
+		hlist_bl_for_each_entry_safe(e, pos, n, old_table + i, hash_list)
+			dm_rehash_exception(et, e);
+
+	kvfree(old_table);
+}
+
+/*
+ * The completed exception table is sized at construction, but a
+ * snapshot can collect many more exceptions than that or drop most of
+ * them while merging.  Keep the chains short by resizing the table with
+ * s->lock held for writing; everything else that touches the table holds
+ * it for reading, including the slot locks of dm_exception_table_lock.
+ */
+static void __resize_complete_table(struct dm_snapshot *s)
+{
+	uint32_t size = dm_exception_table_target_size(&s->complete);
+
+	if (size != s->complete.hash_mask + 1)
+		dm_exception_table_resize(&s->complete, size);
+}
+
+static void resize_complete_table(struct dm_snapshot *s)
+{
+	if (likely(dm_exception_table_target_size(&s->complete) ==
+		   READ_ONCE(s->complete.hash_mask) + 1))
+		return;
+
+	down_write(&s->lock);
+	__resize_complete_table(s);
+	up_write(&s->lock);
+}
+
 /*
  * Callback used by the exception stores to load exceptions when
  * initialising.
@@ -845,6 +991,8 @@ static int dm_add_exception(void *context, chunk_t old, chunk_t new)
 	dm_insert_exception(&s->complete, e);
 	dm_exception_table_unlock(&lock);
 
+	resize_complete_table(s);
+
 	return 0;
 }
 
@@ -919,6 +1067,7 @@ static int init_hash_tables(struct dm_snapshot *s)
 
 static void merge_shutdown(struct dm_snapshot *s)
 {
+	s->merge_jiffies += jiffies - s->merge_start;
 	clear_bit_unlock(RUNNING_MERGE, &s->state_bits);
 	smp_mb__after_atomic();
 	wake_up_bit(&s->state_bits, RUNNING_MERGE);
@@ -926,7 +1075,7 @@ static void merge_shutdown(struct dm_snapshot *s)
 
 static struct bio *__release_queued_bios_after_merge(struct dm_snapshot *s)
 {
-	s->first_merging_chunk = 0;
+	s->nr_merge_runs = 0;
 	s->num_merging_chunks = 0;
 
 	return bio_list_get(&s->bios_queued_during_merge);
@@ -952,7 +1101,7 @@ static int __remove_single_exception_chunk(struct dm_snapshot *s,
 	 * If this is the only chunk using this exception, remove exception.
 	 */
 	if (!dm_consecutive_chunk_count(e)) {
-		dm_remove_exception(e);
+		dm_remove_exception(&s->complete, e);
 		free_completed_exception(e);
 		return 0;
 	}
@@ -988,23 +1137,32 @@ static void flush_bios(struct bio *bio);
 
 static int remove_single_exception_chunk(struct dm_snapshot *s)
 {
+	struct dm_merge_run *run;
 	struct bio *b = NULL;
-	int r;
-	chunk_t old_chunk = s->first_merging_chunk + s->num_merging_chunks - 1;
+	chunk_t old_chunk;
+	int i, r = 0;
 
 	down_write(&s->lock);
 
 	/*
 	 * Process chunks (and associated exceptions) in reverse order
 	 * so that dm_consecutive_chunk_count_dec() accounting works.
+	 * The runs are already ordered from the most recent one.
 	 */
-	do {
-		r = __remove_single_exception_chunk(s, old_chunk);
-		if (r)
-			goto out;
-	} while (old_chunk-- > s->first_merging_chunk);
+	for (i = 0; i < s->nr_merge_runs; i++) {
+		run = &s->merge_runs[i];
+		old_chunk = run->old_chunk + run->nr_chunks - 1;
+		do {
+			r = __remove_single_exception_chunk(s, old_chunk);
+			if (r)
+				goto out;
+		} while (old_chunk-- > run->old_chunk);
+	}
 
+	s->merged_chunks += s->num_merging_chunks;
+	s->merge_commits++;
 	b = __release_queued_bios_after_merge(s);
+	__resize_complete_table(s);
 
 out:
 	up_write(&s->lock);
@@ -1040,10 +1198,14 @@ static void increment_pending_exceptions_done_count(void)
 	wake_up_all(&_pending_exceptions_done);
 }
 
+static void merge_copy_callback(int read_err, unsigned long write_err,
+				void *context);
+
 static void snapshot_merge_next_chunks(struct dm_snapshot *s)
 {
-	int i, linear_chunks;
+	int i, linear_chunks, nr_runs = 0, nr_chunks = 0;
 	chunk_t old_chunk, new_chunk;
+	struct dm_merge_run *run;
 	struct dm_io_region src, dest;
 	sector_t io_size;
 	uint64_t previous_count;
@@ -1060,36 +1222,35 @@ static void snapshot_merge_next_chunks(struct dm_snapshot *s)
 		goto shut;
 	}
 
-	linear_chunks = s->store->type->prepare_merge(s->store, &old_chunk,
-						      &new_chunk);
-	if (linear_chunks <= 0) {
+	/*
+	 * Collect runs of consecutive chunks, most recent first, until the
+	 * exception store can't extend the batch before the next commit.
+	 */
+	while (nr_runs < DM_MERGE_MAX_RUNS) {
+		linear_chunks = s->store->type->prepare_merge(s->store, nr_chunks,
+							      &old_chunk,
+							      &new_chunk);
 		if (linear_chunks < 0) {
 			DMERR("Read error in exception store: "
 			      "shutting down merge");
 			down_write(&s->lock);
 			s->merge_failed = true;
 			up_write(&s->lock);
+			goto shut;
 		}
-		goto shut;
-	}
-
-	/* Adjust old_chunk and new_chunk to reflect start of linear region */
-	old_chunk = old_chunk + 1 - linear_chunks;
-	new_chunk = new_chunk + 1 - linear_chunks;
-
-	/*
-	 * Use one (potentially large) I/O to copy all 'linear_chunks'
-	 * from the exception store to the origin
-	 */
-	io_size = linear_chunks * s->store->chunk_size;
+		if (!linear_chunks)
+			break;
 
-	dest.bdev = s->origin->bdev;
-	dest.sector = chunk_to_sector(s->store, old_chunk);
-	dest.count = min(io_size, get_dev_size(dest.bdev) - dest.sector);
+		/* Adjust old_chunk and new_chunk to reflect start of linear region */
+		run = &s->merge_runs[nr_runs++];
+		run->old_chunk = old_chunk + 1 - linear_chunks;
+		run->new_chunk = new_chunk + 1 - linear_chunks;
+		run->nr_chunks = linear_chunks;
+		nr_chunks += linear_chunks;
+	}
 
-	src.bdev = s->cow->bdev;
-	src.sector = chunk_to_sector(s->store, new_chunk);
-	src.count = dest.count;
+	if (!nr_runs)
+		goto shut;
 
 	/*
 	 * Reallocate any exceptions needed in other snapshots then
@@ -1100,25 +1261,58 @@ static void snapshot_merge_next_chunks(struct dm_snapshot *s)
 	 * efficient algorithm, it is not expected to have any
 	 * significant impact on performance.
 	 */
-	previous_count = read_pending_exceptions_done_count();
-	while (origin_write_extent(s, dest.sector, io_size)) {
-		wait_event(_pending_exceptions_done,
-			   (read_pending_exceptions_done_count() !=
-			    previous_count));
-		/* Retry after the wait, until all exceptions are done. */
+	for (i = 0; i < nr_runs; i++) {
+		run = &s->merge_runs[i];
+		io_size = run->nr_chunks * s->store->chunk_size;
+
 		previous_count = read_pending_exceptions_done_count();
+		while (origin_write_extent(s, chunk_to_sector(s->store,
+							      run->old_chunk),
+					   io_size)) {
+			wait_event(_pending_exceptions_done,
+				   (read_pending_exceptions_done_count() !=
+				    previous_count));
+			/* Retry after the wait, until all exceptions are done. */
+			previous_count = read_pending_exceptions_done_count();
+		}
 	}
 
 	down_write(&s->lock);
-	s->first_merging_chunk = old_chunk;
-	s->num_merging_chunks = linear_chunks;
+	s->nr_merge_runs = nr_runs;
+	s->num_merging_chunks = nr_chunks;
 	up_write(&s->lock);
 
-	/* Wait until writes to all 'linear_chunks' drain */
-	for (i = 0; i < linear_chunks; i++)
-		__check_for_conflicting_io(s, old_chunk + i);
+	/* Wait until writes to all the chunks of the batch drain */
+	for (i = 0; i < nr_runs; i++) {
+		run = &s->merge_runs[i];
+		for (old_chunk = run->old_chunk;
+		     old_chunk < run->old_chunk + run->nr_chunks; old_chunk++)
+			__check_for_conflicting_io(s, old_chunk);
+	}
+
+	atomic_set(&s->merge_copies_pending, nr_runs);
+	s->merge_read_err = 0;
+	s->merge_write_err = 0;
+
+	/*
+	 * Use one (potentially large) I/O per run to copy its chunks from
+	 * the exception store to the origin
+	 */
+	for (i = 0; i < nr_runs; i++) {
+		run = &s->merge_runs[i];
+		io_size = run->nr_chunks * s->store->chunk_size;
+
+		dest.bdev = s->origin->bdev;
+		dest.sector = chunk_to_sector(s->store, run->old_chunk);
+		dest.count = min(io_size, get_dev_size(dest.bdev) - dest.sector);
+
+		src.bdev = s->cow->bdev;
+		src.sector = chunk_to_sector(s->store, run->new_chunk);
+		src.count = dest.count;
 
-	dm_kcopyd_copy(s->kcopyd_client, &src, 1, &dest, 0, merge_callback, s);
+		dm_kcopyd_copy(s->kcopyd_client, &src, 1, &dest, 0,
+			       merge_copy_callback, s);
+	}
 	return;
 
 shut:
@@ -1156,6 +1350,7 @@ static void merge_callback(int read_err, unsigned long write_err, void *context)
 		goto shut;
 	}
 
+	/* One metadata commit for every run of the batch */
 	if (s->store->type->commit_merge(s->store,
 					 s->num_merging_chunks) < 0) {
 		DMERR("Write error in exception store: shutting down merge");
@@ -1179,10 +1374,30 @@ shut:
 	merge_shutdown(s);
 }
 
+/*
+ * kcopyd calls back from a single thread, so the last copy of a batch
+ * to complete finishes it.
+ */
+static void merge_copy_callback(int read_err, unsigned long write_err,
+				void *context)
+{
+	struct dm_snapshot *s = context;
+
+	s->merge_read_err |= read_err;
+	s->merge_write_err |= write_err;
+
+	if (!atomic_dec_and_test(&s->merge_copies_pending))
+		return;
+
+	merge_callback(s->merge_read_err, s->merge_write_err, s);
+}
+
 static void start_merge(struct dm_snapshot *s)
 {
-	if (!test_and_set_bit(RUNNING_MERGE, &s->state_bits))
+	if (!test_and_set_bit(RUNNING_MERGE, &s->state_bits)) {
+		s->merge_start = jiffies;
 		snapshot_merge_next_chunks(s);
+	}
 }
 
 /*
@@ -1337,8 +1552,11 @@ static int snapshot_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	spin_lock_init(&s->pe_lock);
 	s->state_bits = 0;
 	s->merge_failed = false;
-	s->first_merging_chunk = 0;
+	s->nr_merge_runs = 0;
 	s->num_merging_chunks = 0;
+	s->merged_chunks = 0;
+	s->merge_commits = 0;
+	s->merge_jiffies = 0;
 	bio_list_init(&s->bios_queued_during_merge);
 	bio_init(&s->flush_bio, NULL, 0);
 
@@ -1670,31 +1888,26 @@ static void pending_complete(void *context, int success)
 	struct dm_exception_table_lock lock;
 	int error = 0;
 
-	dm_exception_table_lock_init(s, pe->e.old_chunk, &lock);
-
 	if (!success) {
 		/* Read/write error - snapshot is unusable */
 		invalidate_snapshot(s, -EIO);
 		error = 1;
-
-		dm_exception_table_lock(&lock);
-		goto out;
+		goto out_lock;
 	}
 
 	e = alloc_completed_exception(GFP_NOIO);
 	if (!e) {
 		invalidate_snapshot(s, -ENOMEM);
 		error = 1;
-
-		dm_exception_table_lock(&lock);
-		goto out;
+		goto out_lock;
 	}
 	*e = pe->e;
 
+	/* s->lock keeps the completed exception table from being resized */
 	down_read(&s->lock);
+	dm_exception_table_lock_init(s, pe->e.old_chunk, &lock);
 	dm_exception_table_lock(&lock);
 	if (!s->valid) {
-		up_read(&s->lock);
 		free_completed_exception(e);
 		error = 1;
 
@@ -1709,7 +1922,6 @@ static void pending_complete(void *context, int success)
 	 * merging can overwrite the chunk in origin.
 	 */
 	dm_insert_exception(&s->complete, e);
-	up_read(&s->lock);
 
 	/* Wait for conflicting reads to drain */
 	if (__chunk_is_tracked(s, pe->e.old_chunk)) {
@@ -1717,12 +1929,21 @@ static void pending_complete(void *context, int success)
 		__check_for_conflicting_io(s, pe->e.old_chunk);
 		dm_exception_table_lock(&lock);
 	}
+	goto out;
 
+out_lock:
+	down_read(&s->lock);
+	dm_exception_table_lock_init(s, pe->e.old_chunk, &lock);
+	dm_exception_table_lock(&lock);
 out:
 	/* Remove the in-flight exception from the list */
-	dm_remove_exception(&pe->e);
+	dm_remove_exception(&s->pending, &pe->e);
 
 	dm_exception_table_unlock(&lock);
+	up_read(&s->lock);
+
+	if (!error)
+		resize_complete_table(s);
 
 	snapshot_bios = bio_list_get(&pe->snapshot_bios);
 	origin_bios = bio_list_get(&pe->origin_bios);
@@ -1981,7 +2202,6 @@ static int snapshot_map(struct dm_target *ti, struct bio *bio)
 	}
 
 	chunk = sector_to_chunk(s->store, bio->bi_iter.bi_sector);
-	dm_exception_table_lock_init(s, chunk, &lock);
 
 	/* Full snapshots are not usable */
 	/* To get here the table must be live so s->active is always set. */
@@ -1994,6 +2214,7 @@ static int snapshot_map(struct dm_target *ti, struct bio *bio)
 	}
 
 	down_read(&s->lock);
+	dm_exception_table_lock_init(s, chunk, &lock);
 	dm_exception_table_lock(&lock);
 
 	if (!s->valid || (unlikely(s->snapshot_overflowed) &&
@@ -2132,6 +2353,19 @@ out:
  * If merging is currently taking place on the chunk in question, the
  * I/O is deferred by adding it to s->bios_queued_during_merge.
  */
+static bool __chunk_is_merging(struct dm_snapshot *s, chunk_t chunk)
+{
+	int i;
+
+	for (i = 0; i < s->nr_merge_runs; i++)
+		if (chunk >= s->merge_runs[i].old_chunk &&
+		    chunk < s->merge_runs[i].old_chunk +
+			    s->merge_runs[i].nr_chunks)
+			return true;
+
+	return false;
+}
+
 static int snapshot_merge_map(struct dm_target *ti, struct bio *bio)
 {
 	struct dm_exception *e;
@@ -2168,9 +2402,7 @@ static int snapshot_merge_map(struct dm_target *ti, struct bio *bio)
 	if (e) {
 		/* Queue writes overlapping with chunks being merged */
 		if (bio_data_dir(bio) == WRITE &&
-		    chunk >= s->first_merging_chunk &&
-		    chunk < (s->first_merging_chunk +
-			     s->num_merging_chunks)) {
+		    __chunk_is_merging(s, chunk)) {
 			bio_set_dev(bio, s->origin->bdev);
 			bio_list_add(&s->bios_queued_during_merge, bio);
 			r = DM_MAPIO_SUBMITTED;
@@ -2366,6 +2598,21 @@ static void snapshot_status(struct dm_target *ti, status_type_t type,
 			}
 			else
 				DMEMIT("Unknown");
+
+			/*
+			 * Merge progress: chunks merged, metadata commits
+			 * and milliseconds spent merging.
+			 */
+			if (dm_target_is_snapshot_merge(ti)) {
+				unsigned long merge_jiffies = snap->merge_jiffies;
+
+				if (test_bit(RUNNING_MERGE, &snap->state_bits))
+					merge_jiffies += jiffies - snap->merge_start;
+				DMEMIT(" %llu %llu %u",
+				       (unsigned long long)snap->merged_chunks,
+				       (unsigned long long)snap->merge_commits,
+				       jiffies_to_msecs(merge_jiffies));
+			}
 		}
 
 		up_write(&snap->lock);
@@ -2482,9 +2729,9 @@ static int __origin_write(struct list_head *snapshots, sector_t sector,
 		 * different chunk sizes.
 		 */
 		chunk = sector_to_chunk(snap->store, sector);
-		dm_exception_table_lock_init(snap, chunk, &lock);
 
 		down_read(&snap->lock);
+		dm_exception_table_lock_init(snap, chunk, &lock);
 		dm_exception_table_lock(&lock);
 
 		/* Only deal with valid and active snapshots */
@@ -2788,7 +3035,7 @@ static struct target_type snapshot_target = {
 
 static struct target_type merge_target = {
 	.name    = dm_snapshot_merge_target_name,
-	.version = {1, 5, 0},
+	.version = {1, 6, 0},
 	.module  = THIS_MODULE,
 	.ctr     = snapshot_ctr,
 	.dtr     = snapshot_dtr,
@@ -9,11 +9,14 @@
 
 #include <linux/bio.h>
 #include <linux/init.h>
+#include <linux/log2.h>
 #include <linux/mempool.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/poll.h>
 #include <linux/uio.h>
+#include <linux/vmalloc.h>
 #include <linux/wait.h>
 #include <linux/workqueue.h>
 
@@ -21,6 +24,12 @@
 
 #define MAX_OUTSTANDING_MESSAGES 128
 
+/*
+ * Bytes of data each ring slot holds.  BIOs are split to this size so that
+ * any of them fits in a single slot.
+ */
+#define RING_SLOT_SIZE (256 * 1024)
+
 static unsigned int daemon_timeout_msec = 4000;
 module_param_named(dm_user_daemon_timeout_msec, daemon_timeout_msec, uint,
 		   0644);
@@ -55,6 +64,13 @@ MODULE_PARM_DESC(dm_user_daemon_timeout_msec,
  *  - dev_write(), which looks up a message (keyed by sequence number) and
  *    completes the corresponding BIO.
  *
+ * A channel can instead be switched to a ring shared with userspace, in
+ * which case both halves are done in batches by dev_ring_enter(): responses
+ * are read from the completion queue and their BIOs completed, then pending
+ * messages are written to the submission queue.  BIO data is exchanged
+ * through slots in the same mapping, which saves a system call and a copy
+ * to or from userspace per BIO.
+ *
  * Lock ordering (outer to inner)
  *
  * 1) miscdevice's global lock.  This is held around dev_open, so it has to be
@@ -182,6 +198,26 @@ struct channel {
 	 * only ever be pointer to by from_user_cur, and will never have a BIO.
 	 */
 	struct message scratch_message_from_user;
+
+	/*
+	 * Ring mode, see include/uapi/linux/dm-user.h.  Messages that have been
+	 * posted to the ring are kept in the slot holding their data until the
+	 * response is consumed, rather than on from_user.  ring is set last
+	 * and never changes afterwards, so dev_mmap() can check it without
+	 * taking the channel lock.
+	 */
+	void *ring;
+	size_t ring_size;
+	u32 ring_entries;
+	struct dm_user_ring_header *ring_hdr;
+	struct dm_user_ring_req *ring_sq;
+	struct dm_user_ring_resp *ring_cq;
+	void *ring_data;
+	u32 ring_sq_tail;
+	u32 ring_cq_head;
+	struct message **ring_slots;
+	u32 *ring_free;
+	u32 ring_nr_free;
 };
 
 static void message_kill(struct message *m, mempool_t *pool)
@@ -527,6 +563,28 @@ static ssize_t bio_copy_to_iter(struct bio *bio, struct iov_iter *iter)
 	return out;
 }
 
+static void bio_copy_to_buf(struct bio *bio, void *buf)
+{
+	struct bio_vec bvec;
+	struct bvec_iter biter;
+
+	bio_for_each_segment (bvec, bio, biter) {
+		memcpy_from_bvec(buf, &bvec);
+		buf += bvec.bv_len;
+	}
+}
+
+static void bio_copy_from_buf(struct bio *bio, const void *buf)
+{
+	struct bio_vec bvec;
+	struct bvec_iter biter;
+
+	bio_for_each_segment (bvec, bio, biter) {
+		memcpy_to_bvec(&bvec, buf);
+		buf += bvec.bv_len;
+	}
+}
+
 static ssize_t msg_copy_to_iov(struct message *msg, struct iov_iter *to)
 {
 	ssize_t copied = 0;
@@ -733,9 +791,17 @@ static struct channel *channel_alloc(struct target *t)
 	return c;
 }
 
+static void ring_free(struct channel *c)
+{
+	vfree(c->ring);
+	kfree(c->ring_slots);
+	kfree(c->ring_free);
+}
+
 static void channel_free(struct channel *c)
 {
 	struct list_head *cur, *tmp;
+	u32 i;
 
 	lockdep_assert_held(&c->lock);
 
@@ -759,6 +825,11 @@ static void channel_free(struct channel *c)
 	list_for_each_safe (cur, tmp, &c->from_user)
 		message_kill(list_entry(cur, struct message, from_user),
 			     &c->target->message_pool);
+	for (i = 0; i < c->ring_entries; i++)
+		if (c->ring_slots[i] != NULL)
+			message_kill(c->ring_slots[i],
+				     &c->target->message_pool);
+	ring_free(c);
 
 	mutex_lock(&c->target->lock);
 	target_put(c->target);
@@ -810,6 +881,11 @@ static ssize_t dev_read(struct kiocb *iocb, struct iov_iter *to)
 		goto cleanup_unlock;
 	}
 
+	if (unlikely(c->ring)) {
+		total_processed = -EINVAL;
+		goto cleanup_unlock;
+	}
+
 	if (c->cur_to_user == NULL) {
 		struct target *t = target_from_channel(c);
 
@@ -905,6 +981,11 @@ static ssize_t dev_write(struct kiocb *iocb, struct iov_iter *from)
 		goto cleanup_unlock;
 	}
 
+	if (unlikely(c->ring)) {
+		total_processed = -EINVAL;
+		goto cleanup_unlock;
+	}
+
 	/*
 	 * cur_from_user can never be NULL.  If there's no real message it must
 	 * point to the scratch space.
@@ -1004,6 +1085,311 @@ cleanup_unlock:
 	return total_processed;
 }
 
+static inline void *ring_slot_data(struct channel *c, u32 slot)
+{
+	return c->ring_data + (size_t)slot * RING_SLOT_SIZE;
+}
+
+static long dev_ring_setup(struct channel *c,
+			   struct dm_user_ring_setup __user *arg)
+{
+	struct dm_user_ring_setup setup;
+	void *ring;
+	u32 i;
+	long r = 0;
+
+	if (copy_from_user(&setup, arg, sizeof(setup)))
+		return -EFAULT;
+
+	if (!setup.entries || !is_power_of_2(setup.entries) ||
+	    setup.entries > DM_USER_RING_MAX_ENTRIES)
+		return -EINVAL;
+
+	setup.slot_size = RING_SLOT_SIZE;
+	setup.sq_off = sizeof(struct dm_user_ring_header);
+	setup.cq_off = setup.sq_off +
+		       setup.entries * sizeof(struct dm_user_ring_req);
+	setup.data_off = PAGE_ALIGN(setup.cq_off + setup.entries *
+				    sizeof(struct dm_user_ring_resp));
+	setup.size = setup.data_off + (u64)setup.entries * RING_SLOT_SIZE;
+
+	mutex_lock(&c->lock);
+
+	/*
+	 * Switching has to happen before the channel takes any message, so
+	 * every message a channel owns is either on from_user or in a slot.
+	 */
+	if (c->ring || c->cur_to_user || !list_empty(&c->from_user) ||
+	    c->scratch_message_from_user.posn_from_user) {
+		r = -EBUSY;
+		goto cleanup_unlock;
+	}
+
+	c->ring_slots = kcalloc(setup.entries, sizeof(*c->ring_slots),
+				GFP_KERNEL);
+	c->ring_free = kcalloc(setup.entries, sizeof(*c->ring_free),
+			       GFP_KERNEL);
+	ring = vmalloc_user(setup.size);
+	if (!c->ring_slots || !c->ring_free || !ring) {
+		vfree(ring);
+		ring_free(c);
+		c->ring_slots = NULL;
+		c->ring_free = NULL;
+		r = -ENOMEM;
+		goto cleanup_unlock;
+	}
+
+	c->ring_size = setup.size;
+	c->ring_entries = setup.entries;
+	c->ring_hdr = ring;
+	c->ring_sq = ring + setup.sq_off;
+	c->ring_cq = ring + setup.cq_off;
+	c->ring_data = ring + setup.data_off;
+	for (i = 0; i < setup.entries; i++)
+		c->ring_free[i] = setup.entries - 1 - i;
+	c->ring_nr_free = setup.entries;
+	/* Pairs with dev_mmap() */
+	smp_store_release(&c->ring, ring);
+
+cleanup_unlock:
+	mutex_unlock(&c->lock);
+
+	if (!r && copy_to_user(arg, &setup, sizeof(setup)))
+		r = -EFAULT;
+	return r;
+}
+
+/*
+ * Completes the BIOs of all the responses posted by userspace.
+ */
+static int ring_complete(struct channel *c)
+{
+	struct target *t = target_from_channel(c);
+	u32 head = c->ring_cq_head;
+	u32 tail;
+	int r = 0;
+
+	lockdep_assert_held(&c->lock);
+
+	/* Pairs with userspace's store of the tail, after the entries */
+	tail = smp_load_acquire(&c->ring_hdr->cq.tail);
+	if (tail - head > c->ring_entries) {
+		pr_info("user provided an invalid completion tail of %x\n", tail);
+		return -EINVAL;
+	}
+
+	while (head != tail) {
+		struct dm_user_ring_resp resp;
+		struct message *m;
+
+		/* Userspace may rewrite the entry while we look at it */
+		memcpy(&resp, &c->ring_cq[head & (c->ring_entries - 1)],
+		       sizeof(resp));
+		if (resp.slot >= c->ring_entries ||
+		    c->ring_slots[resp.slot] == NULL ||
+		    c->ring_slots[resp.slot]->msg.seq != resp.seq) {
+			pr_info("user provided an invalid messag seq of %llx\n",
+				resp.seq);
+			r = -EINVAL;
+			break;
+		}
+
+		m = c->ring_slots[resp.slot];
+		if (resp.type == DM_USER_RESP_SUCCESS) {
+			if (bio_op(m->bio) == REQ_OP_READ)
+				bio_copy_from_buf(m->bio,
+						  ring_slot_data(c, resp.slot));
+			m->bio->bi_status = BLK_STS_OK;
+		} else {
+			m->bio->bi_status = BLK_STS_IOERR;
+		}
+		bio_endio(m->bio);
+		mempool_free(m, &t->message_pool);
+
+		c->ring_slots[resp.slot] = NULL;
+		c->ring_free[c->ring_nr_free++] = resp.slot;
+		head++;
+	}
+
+	c->ring_cq_head = head;
+	/* Hands the entries, and the slots they referenced, back to userspace */
+	smp_store_release(&c->ring_hdr->cq.head, head);
+	return r;
+}
+
+/*
+ * Posts as many pending messages as there are free slots and submission
+ * queue entries, returning how many were posted.
+ */
+static int ring_submit(struct channel *c)
+{
+	struct target *t = target_from_channel(c);
+	u32 first = c->ring_sq_tail, tail = first;
+	u32 head = READ_ONCE(c->ring_hdr->sq.head);
+	u32 nr_free = c->ring_nr_free, i;
+
+	lockdep_assert_held(&c->lock);
+
+	mutex_lock(&t->lock);
+
+	if (unlikely(t->dm_destroyed)) {
+		/* See dev_read() */
+		mutex_unlock(&t->lock);
+		return -ENOTBLK;
+	}
+
+	/* Pairs with the barrier in user_map(), as in dev_read() */
+	smp_rmb();
+
+	while (c->ring_nr_free && tail - head < c->ring_entries) {
+		struct dm_user_ring_req *req;
+		struct message *m;
+		u32 slot;
+
+		m = msg_get_to_user(t);
+		if (m == NULL)
+			break;
+
+		/* user_ctr() limits the BIO size, so this can't happen */
+		if (WARN_ON_ONCE(m->msg.len > RING_SLOT_SIZE &&
+				 (bio_op(m->bio) == REQ_OP_READ ||
+				  bio_op(m->bio) == REQ_OP_WRITE))) {
+			message_kill(m, &t->message_pool);
+			continue;
+		}
+
+		slot = c->ring_free[--c->ring_nr_free];
+		c->ring_slots[slot] = m;
+
+		req = &c->ring_sq[tail & (c->ring_entries - 1)];
+		req->seq = m->msg.seq;
+		req->type = m->msg.type;
+		req->flags = m->msg.flags;
+		req->sector = m->msg.sector;
+		req->len = m->msg.len;
+		req->slot = slot;
+		req->reserved = 0;
+		tail++;
+	}
+
+	mutex_unlock(&t->lock);
+
+	/*
+	 * The messages now belong to the channel, so their data can be copied
+	 * without holding up user_map().  The slots just taken are still in
+	 * ring_free above ring_nr_free, which unlike the entries can't be
+	 * modified by userspace.
+	 */
+	for (i = c->ring_nr_free; i < nr_free; i++) {
+		u32 slot = c->ring_free[i];
+		struct bio *bio = c->ring_slots[slot]->bio;
+
+		if (bio_op(bio) == REQ_OP_WRITE)
+			bio_copy_to_buf(bio, ring_slot_data(c, slot));
+	}
+
+	c->ring_sq_tail = tail;
+	/* Publishes the entries and their data before the new tail */
+	smp_store_release(&c->ring_hdr->sq.tail, tail);
+	return tail - first;
+}
+
+static long dev_ring_enter(struct channel *c, unsigned long flags)
+{
+	struct target *t = target_from_channel(c);
+	long r;
+
+	if (flags & ~DM_USER_RING_ENTER_WAIT)
+		return -EINVAL;
+
+	mutex_lock(&c->lock);
+
+	if (unlikely(!c->ring)) {
+		r = -EINVAL;
+		goto cleanup_unlock;
+	}
+
+	if (unlikely(c->from_user_error)) {
+		r = c->from_user_error;
+		goto cleanup_unlock;
+	}
+
+	r = ring_complete(c);
+	if (unlikely(r)) {
+		c->from_user_error = r;
+		goto cleanup_unlock;
+	}
+
+	for (;;) {
+		if (unlikely(c->to_user_error)) {
+			r = c->to_user_error;
+			break;
+		}
+
+		r = ring_submit(c);
+		if (unlikely(r < 0)) {
+			c->to_user_error = r;
+			break;
+		}
+
+		/*
+		 * With every slot in use only a response can make progress,
+		 * so there is no point in sleeping.
+		 */
+		if (r || !(flags & DM_USER_RING_ENTER_WAIT) ||
+		    !c->ring_nr_free)
+			break;
+
+		mutex_unlock(&c->lock);
+		r = wait_event_interruptible(t->wq, target_poll(t));
+		mutex_lock(&c->lock);
+		if (unlikely(r))
+			break;
+	}
+
+cleanup_unlock:
+	mutex_unlock(&c->lock);
+	return r;
+}
+
+static long dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct channel *c = channel_from_file(file);
+
+	switch (cmd) {
+	case DM_USER_IOC_RING_SETUP:
+		return dev_ring_setup(c, (void __user *)arg);
+	case DM_USER_IOC_RING_ENTER:
+		return dev_ring_enter(c, arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct channel *c = channel_from_file(file);
+	/*
+	 * This runs under mmap_lock, which the channel lock nests outside of
+	 * when copying to and from userspace, so it can't be taken here.
+	 * Pairs with dev_ring_setup().
+	 */
+	void *ring = smp_load_acquire(&c->ring);
+
+	if (ring == NULL || !(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring, vma->vm_pgoff);
+}
+
+static __poll_t dev_poll(struct file *file, poll_table *wait)
+{
+	struct target *t = target_from_channel(channel_from_file(file));
+
+	poll_wait(file, &t->wq, wait);
+	return target_poll(t) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
 static int dev_release(struct inode *inode, struct file *file)
 {
 	struct channel *c;
@@ -1021,6 +1407,10 @@ static const struct file_operations file_operations = {
 	.llseek = no_llseek,
 	.read_iter = dev_read,
 	.write_iter = dev_write,
+	.poll = dev_poll,
+	.unlocked_ioctl = dev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.mmap = dev_mmap,
 	.release = dev_release,
 };
 
@@ -1048,6 +1438,11 @@ static int user_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	ti->num_flush_bios = 1;
 	ti->flush_supported = true;
 
+	/* Every BIO has to fit in a ring slot */
+	r = dm_set_target_max_io_len(ti, RING_SLOT_SIZE >> SECTOR_SHIFT);
+	if (r)
+		goto cleanup_target;
+
 	/*
 	 * We begin with a single reference to the target, which is miscdev's
 	 * reference.  This ensures that the target won't be freed
@@ -1101,6 +1496,7 @@ cleanup_misc_name:
 	kfree(t->miscdev.name);
 cleanup_message_pool:
 	mempool_exit(&t->message_pool);
+cleanup_target:
 	kfree(t);
 cleanup_none:
 	return r;
@@ -1255,7 +1651,7 @@ static int user_map(struct dm_target *ti, struct bio *bio)
 
 static struct target_type user_target = {
 	.name = "user",
-	.version = { 1, 0, 0 },
+	.version = { 1, 1, 0 },
 	.module = THIS_MODULE,
 	.ctr = user_ctr,
 	.dtr = user_dtr,
@@ -1311,7 +1311,7 @@ static int xmit_ipc_to_pktproc(struct mem_link_device *mld, struct sk_buff *skb)
 
 	if (ppa_ul->num_queue == 1)
 		q = ppa_ul->q[PKTPROC_UL_QUEUE_0];
-	else if (skb->queue_mapping == 1)
+	else if (skb->queue_mapping == VNET_TXQ_HIPRIO)
 		q = ppa_ul->q[PKTPROC_UL_HIPRIO];
 	else
 		q = ppa_ul->q[PKTPROC_UL_NORM];
@@ -1497,7 +1497,7 @@ static int xmit_to_cp(struct mem_link_device *mld, struct io_device *iod,
 			return xmit_ipc_to_dev(mld, ch, skb, IPC_MAP_FMT);
 
 #if IS_ENABLED(CONFIG_MODEM_IF_LEGACY_QOS)
-		if (skb->queue_mapping == 1)
+		if (skb->queue_mapping == VNET_TXQ_HIPRIO)
 			return xmit_ipc_to_dev(mld, ch, skb, IPC_MAP_HPRIO_RAW);
 #endif
 		return xmit_ipc_to_dev(mld, ch, skb, IPC_MAP_NORM_RAW);
@@ -96,7 +96,8 @@ void cpif_pcie_iommu_reset(struct pktproc_queue *q)
 		idx = circ_new_ptr(q->num_desc, idx, 1);
 	}
 
-	/* Initialize */
+	/* Initialize, dropping the unmaps still waiting for a TLB sync */
+	pcie_iommu_tlb_sync(mc->pcie_ch_num);
 	pcie_iommu_tlb_invalidate_all(mc->pcie_ch_num);
 	if (ioc->pf_cache.va) {
 		__page_frag_cache_drain(virt_to_page(ioc->pf_cache.va),
@@ -108,7 +109,6 @@ void cpif_pcie_iommu_reset(struct pktproc_queue *q)
 void *cpif_pcie_iommu_map_va(struct pktproc_queue *q, unsigned long src_pa,
 			     u32 idx, u32 *map_cnt)
 {
-	struct modem_ctl *mc = dev_get_drvdata(q->ppa->dev);
 	struct cpif_pcie_iommu_ctrl *ioc = &q->ioc;
 	const size_t pf_size = q->ppa->true_packet_size;
 	void *addr_des, *addr_asc;
@@ -123,11 +123,15 @@ void *cpif_pcie_iommu_map_va(struct pktproc_queue *q, unsigned long src_pa,
 		return NULL;
 	}
 
-	/* Map the last page */
+	/*
+	 * Queue the mapping of the last page. The queued mappings are issued
+	 * as one batch when the queue is full or the refill is done, and the
+	 * descriptors they cover are handed to CP only after that.
+	 */
 	*map_cnt = 0;
 	if (ioc->map_page_va != ioc->pf_cache.va) {
+		struct pcie_iommu_map_req *req;
 		unsigned long map_size, tailroom;
-		int ret;
 
 		if (!ioc->map_src_pa)
 			goto set_map;
@@ -137,21 +141,26 @@ void *cpif_pcie_iommu_map_va(struct pktproc_queue *q, unsigned long src_pa,
 		if (map_size > tailroom)
 			map_size = tailroom;
 
-		ret = pcie_iommu_map(ioc->map_src_pa, virt_to_phys(ioc->map_page_va),
-				     map_size, 0, mc->pcie_ch_num);
-		if (ret) {
-			mif_err("map failure idx:%u src_pa:0x%lX va:0x%p size:0x%lX\n",
-				ioc->map_idx, ioc->map_src_pa, ioc->map_page_va, map_size);
+		/* Make room first, the batch is rolled back if it fails */
+		if (ioc->map_req_cnt >= CPIF_PCIE_IOMMU_MAP_BATCH &&
+		    cpif_pcie_iommu_map_flush(q, map_cnt)) {
+			page_frag_free(addr_des);
 			return NULL;
 		}
-		ioc->mapped_cnt++;
-		ioc->mapped_size += map_size;
+
+		if (!ioc->map_req_cnt)
+			ioc->map_pending_idx = ioc->map_idx;
+
+		req = &ioc->map_req[ioc->map_req_cnt++];
+		req->iova = ioc->map_src_pa;
+		req->paddr = virt_to_phys(ioc->map_page_va);
+		req->size = map_size;
 
 		/* Store the last mapping size */
 		if (!idx)
 			ioc->end_map_size = (u32)map_size;
 
-		*map_cnt = circ_get_usage(q->num_desc, idx, ioc->map_idx);
+		ioc->map_pending_desc += circ_get_usage(q->num_desc, idx, ioc->map_idx);
 
 set_map:
 		ioc->map_src_pa = src_pa;
@@ -196,15 +205,99 @@ void cpif_pcie_iommu_try_ummap_va(struct pktproc_queue *q, unsigned long src_pa,
 	if (src_pa >= ioc->unmap_src_pa && src_pa < ioc->unmap_src_pa + unmap_size)
 		return;
 
-	ret = pcie_iommu_unmap(ioc->unmap_src_pa, unmap_size, mc->pcie_ch_num);
+	/* TLB is invalidated by cpif_pcie_iommu_unmap_flush() at the end of a poll */
+	ret = pcie_iommu_unmap_deferred(ioc->unmap_src_pa, unmap_size, mc->pcie_ch_num);
 	if (ret != unmap_size) {
 		mif_err("invalid unmap size:0x%zX expected:0x%X src_pa:0x%lX\n",
 			ret, unmap_size, ioc->unmap_src_pa);
 	}
 	ioc->mapped_cnt--;
 	ioc->mapped_size -= unmap_size;
+	ioc->unmaps++;
 
 set_unmap:
 	ioc->unmap_src_pa = src_pa;
 	ioc->unmap_page_size = page_size(virt_to_head_page(addr));
 }
+
+/*
+ * Give back the buffers filled since the first descriptor of a failed batch,
+ * including the page still being filled, so that the next refill starts
+ * over from there with a new page.
+ */
+static void cpif_pcie_iommu_map_rollback(struct pktproc_queue *q)
+{
+	struct cpif_pcie_iommu_ctrl *ioc = &q->ioc;
+	u32 idx = ioc->map_pending_idx;
+
+	while (idx != ioc->curr_fore) {
+		if (q->ppa->buff_rgn_cached && !q->ppa->use_hw_iocc && q->dma_addr[idx]) {
+			dma_unmap_single_attrs(q->ppa->dev, q->dma_addr[idx],
+					       q->ppa->max_packet_size, DMA_FROM_DEVICE, 0);
+			q->dma_addr[idx] = 0;
+		}
+		page_frag_free(ioc->pf_buf[idx]);
+		ioc->pf_buf[idx] = NULL;
+		idx = circ_new_ptr(q->num_desc, idx, 1);
+	}
+
+	if (ioc->pf_cache.va) {
+		__page_frag_cache_drain(virt_to_page(ioc->pf_cache.va),
+					ioc->pf_cache.pagecnt_bias);
+		ioc->pf_cache.va = NULL;
+	}
+
+	ioc->curr_fore = ioc->map_pending_idx;
+	ioc->map_src_pa = 0;
+	ioc->map_page_va = NULL;
+	ioc->map_req_cnt = 0;
+	ioc->map_pending_desc = 0;
+}
+
+/*
+ * Issue the queued mappings at once. On success, @map_cnt is set to the
+ * number of descriptors that became usable by CP. On failure, nothing of
+ * the batch is mapped and the buffers behind it are given back.
+ */
+int cpif_pcie_iommu_map_flush(struct pktproc_queue *q, u32 *map_cnt)
+{
+	struct modem_ctl *mc = dev_get_drvdata(q->ppa->dev);
+	struct cpif_pcie_iommu_ctrl *ioc = &q->ioc;
+	u32 i;
+	int ret;
+
+	*map_cnt = 0;
+	if (!ioc->map_req_cnt)
+		return 0;
+
+	ret = pcie_iommu_map_batch(ioc->map_req, ioc->map_req_cnt, 0, mc->pcie_ch_num);
+	if (ret) {
+		mif_err("batch map failure cnt:%u src_pa:0x%lX ret:%d\n",
+			ioc->map_req_cnt, ioc->map_req[0].iova, ret);
+		cpif_pcie_iommu_map_rollback(q);
+		return ret;
+	}
+
+	for (i = 0; i < ioc->map_req_cnt; i++)
+		ioc->mapped_size += ioc->map_req[i].size;
+	ioc->mapped_cnt += ioc->map_req_cnt;
+	ioc->maps += ioc->map_req_cnt;
+	ioc->map_batches++;
+
+	*map_cnt = ioc->map_pending_desc;
+	ioc->map_req_cnt = 0;
+	ioc->map_pending_desc = 0;
+
+	return 0;
+}
+
+/* Called once per NAPI poll to invalidate the TLB for all unmaps of the poll */
+void cpif_pcie_iommu_unmap_flush(struct pktproc_queue *q)
+{
+	struct modem_ctl *mc = dev_get_drvdata(q->ppa->dev);
+	struct cpif_pcie_iommu_ctrl *ioc = &q->ioc;
+
+	ioc->polls++;
+	if (pcie_iommu_tlb_sync(mc->pcie_ch_num))
+		ioc->tlb_syncs++;
+}
@@ -17,5 +17,7 @@ void *cpif_pcie_iommu_map_va(struct pktproc_queue *q, unsigned long src_pa,
 			     u32 idx, u32 *map_cnt);
 void cpif_pcie_iommu_try_ummap_va(struct pktproc_queue *q, unsigned long src_pa,
 				  void *addr, u32 idx);
+int cpif_pcie_iommu_map_flush(struct pktproc_queue *q, u32 *map_cnt);
+void cpif_pcie_iommu_unmap_flush(struct pktproc_queue *q);
 
 #endif /* __LINK_DEVICE_PCIE_IOMMU_H__ */
@@ -5,6 +5,8 @@
  */
 
 #include <asm/cacheflush.h>
+#include <linux/cpuidle.h>
+#include <linux/sched/clock.h>
 #include <net/ip.h>
 #include <net/ipv6.h>
 #include <net/ip6_checksum.h>
@@ -492,6 +494,15 @@ dma_map:
 #endif
 	}
 
+#if IS_ENABLED(CONFIG_LINK_DEVICE_PCIE_IOMMU)
+	if (cpif_pcie_iommu_map_flush(q, &fore_inc)) {
+		spin_unlock_irqrestore(&q->lock, flags);
+		return -ENOMEM;
+	}
+	if (fore_inc)
+		*q->fore_ptr = circ_new_ptr(q->num_desc, *q->fore_ptr, fore_inc);
+#endif
+
 	pp_debug("Q:%d fore/rear/done:%d/%d/%d\n",
 			q->q_idx, *q->fore_ptr, *q->rear_ptr, q->done_ptr);
 
@@ -1008,6 +1019,11 @@ static int pktproc_clean_rx_ring(struct pktproc_queue *q, int budget, int *work_
 			break;
 	}
 
+#if IS_ENABLED(CONFIG_LINK_DEVICE_PCIE_IOMMU)
+	if (!q->manager)
+		cpif_pcie_iommu_unmap_flush(q);
+#endif
+
 	if (rcvd_dit) {
 		dit_kick(DIT_DIR_RX, false);
 
@@ -1253,6 +1269,40 @@ static ssize_t perftest_show(struct device *dev, struct device_attribute *attr,
 	return count;
 }
 
+/*
+ * Idle hint
+ */
+/* Longer gaps mean the traffic stopped rather than slowed down */
+#define PKTPROC_IRQ_MAX_PERIOD_NS	(10 * NSEC_PER_MSEC)
+
+static void pktproc_update_irq_period(struct pktproc_queue *q)
+{
+	u64 now = local_clock();
+	u64 interval = now - q->irq_last_ns;
+
+	q->irq_last_ns = now;
+	if (interval > PKTPROC_IRQ_MAX_PERIOD_NS)
+		q->irq_period_ns = 0;
+	else if (!q->irq_period_ns)
+		q->irq_period_ns = interval;
+	else
+		q->irq_period_ns = (7 * q->irq_period_ns + interval) / 8;
+}
+
+/*
+ * While CP keeps the DMA running the next interrupt follows at about the
+ * same interval. Tell the idle governor of the CPU that handles it, which
+ * is the one running the poll, so that it is not put in a deep state.
+ */
+static void pktproc_hint_next_irq(struct pktproc_queue *q)
+{
+	u64 elapsed = local_clock() - q->irq_last_ns;
+
+	if (q->irq_period_ns && elapsed < q->irq_period_ns)
+		cpuidle_wakeup_hint(smp_processor_id(),
+				    q->irq_period_ns - elapsed);
+}
+
 /*
  * NAPI
  */
@@ -1282,7 +1332,8 @@ static int pktproc_poll(struct napi_struct *napi, int budget)
 	}
 
 	if (rcvd < budget) {
-		napi_complete_done(napi, rcvd);
+		if (napi_complete_done(napi, rcvd) && rcvd)
+			pktproc_hint_next_irq(q);
 		return rcvd;
 	}
 
@@ -1310,6 +1361,8 @@ static irqreturn_t pktproc_irq_handler(int irq, void *arg)
 	if (!pktproc_get_usage(q))
 		return IRQ_HANDLED;
 
+	pktproc_update_irq_period(q);
+
 #if IS_ENABLED(CONFIG_CPIF_TP_MONITOR)
 	tpmon_start();
 #endif
@@ -1438,6 +1491,10 @@ static ssize_t status_show(struct device *dev, struct device_attribute *attr, ch
 			count += scnprintf(&buf[count], PAGE_SIZE - count,
 				"  iommu_mapped cnt:%u size:0x%llX\n",
 				q->ioc.mapped_cnt, q->ioc.mapped_size);
+			count += scnprintf(&buf[count], PAGE_SIZE - count,
+				"  iommu polls:%llu maps:%llu batches:%llu unmaps:%llu tlb_syncs:%llu\n",
+				q->ioc.polls, q->ioc.maps, q->ioc.map_batches,
+				q->ioc.unmaps, q->ioc.tlb_syncs);
 #endif
 			break;
 		default:
@@ -8,6 +8,9 @@
 #define __LINK_RX_PKTPROC_H__
 
 #include "cpif_netrx_mng.h"
+#if IS_ENABLED(CONFIG_LINK_DEVICE_PCIE_IOMMU)
+#include <soc/samsung/exynos-pcie-iommu-exp.h>
+#endif
 
 /* Debug */
 /* #define PKTPROC_DEBUG */
@@ -121,6 +124,8 @@ struct pktproc_statistics {
 };
 
 #if IS_ENABLED(CONFIG_LINK_DEVICE_PCIE_IOMMU)
+#define CPIF_PCIE_IOMMU_MAP_BATCH	16
+
 struct cpif_pcie_iommu_ctrl {
 	struct page_frag_cache pf_cache;
 	u32 pf_offset;
@@ -137,11 +142,22 @@ struct cpif_pcie_iommu_ctrl {
 	/* Was */
 	u32 end_map_size;
 
+	/* Mappings not issued yet and the descriptors they cover */
+	struct pcie_iommu_map_req map_req[CPIF_PCIE_IOMMU_MAP_BATCH];
+	u32 map_req_cnt;
+	u32 map_pending_idx;
+	u32 map_pending_desc;
+
 	/* These elements must be at the end */
 	void **pf_buf;
 	/* Debug */
 	u32 mapped_cnt;
 	u64 mapped_size;
+	u64 polls;
+	u64 maps;
+	u64 map_batches;
+	u64 unmaps;
+	u64 tlb_syncs;
 };
 #endif
 
@@ -203,6 +219,8 @@ struct pktproc_queue {
 
 	/* IRQ */
 	int irq;
+	u64 irq_last_ns;	/* local_clock() at the last DMA interrupt */
+	u64 irq_period_ns;	/* running average of their interval, 0 if none */
 #if IS_ENABLED(CONFIG_MCU_IPC)
 	u32 irq_idx;
 #endif
@@ -905,6 +905,12 @@ static int cpif_probe(struct platform_device *pdev)
 		mif_err("failed to initialize hiprio list(%d)\n", err);
 #endif
 
+#if IS_ENABLED(CONFIG_MODEM_IF_QOS_FQ_CODEL)
+	err = vnet_qdisc_init();
+	if (err)
+		mif_err("failed to register netdev notifier(%d)\n", err);
+#endif
+
 #if IS_ENABLED(CONFIG_CPIF_VENDOR_HOOK)
 	err = hook_init();
 	if (err)
@@ -164,6 +164,11 @@ struct cpif_version {
  */
 #define MAX_IOD_RXQ_LEN		2048
 
+/* TX queues of the network interfaces with QoS */
+#define VNET_TXQ_NORM		0
+#define VNET_TXQ_HIPRIO		1
+#define VNET_NUM_TXQ		2
+
 
 #define IPv6			6
 #define SOURCE_MAC_ADDR		{0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC}
@@ -749,6 +754,9 @@ u8 sipc5_build_config(struct io_device *iod, struct link_device *ld,
 void sipc5_build_header(struct io_device *iod, u8 *buff, u8 cfg,
 				unsigned int tx_bytes, unsigned int remains);
 void vnet_setup(struct net_device *ndev);
+#if IS_ENABLED(CONFIG_MODEM_IF_QOS_FQ_CODEL)
+int vnet_qdisc_init(void);
+#endif
 int sipc5_init_io_device(struct io_device *iod, struct mem_link_device *mld);
 void sipc5_deinit_io_device(struct io_device *iod);
 
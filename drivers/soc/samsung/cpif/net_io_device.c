@@ -20,7 +20,11 @@
 #include <linux/ip.h>
 #include <linux/tcp.h>
 #include <linux/netdevice.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
 #include <net/tcp.h>
+#include <net/dsfield.h>
+#include <net/pkt_sched.h>
 
 #include <soc/samsung/exynos-modem-ctrl.h>
 
@@ -315,25 +319,85 @@ static inline bool is_tcp_ack(struct sk_buff *skb)
 }
 
 #if IS_ENABLED(CONFIG_MODEM_IF_QOS)
+#define DNS_PORT	53
+#define DSCP_EF		46
+
+static bool is_dns_query(struct sk_buff *skb)
+{
+	unsigned int thoff;
+	u8 proto;
+	__be16 *ports;
+	__be16 _ports[2];
+
+	switch (skb->protocol) {
+	case htons(ETH_P_IP):
+		if (ip_is_fragment(ip_hdr(skb)))
+			return false;
+		proto = ip_hdr(skb)->protocol;
+		thoff = skb_network_offset(skb) + (ip_hdr(skb)->ihl << 2);
+		break;
+	case htons(ETH_P_IPV6):
+		proto = ipv6_hdr(skb)->nexthdr;
+		thoff = skb_network_offset(skb) + sizeof(struct ipv6hdr);
+		break;
+	default:
+		return false;
+	}
+
+	if (proto != IPPROTO_UDP && proto != IPPROTO_TCP)
+		return false;
+
+	/* source and destination ports are at the same offset in udp and tcp */
+	ports = skb_header_pointer(skb, thoff, sizeof(_ports), _ports);
+	if (!ports)
+		return false;
+
+	return ports[1] == htons(DNS_PORT);
+}
+
+static bool is_voice_marked(struct sk_buff *skb)
+{
+	u8 dscp;
+
+	switch (skb->protocol) {
+	case htons(ETH_P_IP):
+		dscp = ipv4_get_dsfield(ip_hdr(skb)) >> 2;
+		break;
+	case htons(ETH_P_IPV6):
+		dscp = ipv6_get_dsfield(ipv6_hdr(skb)) >> 2;
+		break;
+	default:
+		return false;
+	}
+
+	/* IMS voice is marked with EF, SO_PRIORITY users with interactive */
+	return dscp == DSCP_EF || skb->priority == TC_PRIO_INTERACTIVE;
+}
+
 static u16 vnet_select_queue(struct net_device *dev, struct sk_buff *skb,
 		struct net_device *sb_dev)
 {
-#if IS_ENABLED(CONFIG_MODEM_IF_LEGACY_QOS)
 	struct vnet *vnet = netdev_priv(dev);
-#endif
 
 	if (!skb)
-		return 0;
+		return VNET_TXQ_NORM;
 
 	if (is_tcp_ack(skb))
-		return 1;
+		return VNET_TXQ_HIPRIO;
+
+	/* The hiprio queue only holds small packets in ack only mode */
+	if (vnet->hiprio_ack_only)
+		return VNET_TXQ_NORM;
+
+	if (is_voice_marked(skb) || is_dns_query(skb))
+		return VNET_TXQ_HIPRIO;
 
 #if IS_ENABLED(CONFIG_MODEM_IF_LEGACY_QOS)
-	if (!vnet->hiprio_ack_only && skb->sk && cpif_qos_get_node(skb->sk->sk_uid.val))
-		return 1;
+	if (skb->sk && cpif_qos_get_node(skb->sk->sk_uid.val))
+		return VNET_TXQ_HIPRIO;
 #endif
 
-	return 0;
+	return VNET_TXQ_NORM;
 }
 #endif
 
@@ -346,6 +410,89 @@ static const struct net_device_ops vnet_ops = {
 #endif
 };
 
+#if IS_ENABLED(CONFIG_MODEM_IF_QOS_FQ_CODEL)
+/*
+ * The stack attaches mq on the first open with the system default qdisc on
+ * each TX queue. Replace those once with fq_codel so that a bulk upload on
+ * the normal queue does not keep a standing queue. A root qdisc installed
+ * by userspace is left as it is.
+ */
+static void vnet_attach_fq_codel(struct net_device *ndev)
+{
+	struct vnet *vnet = netdev_priv(ndev);
+	const struct Qdisc_ops *ops;
+	struct netdev_queue *txq;
+	struct Qdisc *root;
+	struct Qdisc *qdisc;
+	struct Qdisc *old;
+	unsigned int i;
+
+	ASSERT_RTNL();
+
+	if (vnet->fq_codel_attached)
+		return;
+
+	root = rtnl_dereference(ndev->qdisc);
+	if (!(root->flags & TCQ_F_MQROOT))
+		return;
+
+	ops = qdisc_get_ops("fq_codel");
+	if (!ops) {
+		mif_err("%s: fq_codel is not registered\n", ndev->name);
+		return;
+	}
+
+	dev_deactivate(ndev);
+
+	for (i = 0; i < ndev->real_num_tx_queues; i++) {
+		txq = netdev_get_tx_queue(ndev, i);
+		qdisc = qdisc_create_dflt(txq, ops,
+				TC_H_MAKE(TC_H_MAJ(root->handle), TC_H_MIN(i + 1)),
+				NULL);
+		if (!qdisc) {
+			mif_err("%s: ERR! txq %d fq_codel alloc fail\n", ndev->name, i);
+			continue;
+		}
+
+		qdisc->flags |= TCQ_F_ONETXQUEUE | TCQ_F_NOPARENT;
+		old = dev_graft_qdisc(txq, qdisc);
+		if (old)
+			qdisc_put(old);
+		qdisc_hash_add(qdisc, false);
+	}
+
+	dev_activate(ndev);
+	module_put(ops->owner);
+
+	vnet->fq_codel_attached = true;
+	mif_info("%s: fq_codel attached to %d txq\n", ndev->name,
+		 ndev->real_num_tx_queues);
+}
+
+static int vnet_netdev_event(struct notifier_block *nb, unsigned long event,
+		void *ptr)
+{
+	struct net_device *ndev = netdev_notifier_info_to_dev(ptr);
+
+	if (ndev->netdev_ops != &vnet_ops)
+		return NOTIFY_DONE;
+
+	if (event == NETDEV_UP)
+		vnet_attach_fq_codel(ndev);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block vnet_netdev_notifier = {
+	.notifier_call = vnet_netdev_event,
+};
+
+int vnet_qdisc_init(void)
+{
+	return register_netdevice_notifier(&vnet_netdev_notifier);
+}
+#endif
+
 void vnet_setup(struct net_device *ndev)
 {
 	ndev->netdev_ops = &vnet_ops;
@@ -98,7 +98,9 @@ static int devfreq_cooling_set_cur_state(struct thermal_cooling_device *cdev,
 
 	if (dfc->em_pd) {
 		perf_idx = dfc->max_state - state;
-		freq = dfc->em_pd->table[perf_idx].frequency * 1000;
+		rcu_read_lock();
+		freq = em_perf_state_table(dfc->em_pd)[perf_idx].frequency * 1000;
+		rcu_read_unlock();
 	} else {
 		freq = dfc->freq_table[state];
 	}
@@ -121,14 +123,20 @@ static int devfreq_cooling_set_cur_state(struct thermal_cooling_device *cdev,
  */
 static int get_perf_idx(struct em_perf_domain *em_pd, unsigned long freq)
 {
-	int i;
+	struct em_perf_state *table;
+	int i, ret = -EINVAL;
 
+	rcu_read_lock();
+	table = em_perf_state_table(em_pd);
 	for (i = 0; i < em_pd->nr_perf_states; i++) {
-		if (em_pd->table[i].frequency == freq)
-			return i;
+		if (table[i].frequency == freq) {
+			ret = i;
+			break;
+		}
 	}
+	rcu_read_unlock();
 
-	return -EINVAL;
+	return ret;
 }
 
 static unsigned long get_voltage(struct devfreq *df, unsigned long freq)
@@ -200,7 +208,9 @@ static int devfreq_cooling_get_requested_power(struct thermal_cooling_device *cd
 		res = dfc->power_ops->get_real_power(df, power, freq, voltage);
 		if (!res) {
 			state = dfc->capped_state;
-			dfc->res_util = dfc->em_pd->table[state].power;
+			rcu_read_lock();
+			dfc->res_util = em_perf_state_table(dfc->em_pd)[state].power;
+			rcu_read_unlock();
 			dfc->res_util *= SCALE_ERROR_MITIGATION;
 
 			if (*power > 1)
@@ -219,7 +229,9 @@ static int devfreq_cooling_get_requested_power(struct thermal_cooling_device *cd
 		_normalize_load(&status);
 
 		/* Scale power for utilization */
-		*power = dfc->em_pd->table[perf_idx].power;
+		rcu_read_lock();
+		*power = em_perf_state_table(dfc->em_pd)[perf_idx].power;
+		rcu_read_unlock();
 		*power *= status.busy_time;
 		*power >>= 10;
 	}
@@ -243,7 +255,9 @@ static int devfreq_cooling_state2power(struct thermal_cooling_device *cdev,
 		return -EINVAL;
 
 	perf_idx = dfc->max_state - state;
-	*power = dfc->em_pd->table[perf_idx].power;
+	rcu_read_lock();
+	*power = em_perf_state_table(dfc->em_pd)[perf_idx].power;
+	rcu_read_unlock();
 
 	return 0;
 }
@@ -254,6 +268,7 @@ static int devfreq_cooling_power2state(struct thermal_cooling_device *cdev,
 	struct devfreq_cooling_device *dfc = cdev->devdata;
 	struct devfreq *df = dfc->devfreq;
 	struct devfreq_dev_status status;
+	struct em_perf_state *table;
 	unsigned long freq;
 	s32 est_power;
 	int i;
@@ -279,9 +294,12 @@ static int devfreq_cooling_power2state(struct thermal_cooling_device *cdev,
 	 * Find the first cooling state that is within the power
 	 * budget. The EM power table is sorted ascending.
 	 */
+	rcu_read_lock();
+	table = em_perf_state_table(dfc->em_pd);
 	for (i = dfc->max_state; i > 0; i--)
-		if (est_power >= dfc->em_pd->table[i].power)
+		if (est_power >= table[i].power)
 			break;
+	rcu_read_unlock();
 
 	*state = dfc->max_state - i;
 	dfc->capped_state = *state;
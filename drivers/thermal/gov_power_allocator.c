@@ -18,6 +18,7 @@
 #include <trace/hooks/thermal.h>
 
 #include "thermal_core.h"
+#include "gov_power_allocator_forecast.h"
 
 #define INVALID_TRIP -1
 
@@ -69,6 +70,10 @@ static inline s64 div_frac(s64 x, s64 y)
  *					controlling for.
  * @sustainable_power:	Sustainable power (heat) that this thermal zone can
  *			dissipate
+ * @forecast:	online thermal model of the zone, used when tzp->forecast_ms
+ *		is set
+ * @last_sample:	time of the previous sample fed to @forecast
+ * @last_temp:	temperature of the zone at @last_sample
  */
 struct power_allocator_params {
 	bool allocated_tzp;
@@ -80,6 +85,9 @@ struct power_allocator_params {
 #endif
 	int trip_max_desired_temperature;
 	u32 sustainable_power;
+	struct pa_forecast forecast;
+	ktime_t last_sample;
+	int last_temp;
 };
 
 /**
@@ -203,9 +211,64 @@ static u32 get_sustainable_power(struct thermal_zone_device *tz,
 	return sustainable_power;
 }
 
+/**
+ * forecast_learn() - Feed the thermal model with the last period
+ * @tz:		thermal zone we are operating in
+ * @power:	power the actors consumed during the last period
+ *
+ * Called on every invocation of the governor, whether it is throttling or
+ * not, so the model also learns how the zone behaves below the switch on
+ * temperature.
+ */
+static void forecast_learn(struct thermal_zone_device *tz, u32 power)
+{
+	struct power_allocator_params *params = tz->governor_data;
+	ktime_t now = ktime_get();
+
+	if (params->last_sample)
+		pa_forecast_learn(&params->forecast, power, params->last_temp,
+				  tz->temperature,
+				  ktime_ms_delta(now, params->last_sample));
+
+	params->last_sample = now;
+	params->last_temp = tz->temperature;
+}
+
+/**
+ * forecast_temp() - Temperature the PID controller should act on
+ * @tz:		thermal zone we are operating in
+ * @control_temp:	the target temperature in millicelsius
+ * @power:	power the actors are currently consuming
+ *
+ * In predictive mode the controller acts on the temperature expected
+ * tzp->forecast_ms ahead if the actors keep consuming @power, so the
+ * budget is cut before the zone overshoots rather than after. The current
+ * temperature is used until the model has converged, and whenever the
+ * zone is already above @control_temp and the forecast would be lower.
+ *
+ * Return: the temperature to feed to the PID controller.
+ */
+static int forecast_temp(struct thermal_zone_device *tz, int control_temp,
+			 u32 power)
+{
+	struct power_allocator_params *params = tz->governor_data;
+	int temp;
+
+	if (tz->tzp->forecast_ms <= 0 || !pa_forecast_ready(&params->forecast))
+		return tz->temperature;
+
+	temp = pa_forecast_temp(&params->forecast, tz->temperature, power,
+				tz->tzp->forecast_ms);
+	if (tz->temperature > control_temp)
+		temp = max(temp, tz->temperature);
+
+	return temp;
+}
+
 /**
  * pid_controller() - PID controller
  * @tz:	thermal zone we are operating in
+ * @current_temp:	the temperature to control, in millicelsius
  * @control_temp:	the target temperature in millicelsius
  * @max_allocatable_power:	maximum allocatable power for this thermal zone
  *
@@ -222,6 +285,7 @@ static u32 get_sustainable_power(struct thermal_zone_device *tz,
  * Return: The power budget for the next period.
  */
 static u32 pid_controller(struct thermal_zone_device *tz,
+			  int current_temp,
 			  int control_temp,
 			  u32 max_allocatable_power)
 {
@@ -234,7 +298,7 @@ static u32 pid_controller(struct thermal_zone_device *tz,
 
 	sustainable_power = get_sustainable_power(tz, params, control_temp);
 
-	err = control_temp - tz->temperature;
+	err = control_temp - current_temp;
 	err = int_to_frac(err);
 
 	/* Calculate the proportional term */
@@ -396,7 +460,7 @@ static int allocate_power(struct thermal_zone_device *tz,
 	u32 *weighted_req_power;
 	u32 total_req_power, max_allocatable_power, total_weighted_req_power;
 	u32 total_granted_power, power_range;
-	int i, num_actors, total_weight, ret = 0;
+	int i, num_actors, total_weight, current_temp, ret = 0;
 	int trip_max_desired_temperature = params->trip_max_desired_temperature;
 
 	mutex_lock(&tz->lock);
@@ -474,7 +538,11 @@ static int allocate_power(struct thermal_zone_device *tz,
 		i++;
 	}
 
-	power_range = pid_controller(tz, control_temp, max_allocatable_power);
+	forecast_learn(tz, total_req_power);
+	current_temp = forecast_temp(tz, control_temp, total_req_power);
+
+	power_range = pid_controller(tz, current_temp, control_temp,
+				     max_allocatable_power);
 	trace_android_vh_thermal_power_cap(&power_range);
 
 	divvy_up_power(weighted_req_power, max_power, num_actors,
@@ -601,7 +669,7 @@ static void allow_maximum_power(struct thermal_zone_device *tz, bool update)
 {
 	struct thermal_instance *instance;
 	struct power_allocator_params *params = tz->governor_data;
-	u32 req_power;
+	u32 req_power, total_req_power = 0;
 
 	mutex_lock(&tz->lock);
 	list_for_each_entry(instance, &tz->thermal_instances, tz_node) {
@@ -618,13 +686,15 @@ static void allow_maximum_power(struct thermal_zone_device *tz, bool update)
 		 * periods of dozen of seconds when those have not been
 		 * maintained.
 		 */
-		cdev->ops->get_requested_power(cdev, &req_power);
+		if (!cdev->ops->get_requested_power(cdev, &req_power))
+			total_req_power += req_power;
 
 		if (update)
 			__thermal_cdev_update(instance->cdev);
 
 		mutex_unlock(&instance->cdev->lock);
 	}
+	forecast_learn(tz, total_req_power);
 	mutex_unlock(&tz->lock);
 }
 
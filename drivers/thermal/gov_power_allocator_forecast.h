@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Online thermal model used by the power allocator governor to forecast
+ * the temperature of a thermal zone.
+ *
+ * The zone is modelled as a first order system, where the rate of change
+ * of the temperature is linear in the power dissipated by the actors and
+ * in the temperature itself:
+ *
+ *	dT/dt = a * P + b * T + c
+ *
+ * a is the heating per mW, b (negative) the cooling towards the ambient
+ * temperature, which is folded into c. The weights are a least squares fit
+ * over exponentially decaying means and covariances of the samples, so the
+ * model keeps following slow changes such as the device being put in a
+ * pocket. Fitting on deviations from the means keeps the 2x2 system small
+ * enough to be solved in 64-bit integers.
+ *
+ * Units: temperatures in millicelsius, power in mW, rates and c in
+ * millicelsius per second, a and b in PA_FC_FRAC_BITS fixed point.
+ *
+ * This file has no kernel-only dependencies so that the ipa_sim tool in
+ * tools/thermal can replay recorded traces through the same code.
+ */
+#ifndef __GOV_POWER_ALLOCATOR_FORECAST_H__
+#define __GOV_POWER_ALLOCATOR_FORECAST_H__
+
+#ifdef __KERNEL__
+#include <linux/math64.h>
+#include <linux/types.h>
+#endif
+
+#define PA_FC_FRAC_BITS		20
+/* Fractional bits of the running means */
+#define PA_FC_MEAN_BITS		8
+/* The statistics decay with a weight of 1/2^PA_FC_DECAY_SHIFT per sample */
+#define PA_FC_DECAY_SHIFT	7
+/* Deviations are clamped so the products below cannot overflow */
+#define PA_FC_MAX_DEV		(1 << 15)
+/* Samples needed before the forecast is trusted */
+#define PA_FC_MIN_SAMPLES	32
+/* Euler integration steps over the forecast horizon */
+#define PA_FC_STEPS		8
+/* Samples further apart than this (e.g. across suspend) are dropped */
+#define PA_FC_MAX_DT_MS		10000
+/*
+ * The fit is rejected when power and temperature are so correlated that
+ * the determinant is below 1/2^PA_FC_MIN_DET_SHIFT of cov_pp * cov_tt
+ */
+#define PA_FC_MIN_DET_SHIFT	6
+/* Bounds of the inputs, weights and forecasts, so s64 cannot overflow */
+#define PA_FC_MAX_POWER		(1 << 24)
+#define PA_FC_MAX_TEMP		(1 << 20)
+#define PA_FC_MAX_RATE		(1 << 20)
+#define PA_FC_MAX_W		(1LL << (PA_FC_FRAC_BITS + 10))
+
+enum { PA_FC_POWER, PA_FC_TEMP, PA_FC_RATE, PA_FC_NR };
+
+/**
+ * struct pa_forecast - learned thermal model of a zone
+ * @mean:	running means of power, temperature and rate, in
+ *		PA_FC_MEAN_BITS fixed point
+ * @cov_pp:	running variance of the power
+ * @cov_tt:	running variance of the temperature
+ * @cov_pt:	running covariance of power and temperature
+ * @cov_py:	running covariance of power and rate
+ * @cov_ty:	running covariance of temperature and rate
+ * @w:		fitted a, b and c
+ * @err_avg:	running average of the absolute prediction error, in
+ *		millicelsius per second
+ * @samples:	number of samples learned so far
+ */
+struct pa_forecast {
+	s64 mean[PA_FC_NR];
+	s64 cov_pp, cov_tt, cov_pt, cov_py, cov_ty;
+	s64 w[3];
+	s64 err_avg;
+	u32 samples;
+};
+
+static inline s64 pa_forecast_clamp(s64 val, s64 max)
+{
+	if (val > max)
+		return max;
+	if (val < -max)
+		return -max;
+	return val;
+}
+
+static inline s64 pa_forecast_rate(const struct pa_forecast *fc, s64 power,
+				   s64 temp)
+{
+	s64 rate;
+
+	power = pa_forecast_clamp(power, PA_FC_MAX_POWER);
+	temp = pa_forecast_clamp(temp, PA_FC_MAX_TEMP);
+	rate = (fc->w[0] * power + fc->w[1] * temp) / (1 << PA_FC_FRAC_BITS) +
+		fc->w[2];
+
+	return pa_forecast_clamp(rate, PA_FC_MAX_RATE);
+}
+
+static inline void pa_forecast_decay(s64 *avg, s64 val)
+{
+	*avg += (val - *avg) / (1 << PA_FC_DECAY_SHIFT);
+}
+
+static inline s64 pa_forecast_dev(const struct pa_forecast *fc, int i, s64 val)
+{
+	return pa_forecast_clamp(val - fc->mean[i] / (1 << PA_FC_MEAN_BITS),
+				 PA_FC_MAX_DEV);
+}
+
+/*
+ * Solve the least squares fit of the rate on power and temperature.
+ * The weights are left alone while the inputs do not vary enough, or
+ * vary too much together, to tell the effect of power and temperature
+ * apart.
+ */
+static inline void pa_forecast_fit(struct pa_forecast *fc)
+{
+	s64 var, det, a, b, c;
+
+	var = fc->cov_pp * fc->cov_tt;
+	det = var - fc->cov_pt * fc->cov_pt;
+	if (det <= 0 || det < var >> PA_FC_MIN_DET_SHIFT)
+		return;
+
+	det /= 1 << PA_FC_FRAC_BITS;
+	if (det <= 0)
+		return;
+
+	a = div64_s64(fc->cov_py * fc->cov_tt - fc->cov_ty * fc->cov_pt, det);
+	b = div64_s64(fc->cov_ty * fc->cov_pp - fc->cov_py * fc->cov_pt, det);
+	a = pa_forecast_clamp(a, PA_FC_MAX_W);
+	b = pa_forecast_clamp(b, PA_FC_MAX_W);
+	c = (fc->mean[PA_FC_RATE] -
+	     (a * fc->mean[PA_FC_POWER] + b * fc->mean[PA_FC_TEMP]) /
+	     (1 << PA_FC_FRAC_BITS)) / (1 << PA_FC_MEAN_BITS);
+
+	fc->w[0] = a;
+	fc->w[1] = b;
+	fc->w[2] = pa_forecast_clamp(c, PA_FC_MAX_RATE);
+}
+
+/**
+ * pa_forecast_learn() - update the model with a new sample
+ * @fc:		model to update
+ * @power:	power dissipated since the previous sample
+ * @prev_temp:	temperature at the previous sample
+ * @temp:	current temperature
+ * @dt_ms:	time elapsed since the previous sample
+ */
+static inline void pa_forecast_learn(struct pa_forecast *fc, u32 power,
+				     int prev_temp, int temp, s64 dt_ms)
+{
+	s64 x[PA_FC_NR], dp, dt, dy, err;
+	int i;
+
+	if (dt_ms <= 0 || dt_ms > PA_FC_MAX_DT_MS)
+		return;
+
+	x[PA_FC_POWER] = pa_forecast_clamp(power, PA_FC_MAX_POWER);
+	x[PA_FC_TEMP] = pa_forecast_clamp(prev_temp, PA_FC_MAX_TEMP);
+	x[PA_FC_RATE] = div64_s64((pa_forecast_clamp(temp, PA_FC_MAX_TEMP) -
+				   x[PA_FC_TEMP]) * 1000, dt_ms);
+
+	err = x[PA_FC_RATE] - pa_forecast_rate(fc, power, prev_temp);
+	if (err < 0)
+		err = -err;
+
+	for (i = 0; i < PA_FC_NR; i++) {
+		if (!fc->samples)
+			fc->mean[i] = x[i] * (1 << PA_FC_MEAN_BITS);
+		else
+			pa_forecast_decay(&fc->mean[i],
+					  x[i] * (1 << PA_FC_MEAN_BITS));
+	}
+
+	dp = pa_forecast_dev(fc, PA_FC_POWER, x[PA_FC_POWER]);
+	dt = pa_forecast_dev(fc, PA_FC_TEMP, x[PA_FC_TEMP]);
+	dy = pa_forecast_dev(fc, PA_FC_RATE, x[PA_FC_RATE]);
+
+	pa_forecast_decay(&fc->cov_pp, dp * dp);
+	pa_forecast_decay(&fc->cov_tt, dt * dt);
+	pa_forecast_decay(&fc->cov_pt, dp * dt);
+	pa_forecast_decay(&fc->cov_py, dp * dy);
+	pa_forecast_decay(&fc->cov_ty, dt * dy);
+
+	pa_forecast_fit(fc);
+
+	if (fc->samples)
+		pa_forecast_decay(&fc->err_avg, err);
+	fc->samples++;
+}
+
+/**
+ * pa_forecast_ready() - check whether the model can be used
+ * @fc:		model to check
+ *
+ * The model is only trusted once it has seen enough samples and describes
+ * a zone that heats up with power and cools down on its own.
+ */
+static inline bool pa_forecast_ready(const struct pa_forecast *fc)
+{
+	return fc->samples >= PA_FC_MIN_SAMPLES && fc->w[0] > 0 && fc->w[1] < 0;
+}
+
+/**
+ * pa_forecast_temp() - forecast the temperature of the zone
+ * @fc:		model to use
+ * @temp:	current temperature
+ * @power:	power the actors are assumed to keep dissipating
+ * @horizon_ms:	how far ahead to forecast
+ *
+ * Return: the temperature expected in @horizon_ms.
+ */
+static inline int pa_forecast_temp(const struct pa_forecast *fc, int temp,
+				   u32 power, s64 horizon_ms)
+{
+	s64 t = temp, step_ms = horizon_ms / PA_FC_STEPS;
+	int i;
+
+	for (i = 0; i < PA_FC_STEPS; i++) {
+		t += div64_s64(pa_forecast_rate(fc, power, t) * step_ms, 1000);
+		t = pa_forecast_clamp(t, PA_FC_MAX_TEMP);
+	}
+
+	return t;
+}
+
+#endif /* __GOV_POWER_ALLOCATOR_FORECAST_H__ */
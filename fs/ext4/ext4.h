@@ -1743,6 +1743,10 @@ struct ext4_sb_info {
 	struct buffer_head *s_fc_bh;
 	struct ext4_fc_stats s_fc_stats;
 	tid_t s_fc_ineligible_tid;
+	/* fsync batching, see ext4_fc_batch_wait() */
+	unsigned int s_fc_max_batch_time;	/* in us, 0 disables it */
+	pid_t s_fc_last_fsync_pid;
+	ktime_t s_fc_last_commit;
 #ifdef CONFIG_EXT4_DEBUG
 	int s_fc_debug_max_replay;
 #endif
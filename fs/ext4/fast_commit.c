@@ -1134,6 +1134,43 @@ static void ext4_fc_update_stats(struct super_block *sb, int status,
 	trace_ext4_fc_commit_stop(sb, nblks, status);
 }
 
+/*
+ * Fsync group commit. When the last fsync came from another task and fast
+ * commits are being issued back to back, wait a little before starting a
+ * fast commit so that the other tasks fsyncing at the same time get their
+ * inodes into it, the way jbd2 batches synchronous handles. The wait is
+ * bounded by the average fast commit time and by s_fc_max_batch_time.
+ * Returns true if the task waited.
+ */
+static bool ext4_fc_batch_wait(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_stats *stats = &sbi->s_fc_stats;
+	pid_t pid = current->pid;
+	ktime_t start, expires;
+	u64 batch_time;
+
+	if (!sbi->s_fc_max_batch_time ||
+	    READ_ONCE(sbi->s_fc_last_fsync_pid) == pid)
+		return false;
+	WRITE_ONCE(sbi->s_fc_last_fsync_pid, pid);
+
+	batch_time = min_t(u64, stats->s_fc_avg_commit_time,
+			   (u64)sbi->s_fc_max_batch_time * NSEC_PER_USEC);
+	start = ktime_get();
+	if (!batch_time ||
+	    ktime_to_ns(ktime_sub(start, sbi->s_fc_last_commit)) >= batch_time)
+		return false;
+
+	expires = ktime_add_ns(start, batch_time);
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+
+	stats->fc_batch_waits++;
+	stats->fc_batch_wait_time += ktime_to_ns(ktime_sub(ktime_get(), start));
+	return true;
+}
+
 /*
  * The main commit entry point. Performs a fast commit for transaction
  * commit_tid if needed. If it's not possible to perform a fast commit
@@ -1151,11 +1188,18 @@ int ext4_fc_commit(journal_t *journal, tid_t commit_tid)
 
 	trace_ext4_fc_commit_start(sb);
 
-	start_time = ktime_get();
-
 	if (!test_opt2(sb, JOURNAL_FAST_COMMIT))
 		return jbd2_complete_transaction(journal, commit_tid);
 
+	sbi->s_fc_stats.fc_fsyncs++;
+	if (ext4_fc_batch_wait(sb) && atomic_read(&sbi->s_fc_subtid) > subtid) {
+		/* A fast commit done while we waited covered us */
+		ext4_fc_update_stats(sb, EXT4_FC_STATUS_SKIPPED, 0, 0);
+		return 0;
+	}
+
+	start_time = ktime_get();
+
 restart_fc:
 	ret = jbd2_fc_begin_commit(journal, commit_tid);
 	if (ret == -EALREADY) {
@@ -1196,6 +1240,7 @@ restart_fc:
 		goto fallback;
 	}
 	atomic_inc(&sbi->s_fc_subtid);
+	sbi->s_fc_last_commit = ktime_get();
 	ret = jbd2_fc_end_commit(journal);
 	/*
 	 * weight the commit time higher than the average time so we
@@ -2226,6 +2271,13 @@ int ext4_fc_info_show(struct seq_file *seq, void *v)
 		   stats->fc_num_commits, stats->fc_ineligible_commits,
 		   stats->fc_numblks,
 		   div_u64(stats->s_fc_avg_commit_time, 1000));
+	seq_printf(seq,
+		"%ld fsyncs\n%ld skipped\n%ld batch_waits\n%lluus avg_batch_wait\n",
+		   stats->fc_fsyncs, stats->fc_skipped_commits,
+		   stats->fc_batch_waits,
+		   stats->fc_batch_waits ?
+		   div64_u64(stats->fc_batch_wait_time,
+			     stats->fc_batch_waits * 1000ULL) : 0);
 	seq_puts(seq, "Ineligible reasons:\n");
 	for (i = 0; i < EXT4_FC_REASON_MAX; i++)
 		seq_printf(seq, "\"%s\":\t%d\n", fc_ineligible_reasons[i],
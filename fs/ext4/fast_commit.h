@@ -121,9 +121,15 @@ struct ext4_fc_stats {
 	unsigned long fc_failed_commits;
 	unsigned long fc_skipped_commits;
 	unsigned long fc_numblks;
+	unsigned long fc_fsyncs;
+	unsigned long fc_batch_waits;
+	u64 fc_batch_wait_time;
 	u64 s_fc_avg_commit_time;
 };
 
+/* Default upper bound of the fsync batching window, in microseconds */
+#define EXT4_DEF_FC_MAX_BATCH_TIME	2000
+
 #define EXT4_FC_REPLAY_REALLOC_INCREMENT	4
 
 /*
@@ -4638,6 +4638,9 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 	sbi->s_fc_ineligible_tid = 0;
 	spin_lock_init(&sbi->s_fc_lock);
 	memset(&sbi->s_fc_stats, 0, sizeof(sbi->s_fc_stats));
+	sbi->s_fc_max_batch_time = EXT4_DEF_FC_MAX_BATCH_TIME;
+	sbi->s_fc_last_fsync_pid = 0;
+	sbi->s_fc_last_commit = 0;
 	sbi->s_fc_replay_state.fc_regions = NULL;
 	sbi->s_fc_replay_state.fc_regions_size = 0;
 	sbi->s_fc_replay_state.fc_regions_used = 0;
@@ -222,6 +222,36 @@ bool f2fs_is_valid_blkaddr(struct f2fs_sb_info *sbi,
 	return true;
 }
 
+/*
+ * Check at once that the @len blocks from @blkaddr are valid data blocks,
+ * as DATA_GENERIC_ENHANCE_READ would for each of them. Nothing is reported
+ * here: on a false return the caller checks block by block, which reports
+ * the bad block.
+ */
+bool f2fs_is_valid_data_blkaddr_range(struct f2fs_sb_info *sbi,
+					block_t blkaddr, unsigned int len)
+{
+	block_t end = blkaddr + len;
+
+	if (unlikely(!len || end < blkaddr || blkaddr < MAIN_BLKADDR(sbi) ||
+			end > MAX_BLKADDR(sbi)))
+		return false;
+
+	while (blkaddr < end) {
+		struct seg_entry *se = get_seg_entry(sbi,
+						GET_SEGNO(sbi, blkaddr));
+		unsigned int offset = GET_BLKOFF_FROM_SEG0(sbi, blkaddr);
+		unsigned int nr = min_t(block_t, end - blkaddr,
+					sbi->blocks_per_seg - offset);
+
+		blkaddr += nr;
+		for (; nr; nr--, offset++)
+			if (!f2fs_test_bit(offset, se->cur_valid_map))
+				return false;
+	}
+	return true;
+}
+
 /*
  * Readahead CP/NAT/SIT/SSA/POR pages
  */
@@ -1250,6 +1280,40 @@ out:
 #define sec_dbg_add_time(node, type, start) (0)
 #define sec_dbg_start_jiffies(val) (0)
 #endif
+
+/*
+ * Write back what is already dirty before block_operations() takes
+ * cp_rwsem, so that the flushes done with operations blocked only see what
+ * was dirtied in the meantime. Errors are left for block_operations() to
+ * run into again.
+ */
+static void prepare_checkpoint(struct f2fs_sb_info *sbi)
+{
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_ALL,
+		.nr_to_write = LONG_MAX,
+		.for_reclaim = 0,
+	};
+
+	/*
+	 * Let's flush inline_data in dirty node pages.
+	 */
+	f2fs_flush_inline_data(sbi);
+
+	if (get_pages(sbi, F2FS_DIRTY_DENTS) &&
+			f2fs_sync_dirty_inodes(sbi, DIR_INODE, true))
+		return;
+
+	if (get_pages(sbi, F2FS_DIRTY_IMETA) && f2fs_sync_inode_meta(sbi))
+		return;
+
+	if (get_pages(sbi, F2FS_DIRTY_NODES)) {
+		atomic_inc(&sbi->wb_sync_req[NODE]);
+		f2fs_sync_node_pages(sbi, &wbc, false, FS_CP_NODE_IO);
+		atomic_dec(&sbi->wb_sync_req[NODE]);
+	}
+}
+
 /*
  * Freeze all the FS-operations for checkpoint.
  */
@@ -1269,11 +1333,6 @@ static int block_operations(struct f2fs_sb_info *sbi)
 	dbg_entry.start_time = local_clock();
 #endif
 
-	/*
-	 * Let's flush inline_data in dirty node pages.
-	 */
-	f2fs_flush_inline_data(sbi);
-
 retry_flush_quotas:
 	f2fs_lock_all(sbi);
 	if (__need_flush_quota(sbi)) {
@@ -1712,6 +1771,7 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 {
 	struct f2fs_checkpoint *ckpt = F2FS_CKPT(sbi);
 	unsigned long long ckpt_ver;
+	u64 start, prepared, blocked, end;
 	int err = 0;
 
 	if (f2fs_readonly(sbi->sb) || f2fs_hw_is_readonly(sbi))
@@ -1734,11 +1794,16 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 		goto out;
 	}
 
+	start = ktime_get_ns();
+	prepare_checkpoint(sbi);
+	prepared = ktime_get_ns();
+
 	trace_f2fs_write_checkpoint(sbi->sb, cpc->reason, "start block_ops");
 
 	err = block_operations(sbi);
 	if (err)
 		goto out;
+	blocked = ktime_get_ns();
 
 	trace_f2fs_write_checkpoint(sbi->sb, cpc->reason, "finish block_ops");
 
@@ -1794,6 +1859,14 @@ int f2fs_write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	f2fs_restore_inmem_curseg(sbi);
 stop:
 	unblock_operations(sbi);
+	end = ktime_get_ns();
+	f2fs_account_cp_lat(sbi->cp_phase_hist[CP_PHASE_PREPARE],
+				prepared - start);
+	f2fs_account_cp_lat(sbi->cp_phase_hist[CP_PHASE_BLOCK_OPS],
+				blocked - prepared);
+	f2fs_account_cp_lat(sbi->cp_phase_hist[CP_PHASE_BLOCKED],
+				end - blocked);
+	f2fs_account_cp_lat(sbi->cp_phase_hist[CP_PHASE_TOTAL], end - start);
 	stat_inc_cp_count(sbi->stat_info);
 	sbi->sec_stat.cp_cnt[STAT_CP_ALL]++;
 	f2fs_update_max_cp_interval(sbi);
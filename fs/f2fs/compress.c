@@ -13,6 +13,7 @@
 #include <linux/lz4.h>
 #include <linux/zstd.h>
 #include <linux/pagevec.h>
+#include <linux/sched/mm.h>
 
 #include "f2fs.h"
 #include "node.h"
@@ -235,12 +236,24 @@ static const struct f2fs_compress_ops f2fs_lzo_ops = {
 #endif
 
 #ifdef CONFIG_F2FS_FS_LZ4
+#ifdef CONFIG_F2FS_FS_LZ4HC
+static unsigned char lz4_compress_level(struct compress_ctx *cc)
+{
+	struct f2fs_inode_info *fi = F2FS_I(cc->inode);
+
+	/* the level of an adaptive inode is the one of zstd */
+	if (fi->i_compress_algorithm != COMPRESS_LZ4)
+		return 0;
+	return fi->i_compress_flag >> COMPRESS_LEVEL_OFFSET;
+}
+#endif
+
 static int lz4_init_compress_ctx(struct compress_ctx *cc)
 {
 	unsigned int size = LZ4_MEM_COMPRESS;
 
 #ifdef CONFIG_F2FS_FS_LZ4HC
-	if (F2FS_I(cc->inode)->i_compress_flag >> COMPRESS_LEVEL_OFFSET)
+	if (lz4_compress_level(cc))
 		size = LZ4HC_MEM_COMPRESS;
 #endif
 
@@ -266,8 +279,7 @@ static void lz4_destroy_compress_ctx(struct compress_ctx *cc)
 #ifdef CONFIG_F2FS_FS_LZ4HC
 static int lz4hc_compress_pages(struct compress_ctx *cc)
 {
-	unsigned char level = F2FS_I(cc->inode)->i_compress_flag >>
-						COMPRESS_LEVEL_OFFSET;
+	unsigned char level = lz4_compress_level(cc);
 	int len;
 
 	if (level)
@@ -550,10 +562,21 @@ static const struct f2fs_compress_ops *f2fs_cops[COMPRESS_MAX] = {
 #endif
 };
 
+static bool f2fs_compress_adaptive(struct inode *inode)
+{
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+
+	return f2fs_sb_has_adaptive_compress(F2FS_I_SB(inode)) &&
+		fi->i_compress_algorithm == COMPRESS_ZSTD &&
+		fi->i_compress_flag & 1 << COMPRESS_ADAPTIVE;
+}
+
 bool f2fs_is_compress_backend_ready(struct inode *inode)
 {
 	if (!f2fs_compressed_file(inode))
 		return true;
+	if (f2fs_compress_adaptive(inode) && !f2fs_cops[COMPRESS_LZ4])
+		return false;
 	return f2fs_cops[F2FS_I(inode)->i_compress_algorithm];
 }
 
@@ -613,17 +636,67 @@ static void *f2fs_vmap(struct page **pages, unsigned int count)
 	return buf;
 }
 
-static int f2fs_compress_pages(struct compress_ctx *cc)
+/*
+ * Clusters of an adaptive inode are compressed with lz4 first, and with
+ * zstd only when lz4 got them below this percentage of their size.
+ */
+#define COMPRESS_ADAPTIVE_RATIO		75
+
+/*
+ * Recompress with zstd a cluster that lz4 compressed well.  The lz4
+ * context has been destroyed when this returns, and *algorithm is the
+ * algorithm of the data left in cc->cbuf.
+ */
+static int f2fs_compress_escalate(struct compress_ctx *cc,
+					unsigned char *algorithm)
 {
 	struct f2fs_inode_info *fi = F2FS_I(cc->inode);
-	const struct f2fs_compress_ops *cops =
+	const struct f2fs_compress_ops *lz4 = f2fs_cops[COMPRESS_LZ4];
+	const struct f2fs_compress_ops *zstd =
 				f2fs_cops[fi->i_compress_algorithm];
+	size_t clen = cc->clen;
+	int ret;
+
+	lz4->destroy_compress_ctx(cc);
+
+	/* no memory for zstd, the lz4 output is still in place */
+	if (zstd->init_compress_ctx(cc)) {
+		cc->clen = clen;
+		return 0;
+	}
+
+	ret = zstd->compress_pages(cc);
+	zstd->destroy_compress_ctx(cc);
+	if (!ret && cc->clen < clen) {
+		*algorithm = fi->i_compress_algorithm;
+		atomic64_inc(&fi->i_escalated_clusters);
+		return 0;
+	}
+
+	/* zstd did no better and may have overwritten cbuf, redo lz4 */
+	ret = lz4->init_compress_ctx(cc);
+	if (ret)
+		return ret;
+	ret = lz4->compress_pages(cc);
+	lz4->destroy_compress_ctx(cc);
+	return ret;
+}
+
+static int f2fs_compress_pages(struct compress_ctx *cc)
+{
+	struct f2fs_inode_info *fi = F2FS_I(cc->inode);
+	unsigned char algorithm = fi->i_compress_algorithm;
+	const struct f2fs_compress_ops *cops;
 	unsigned int max_len, new_nr_cpages;
 	u32 chksum = 0;
 	int i, ret;
 
+	if (f2fs_compress_adaptive(cc->inode))
+		algorithm = COMPRESS_LZ4;
+	cops = f2fs_cops[algorithm];
+
 	trace_f2fs_compress_pages_start(cc->inode, cc->cluster_idx,
-				cc->cluster_size, fi->i_compress_algorithm);
+				cc->cluster_size, algorithm);
 
 	if (cops->init_compress_ctx) {
 		ret = cops->init_compress_ctx(cc);
@@ -665,6 +738,13 @@ static int f2fs_compress_pages(struct compress_ctx *cc)
 	if (ret)
 		goto out_vunmap_cbuf;
 
+	if (algorithm != fi->i_compress_algorithm &&
+			cc->clen * 100 < cc->rlen * COMPRESS_ADAPTIVE_RATIO) {
+		ret = f2fs_compress_escalate(cc, &algorithm);
+		if (ret)
+			goto out_vunmap_cbuf;
+	}
+
 	max_len = PAGE_SIZE * (cc->cluster_size - 1) - COMPRESS_HEADER_SIZE;
 
 	if (cc->clen > max_len) {
@@ -681,6 +761,9 @@ static int f2fs_compress_pages(struct compress_ctx *cc)
 
 	for (i = 0; i < COMPRESS_DATA_RESERVED_SIZE; i++)
 		cc->cbuf->reserved[i] = cpu_to_le32(0);
+	if (f2fs_compress_adaptive(cc->inode))
+		cc->cbuf->reserved[COMPRESS_DATA_ALGORITHM] =
+						cpu_to_le32(algorithm);
 
 	new_nr_cpages = DIV_ROUND_UP(cc->clen + COMPRESS_HEADER_SIZE, PAGE_SIZE);
 
@@ -733,14 +816,177 @@ static int f2fs_prepare_decomp_mem(struct decompress_io_ctx *dic,
 static void f2fs_release_decomp_mem(struct decompress_io_ctx *dic,
 		bool bypass_destroy_callback, bool pre_alloc);
 
+/*
+ * The algorithm of an adaptive cluster is in its header.  Only the inode's
+ * algorithm has a decompress context set up, any other must not need one.
+ */
+static const struct f2fs_compress_ops *
+f2fs_decompress_ops(struct decompress_io_ctx *dic)
+{
+	struct f2fs_inode_info *fi = F2FS_I(dic->inode);
+	const struct f2fs_compress_ops *cops;
+	u32 algorithm;
+
+	algorithm = le32_to_cpu(dic->cbuf->reserved[COMPRESS_DATA_ALGORITHM]);
+	if (algorithm >= COMPRESS_MAX)
+		return NULL;
+
+	cops = f2fs_cops[algorithm];
+	if (!cops)
+		return NULL;
+	if (algorithm != fi->i_compress_algorithm && cops->init_decompress_ctx)
+		return NULL;
+	return cops;
+}
+
+/*
+ * Per-CPU buffers to gather the compressed pages of a cluster, and to
+ * decompress clusters that are only partially in the page cache, instead
+ * of vmapping pages from the compress mempool for every cluster.
+ */
+struct f2fs_decomp_scratch {
+	void *cbuf;		/* compressed data of the cluster */
+	void *rbuf;		/* decompressed data of the cluster */
+	bool busy;		/* held by the context we interrupted */
+};
+
+static DEFINE_PER_CPU(struct f2fs_decomp_scratch, decomp_scratch);
+static unsigned int decomp_scratch_log_size = MIN_COMPRESS_LOG_SIZE;
+module_param(decomp_scratch_log_size, uint, 0444);
+MODULE_PARM_DESC(decomp_scratch_log_size,
+		"Log of the largest cluster size decompressed in per-CPU buffers");
+
+/*
+ * Preemption stays disabled while the buffers are held.  NULL means that
+ * they are held by the task or softirq this context interrupted.
+ */
+static struct f2fs_decomp_scratch *f2fs_get_decomp_scratch(void)
+{
+	struct f2fs_decomp_scratch *scratch;
+
+	preempt_disable();
+	scratch = this_cpu_ptr(&decomp_scratch);
+	if (READ_ONCE(scratch->busy)) {
+		preempt_enable();
+		return NULL;
+	}
+	WRITE_ONCE(scratch->busy, true);
+	barrier();
+	return scratch;
+}
+
+static void f2fs_put_decomp_scratch(struct f2fs_decomp_scratch *scratch)
+{
+	barrier();
+	WRITE_ONCE(scratch->busy, false);
+	preempt_enable();
+}
+
+static void f2fs_map_decomp_scratch(struct decompress_io_ctx *dic,
+				struct f2fs_decomp_scratch *scratch)
+{
+	int i;
+
+	if (dic->nr_cpages == 1) {
+		dic->cbuf = page_address(dic->cpages[0]);
+	} else {
+		for (i = 0; i < dic->nr_cpages; i++)
+			memcpy(scratch->cbuf + i * PAGE_SIZE,
+				page_address(dic->cpages[i]), PAGE_SIZE);
+		dic->cbuf = scratch->cbuf;
+	}
+
+	/* a fully covered cluster is decompressed into the page cache */
+	if (!dic->rbuf)
+		dic->rbuf = scratch->rbuf;
+}
+
+static void f2fs_unmap_decomp_scratch(struct decompress_io_ctx *dic,
+				struct f2fs_decomp_scratch *scratch, bool copy)
+{
+	int i;
+
+	if (dic->rbuf == scratch->rbuf) {
+		for (i = 0; copy && i < dic->cluster_size; i++) {
+			if (dic->rpages[i])
+				memcpy_to_page(dic->rpages[i], 0,
+					scratch->rbuf + i * PAGE_SIZE,
+					PAGE_SIZE);
+		}
+		dic->rbuf = NULL;
+	}
+	dic->cbuf = NULL;
+}
+
+static void f2fs_late_decompress(struct work_struct *work)
+{
+	struct decompress_io_ctx *dic =
+		container_of(work, struct decompress_io_ctx, decompress_work);
+
+	f2fs_decompress_cluster(dic, true);
+}
+
+static int __init f2fs_init_decomp_scratch(void)
+{
+	size_t size;
+	int cpu;
+
+	if (decomp_scratch_log_size > MAX_COMPRESS_LOG_SIZE)
+		decomp_scratch_log_size = MAX_COMPRESS_LOG_SIZE;
+	size = PAGE_SIZE << decomp_scratch_log_size;
+
+	for_each_possible_cpu(cpu) {
+		struct f2fs_decomp_scratch *scratch =
+					per_cpu_ptr(&decomp_scratch, cpu);
+
+		scratch->cbuf = kvmalloc(size, GFP_KERNEL);
+		scratch->rbuf = kvmalloc(size, GFP_KERNEL);
+		if (!scratch->cbuf || !scratch->rbuf)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static void f2fs_destroy_decomp_scratch(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct f2fs_decomp_scratch *scratch =
+					per_cpu_ptr(&decomp_scratch, cpu);
+
+		kvfree(scratch->cbuf);
+		kvfree(scratch->rbuf);
+		scratch->cbuf = NULL;
+		scratch->rbuf = NULL;
+	}
+}
+
 void f2fs_decompress_cluster(struct decompress_io_ctx *dic, bool in_task)
 {
 	struct f2fs_sb_info *sbi = F2FS_I_SB(dic->inode);
 	struct f2fs_inode_info *fi = F2FS_I(dic->inode);
 	const struct f2fs_compress_ops *cops =
 			f2fs_cops[fi->i_compress_algorithm];
+	struct f2fs_decomp_scratch *scratch = NULL;
 	bool bypass_callback = false;
-	int ret;
+	int ret = 0;
+
+	if (!dic->failed) {
+		ret = f2fs_prepare_decomp_mem(dic, false);
+		if (!ret && dic->in_scratch) {
+			scratch = f2fs_get_decomp_scratch();
+			if (!scratch) {
+				f2fs_release_decomp_mem(dic, false, false);
+				INIT_WORK(&dic->decompress_work,
+						f2fs_late_decompress);
+				queue_work(sbi->post_read_wq,
+						&dic->decompress_work);
+				return;
+			}
+			f2fs_map_decomp_scratch(dic, scratch);
+		}
+	}
 
 	trace_f2fs_decompress_pages_start(dic->inode, dic->cluster_idx,
 				dic->cluster_size, fi->i_compress_algorithm);
@@ -750,7 +996,6 @@ void f2fs_decompress_cluster(struct decompress_io_ctx *dic, bool in_task)
 		goto out_end_io;
 	}
 
-	ret = f2fs_prepare_decomp_mem(dic, false);
 	if (ret) {
 		bypass_callback = true;
 		goto out_release;
@@ -764,6 +1009,14 @@ void f2fs_decompress_cluster(struct decompress_io_ctx *dic, bool in_task)
 		goto out_release;
 	}
 
+	if (f2fs_compress_adaptive(dic->inode)) {
+		cops = f2fs_decompress_ops(dic);
+		if (!cops) {
+			ret = -EFSCORRUPTED;
+			goto out_release;
+		}
+	}
+
 	ret = cops->decompress_pages(dic);
 
 	if (!ret && (fi->i_compress_flag & 1 << COMPRESS_CHKSUM)) {
@@ -783,6 +1036,10 @@ void f2fs_decompress_cluster(struct decompress_io_ctx *dic, bool in_task)
 	}
 
 out_release:
+	if (scratch) {
+		f2fs_unmap_decomp_scratch(dic, scratch, !ret);
+		f2fs_put_decomp_scratch(scratch);
+	}
 	f2fs_release_decomp_mem(dic, bypass_callback, false);
 
 out_end_io:
@@ -1398,7 +1655,8 @@ void f2fs_compress_write_end_io(struct bio *bio, struct page *page)
 static int f2fs_write_raw_pages(struct compress_ctx *cc,
 					int *submitted,
 					struct writeback_control *wbc,
-					enum iostat_type io_type)
+					enum iostat_type io_type,
+					bool *defer_balance)
 {
 	struct address_space *mapping = cc->inode->i_mapping;
 	int _submitted, compr_blocks, ret, i;
@@ -1465,21 +1723,32 @@ continue_unlock:
 		*submitted += _submitted;
 	}
 
-	f2fs_balance_fs(F2FS_M_SB(mapping), true);
+	/*
+	 * GC may lock data pages of this inode, which must wait until the
+	 * clusters still queued for compression have been written.
+	 */
+	if (defer_balance)
+		*defer_balance = true;
+	else
+		f2fs_balance_fs(F2FS_M_SB(mapping), true);
 
 	return 0;
 }
 
-int f2fs_write_multi_pages(struct compress_ctx *cc,
+/*
+ * Write a cluster whose compression, if @compress, has completed with
+ * @err.  Balancing is left to the caller when @defer_balance is set.
+ */
+static int f2fs_write_cluster(struct compress_ctx *cc, bool compress,
+					int err, bool *defer_balance,
 					int *submitted,
 					struct writeback_control *wbc,
 					enum iostat_type io_type)
 {
-	int err;
+	struct f2fs_inode_info *fi = F2FS_I(cc->inode);
 
 	*submitted = 0;
-	if (cluster_may_compress(cc)) {
-		err = f2fs_compress_pages(cc);
+	if (compress) {
 		if (err == -EAGAIN) {
 			add_compr_block_stat(cc->inode, cc->cluster_size);
 			goto write;
@@ -1490,26 +1759,219 @@ int f2fs_write_multi_pages(struct compress_ctx *cc,
 
 		err = f2fs_write_compressed_pages(cc, submitted,
 							wbc, io_type);
-		if (!err)
+		if (!err) {
+			atomic64_inc(&fi->i_compr_clusters);
+			atomic64_add(cc->rlen, &fi->i_compr_raw_bytes);
+			atomic64_add(cc->clen, &fi->i_compr_bytes);
 			return 0;
+		}
 		f2fs_bug_on(F2FS_I_SB(cc->inode), err != -EAGAIN);
 	}
 write:
 	f2fs_bug_on(F2FS_I_SB(cc->inode), *submitted);
 
-	err = f2fs_write_raw_pages(cc, submitted, wbc, io_type);
+	atomic64_inc(&fi->i_raw_clusters);
+	err = f2fs_write_raw_pages(cc, submitted, wbc, io_type, defer_balance);
 	f2fs_put_rpages_wbc(cc, wbc, false, 0);
 destroy_out:
 	f2fs_destroy_compress_ctx(cc, false);
 	return err;
 }
 
+int f2fs_write_multi_pages(struct compress_ctx *cc,
+					int *submitted,
+					struct writeback_control *wbc,
+					enum iostat_type io_type)
+{
+	bool compress = cluster_may_compress(cc);
+	int err = 0;
+
+	if (compress)
+		err = f2fs_compress_pages(cc);
+
+	return f2fs_write_cluster(cc, compress, err, NULL,
+					submitted, wbc, io_type);
+}
+
+/* a full cluster handed to a compress worker */
+struct compress_work {
+	struct work_struct work;
+	struct compress_ctx cc;
+	int err;
+};
+
+static void f2fs_compress_work(struct work_struct *work)
+{
+	struct compress_work *cw = container_of(work,
+					struct compress_work, work);
+	unsigned int nofs_flag;
+
+	/* writeback is waiting on this, do not recurse into the fs */
+	nofs_flag = memalloc_nofs_save();
+	cw->err = f2fs_compress_pages(&cw->cc);
+	memalloc_nofs_restore(nofs_flag);
+}
+
+void f2fs_init_compress_queue(struct compress_queue *cq, struct inode *inode)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	unsigned int depth = READ_ONCE(sbi->compress_queue_depth);
+
+	memset(cq, 0, sizeof(*cq));
+	if (!sbi->compress_wq || depth <= 1)
+		return;
+
+	cq->works = f2fs_kmalloc(sbi, sizeof(struct compress_work) * depth,
+								GFP_NOFS);
+	if (cq->works)
+		cq->size = depth;
+}
+
+void f2fs_destroy_compress_queue(struct compress_queue *cq)
+{
+	WARN_ON(cq->nr);
+	kfree(cq->works);
+	cq->works = NULL;
+	cq->size = 0;
+}
+
+/*
+ * Write the oldest queued cluster once its worker is done.  @locked tells
+ * that the caller holds the pages of another cluster.
+ */
+static int f2fs_write_queued_cluster(struct compress_queue *cq, bool locked,
+					int *submitted,
+					struct writeback_control *wbc,
+					enum iostat_type io_type)
+{
+	struct compress_work *cw = &cq->works[cq->head];
+	struct f2fs_sb_info *sbi = F2FS_I_SB(cw->cc.inode);
+	int err;
+
+	flush_work(&cw->work);
+	cq->head = (cq->head + 1) % cq->size;
+	cq->nr--;
+
+	err = f2fs_write_cluster(&cw->cc, true, cw->err,
+				locked || cq->nr ? &cq->need_balance : NULL,
+				submitted, wbc, io_type);
+
+	if (!locked && !cq->nr && cq->need_balance) {
+		cq->need_balance = false;
+		f2fs_balance_fs(sbi, true);
+	}
+	return err;
+}
+
+static int __f2fs_flush_compress_queue(struct compress_queue *cq,
+					bool locked, int *submitted,
+					struct writeback_control *wbc,
+					enum iostat_type io_type)
+{
+	int _submitted, err = 0, ret;
+
+	*submitted = 0;
+	while (cq->nr) {
+		ret = f2fs_write_queued_cluster(cq, locked, &_submitted,
+							wbc, io_type);
+		*submitted += _submitted;
+		if (ret && !err)
+			err = ret;
+	}
+	return err;
+}
+
+int f2fs_flush_compress_queue(struct compress_queue *cq, int *submitted,
+					struct writeback_control *wbc,
+					enum iostat_type io_type)
+{
+	return __f2fs_flush_compress_queue(cq, false, submitted, wbc, io_type);
+}
+
+/*
+ * Write the cluster in @cc like f2fs_write_multi_pages(), but let a worker
+ * compress it while writeback goes on gathering the next clusters.  The
+ * clusters are written in order, and up to cq->size of them are kept in
+ * flight with their pages locked.  @cc is left empty for the next cluster.
+ */
+int f2fs_queue_multi_pages(struct compress_queue *cq, struct compress_ctx *cc,
+					int *submitted,
+					struct writeback_control *wbc,
+					enum iostat_type io_type)
+{
+	struct compress_work *cw;
+	int _submitted, err, ret;
+
+	if (!cq->size)
+		return f2fs_write_multi_pages(cc, submitted, wbc, io_type);
+
+	if (!cluster_may_compress(cc)) {
+		err = __f2fs_flush_compress_queue(cq, true, submitted,
+							wbc, io_type);
+		ret = f2fs_write_cluster(cc, false, 0, NULL, &_submitted,
+							wbc, io_type);
+		*submitted += _submitted;
+		if (cq->need_balance) {
+			cq->need_balance = false;
+			f2fs_balance_fs(F2FS_I_SB(cc->inode), true);
+		}
+		return err ? err : ret;
+	}
+
+	cw = &cq->works[(cq->head + cq->nr) % cq->size];
+	cw->cc = *cc;
+	cw->err = 0;
+	INIT_WORK(&cw->work, f2fs_compress_work);
+	queue_work(F2FS_I_SB(cc->inode)->compress_wq, &cw->work);
+	cq->nr++;
+
+	cc->rpages = NULL;
+	cc->nr_rpages = 0;
+	cc->cluster_idx = NULL_CLUSTER;
+
+	*submitted = 0;
+	if (cq->nr < cq->size)
+		return 0;
+	return f2fs_write_queued_cluster(cq, false, submitted, wbc, io_type);
+}
+
+int f2fs_init_compress_wq(struct f2fs_sb_info *sbi)
+{
+	if (!f2fs_sb_has_compression(sbi))
+		return 0;
+
+	sbi->compress_queue_depth = min_t(unsigned int, num_online_cpus(),
+						DEF_COMPRESS_QUEUE_DEPTH);
+	sbi->compress_wq = alloc_workqueue("f2fs_compress_wq",
+						WQ_UNBOUND | WQ_MEM_RECLAIM,
+						num_online_cpus());
+	if (!sbi->compress_wq)
+		return -ENOMEM;
+	return 0;
+}
+
+void f2fs_destroy_compress_wq(struct f2fs_sb_info *sbi)
+{
+	if (sbi->compress_wq)
+		destroy_workqueue(sbi->compress_wq);
+}
+
 static inline bool allow_memalloc_for_decomp(struct f2fs_sb_info *sbi,
 		bool pre_alloc)
 {
 	return pre_alloc ^ f2fs_low_mem_mode(sbi);
 }
 
+static bool f2fs_cluster_is_covered(struct decompress_io_ctx *dic)
+{
+	int i;
+
+	for (i = 0; i < dic->cluster_size; i++)
+		if (!dic->rpages[i])
+			return false;
+	return true;
+}
+
 static int f2fs_prepare_decomp_mem(struct decompress_io_ctx *dic,
 		bool pre_alloc)
 {
@@ -1520,28 +1982,38 @@ static int f2fs_prepare_decomp_mem(struct decompress_io_ctx *dic,
 	if (!allow_memalloc_for_decomp(F2FS_I_SB(dic->inode), pre_alloc))
 		return 0;
 
-	dic->tpages = page_array_alloc(dic->inode, dic->cluster_size);
-	if (!dic->tpages)
-		return -ENOMEM;
+	if (f2fs_cluster_is_covered(dic)) {
+		/* decompress straight into the page cache */
+		dic->rbuf = f2fs_vmap(dic->rpages, dic->cluster_size);
+		if (!dic->rbuf)
+			return -ENOMEM;
+	} else if (!dic->in_scratch) {
+		dic->tpages = page_array_alloc(dic->inode, dic->cluster_size);
+		if (!dic->tpages)
+			return -ENOMEM;
 
-	for (i = 0; i < dic->cluster_size; i++) {
-		if (dic->rpages[i]) {
-			dic->tpages[i] = dic->rpages[i];
-			continue;
+		for (i = 0; i < dic->cluster_size; i++) {
+			if (dic->rpages[i]) {
+				dic->tpages[i] = dic->rpages[i];
+				continue;
+			}
+
+			dic->tpages[i] = f2fs_compress_alloc_page();
+			if (!dic->tpages[i])
+				return -ENOMEM;
 		}
 
-		dic->tpages[i] = f2fs_compress_alloc_page();
-		if (!dic->tpages[i])
+		dic->rbuf = f2fs_vmap(dic->tpages, dic->cluster_size);
+		if (!dic->rbuf)
 			return -ENOMEM;
 	}
 
-	dic->rbuf = f2fs_vmap(dic->tpages, dic->cluster_size);
-	if (!dic->rbuf)
-		return -ENOMEM;
-
-	dic->cbuf = f2fs_vmap(dic->cpages, dic->nr_cpages);
-	if (!dic->cbuf)
-		return -ENOMEM;
+	/* compressed pages are gathered into the per-CPU buffer instead */
+	if (!dic->in_scratch) {
+		dic->cbuf = f2fs_vmap(dic->cpages, dic->nr_cpages);
+		if (!dic->cbuf)
+			return -ENOMEM;
+	}
 
 	if (cops->init_decompress_ctx) {
 		int ret = cops->init_decompress_ctx(dic);
@@ -1602,6 +2074,7 @@ struct decompress_io_ctx *f2fs_alloc_dic(struct compress_ctx *cc)
 	refcount_set(&dic->refcnt, 1);
 	dic->failed = false;
 	dic->need_verity = f2fs_need_verity(cc->inode, start_idx);
+	dic->in_scratch = dic->log_cluster_size <= decomp_scratch_log_size;
 
 	for (i = 0; i < dic->cluster_size; i++)
 		dic->rpages[i] = cc->rpages[i];
@@ -1723,16 +2196,33 @@ static void f2fs_verify_cluster(struct work_struct *work)
 {
 	struct decompress_io_ctx *dic =
 		container_of(work, struct decompress_io_ctx, verity_work);
+	struct bio *bio;
 	int i;
 
-	/* Verify the cluster's decompressed pages with fs-verity. */
+	/*
+	 * Verify the cluster's decompressed pages with fs-verity.  Passing
+	 * them in one bio shares the hash request and the Merkle tree walk
+	 * between all pages of the cluster.
+	 */
+	bio = bio_kmalloc(GFP_NOFS, dic->cluster_size);
+	if (bio) {
+		for (i = 0; i < dic->cluster_size; i++) {
+			if (dic->rpages[i])
+				bio_add_page(bio, dic->rpages[i], PAGE_SIZE, 0);
+		}
+		if (bio->bi_vcnt)
+			fsverity_verify_bio(bio);
+		bio_put(bio);
+		goto out;
+	}
+
 	for (i = 0; i < dic->cluster_size; i++) {
 		struct page *rpage = dic->rpages[i];
 
 		if (rpage && !fsverity_verify_page(rpage))
 			SetPageError(rpage);
 	}
-
+out:
 	__f2fs_decompress_end_io(dic, false, true);
 }
 
@@ -2012,7 +2502,13 @@ int __init f2fs_init_compress_cache(void)
 	err = f2fs_init_dic_cache();
 	if (err)
 		goto free_cic;
+	err = f2fs_init_decomp_scratch();
+	if (err)
+		goto free_dic;
 	return 0;
+free_dic:
+	f2fs_destroy_decomp_scratch();
+	f2fs_destroy_dic_cache();
 free_cic:
 	f2fs_destroy_cic_cache();
 out:
@@ -2021,6 +2517,7 @@ out:
 
 void f2fs_destroy_compress_cache(void)
 {
+	f2fs_destroy_decomp_scratch();
 	f2fs_destroy_dic_cache();
 	f2fs_destroy_cic_cache();
 }
@@ -2054,8 +2054,10 @@ static inline loff_t f2fs_readpage_limit(struct inode *inode)
 static int f2fs_read_single_page(struct inode *inode, struct page *page,
 					unsigned nr_pages,
 					struct f2fs_map_blocks *map,
+					bool *map_checked,
 					struct bio **bio_ret,
 					sector_t *last_block_in_bio,
+					unsigned int *nr_read,
 					bool is_readahead)
 {
 	struct bio *bio = *bio_ret;
@@ -2094,6 +2096,14 @@ static int f2fs_read_single_page(struct inode *inode, struct page *page,
 	ret = f2fs_map_blocks(inode, map, 0, F2FS_GET_BLOCK_DEFAULT);
 	if (ret)
 		goto out;
+
+	/*
+	 * Sequential reads get the whole extent from one lookup, check all
+	 * of its blocks here rather than once per page.
+	 */
+	*map_checked = (map->m_flags & F2FS_MAP_MAPPED) &&
+		f2fs_is_valid_data_blkaddr_range(F2FS_I_SB(inode),
+						map->m_pblk, map->m_len);
 got_it:
 	if ((map->m_flags & F2FS_MAP_MAPPED)) {
 		block_nr = map->m_pblk + block_in_file - map->m_lblk;
@@ -2105,7 +2115,8 @@ got_it:
 			goto confused;
 		}
 
-		if (!f2fs_is_valid_blkaddr(F2FS_I_SB(inode), block_nr,
+		if (!*map_checked &&
+		    !f2fs_is_valid_blkaddr(F2FS_I_SB(inode), block_nr,
 						DATA_GENERIC_ENHANCE_READ)) {
 			ret = -EFSCORRUPTED;
 			goto out;
@@ -2145,7 +2156,8 @@ submit_and_realloc:
 #endif
 
 	if (bio == NULL) {
-		bio = f2fs_grab_read_bio(inode, block_nr, nr_pages,
+		bio = f2fs_grab_read_bio(inode, block_nr,
+				last_block - block_in_file,
 				is_readahead ? REQ_RAHEAD : 0, page->index,
 				false);
 		if (IS_ERR(bio)) {
@@ -2165,7 +2177,7 @@ submit_and_realloc:
 		goto submit_and_realloc;
 
 	inc_page_count(F2FS_I_SB(inode), F2FS_RD_DATA);
-	f2fs_update_iostat(F2FS_I_SB(inode), FS_DATA_READ_IO, F2FS_BLKSIZE);
+	(*nr_read)++;
 	ClearPageError(page);
 	*last_block_in_bio = block_nr;
 	goto out;
@@ -2357,6 +2369,8 @@ static int f2fs_mpage_readpages(struct inode *inode,
 	struct bio *bio = NULL;
 	sector_t last_block_in_bio = 0;
 	struct f2fs_map_blocks map;
+	bool map_checked = false;
+	unsigned int nr_read = 0;
 #ifdef CONFIG_F2FS_FS_COMPRESSION
 	struct compress_ctx cc = {
 		.inode = inode,
@@ -2429,8 +2443,10 @@ static int f2fs_mpage_readpages(struct inode *inode,
 read_single_page:
 #endif
 
-		ret = f2fs_read_single_page(inode, page, max_nr_pages, &map,
-					&bio, &last_block_in_bio, rac);
+		/* The pages left in the window, not the whole window */
+		ret = f2fs_read_single_page(inode, page, nr_pages, &map,
+					&map_checked, &bio, &last_block_in_bio,
+					&nr_read, rac);
 		if (ret) {
 #ifdef CONFIG_F2FS_FS_COMPRESSION
 set_error_page:
@@ -2460,6 +2476,9 @@ next_page:
 	}
 	if (bio)
 		__submit_bio(F2FS_I_SB(inode), bio, DATA);
+	if (nr_read)
+		f2fs_update_iostat(F2FS_I_SB(inode), FS_DATA_READ_IO,
+				(unsigned long long)nr_read * F2FS_BLKSIZE);
 	return ret;
 }
 
@@ -3102,6 +3121,11 @@ static int f2fs_write_cache_pages(struct address_space *mapping,
 		.rlen = PAGE_SIZE * F2FS_I(inode)->i_cluster_size,
 		.private = NULL,
 	};
+	struct compress_queue cq = {
+		.works = NULL,
+		.size = 0,
+		.nr = 0,
+	};
 #endif
 	int nr_pages;
 	pgoff_t index;
@@ -3116,6 +3140,10 @@ static int f2fs_write_cache_pages(struct address_space *mapping,
 	pagevec_init(&pvec);
 #ifdef CONFIG_F2FS_ML_BASED_STREAM_SEPARATION
 	do_ml_stream(sbi, mapping->host);
+#endif
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	if (f2fs_compressed_file(inode))
+		f2fs_init_compress_queue(&cq, inode);
 #endif
 	if (get_dirty_pages(mapping->host) <=
 				SM_I(F2FS_M_SB(mapping))->min_hot_blocks)
@@ -3162,7 +3190,7 @@ readd:
 
 				if (!f2fs_cluster_can_merge_page(&cc,
 								page->index)) {
-					ret = f2fs_write_multi_pages(&cc,
+					ret = f2fs_queue_multi_pages(&cq, &cc,
 						&submitted, wbc, io_type);
 					if (!ret)
 						need_readd = true;
@@ -3286,7 +3314,7 @@ next:
 #ifdef CONFIG_F2FS_FS_COMPRESSION
 	/* flush remained pages in compress cluster */
 	if (f2fs_compressed_file(inode) && !f2fs_cluster_is_empty(&cc)) {
-		ret = f2fs_write_multi_pages(&cc, &submitted, wbc, io_type);
+		ret = f2fs_queue_multi_pages(&cq, &cc, &submitted, wbc, io_type);
 		nwritten += submitted;
 		wbc->nr_to_write -= submitted;
 		if (ret) {
@@ -3294,14 +3322,29 @@ next:
 			retry = 0;
 		}
 	}
-	if (f2fs_compressed_file(inode))
+	if (f2fs_compressed_file(inode)) {
+		int err = f2fs_flush_compress_queue(&cq, &submitted,
+							wbc, io_type);
+
+		nwritten += submitted;
+		wbc->nr_to_write -= submitted;
+		if (err) {
+			if (!ret)
+				ret = err;
+			done = 1;
+			retry = 0;
+		}
 		f2fs_destroy_compress_ctx(&cc, false);
+	}
 #endif
 	if (retry) {
 		index = 0;
 		end = -1;
 		goto retry;
 	}
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	f2fs_destroy_compress_queue(&cq);
+#endif
 	if (wbc->range_cyclic && !done)
 		done_index = 0;
 	if (wbc->range_cyclic || (range_whole && wbc->nr_to_write > 0))
@@ -213,6 +213,7 @@ struct f2fs_mount_info {
 	unsigned char compress_log_size;	/* cluster log size */
 	unsigned char compress_level;		/* compress level */
 	bool compress_chksum;			/* compressed data chksum */
+	bool compress_adaptive;			/* try lz4 before zstd */
 	unsigned char compress_ext_cnt;		/* extension count */
 	unsigned char nocompress_ext_cnt;		/* nocompress extension count */
 	int compress_mode;			/* compression mode */
@@ -235,6 +236,7 @@ struct f2fs_mount_info {
 #define F2FS_FEATURE_CASEFOLD		0x1000
 #define F2FS_FEATURE_COMPRESSION	0x2000
 #define F2FS_FEATURE_RO			0x4000
+#define F2FS_FEATURE_ADAPTIVE_COMPRESS	0x8000
 
 #define __F2FS_HAS_FEATURE(raw_super, mask)				\
 	((raw_super->feature & cpu_to_le32(mask)) != 0)
@@ -361,6 +363,18 @@ struct ckpt_req_control {
 	unsigned int peak_time;		/* peak wait time in msec until now */
 };
 
+/* checkpoint phases whose durations are kept in histograms */
+enum cp_phase {
+	CP_PHASE_PREPARE,	/* flushing while operations still run */
+	CP_PHASE_BLOCK_OPS,	/* block_operations() */
+	CP_PHASE_BLOCKED,	/* operations blocked until unblock_operations() */
+	CP_PHASE_TOTAL,		/* whole f2fs_write_checkpoint() */
+	NR_CP_PHASE,
+};
+
+/* log2 buckets of microseconds, the last one is open ended */
+#define CP_LAT_BUCKETS		24
+
 /* for the bitmap indicate blocks to be discarded */
 struct discard_entry {
 	struct list_head list;	/* list head */
@@ -872,6 +886,14 @@ struct f2fs_inode_info {
 	unsigned char i_compress_level;		/* compress level (lz4hc,zstd) */
 	unsigned short i_compress_flag;		/* compress flag */
 	unsigned int i_cluster_size;		/* cluster size */
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	/* compress statistics since the inode was loaded */
+	atomic64_t i_compr_clusters;		/* # of clusters written compressed */
+	atomic64_t i_raw_clusters;		/* # of clusters written raw */
+	atomic64_t i_escalated_clusters;	/* # of adaptive clusters in zstd */
+	atomic64_t i_compr_raw_bytes;		/* input size of compressed clusters */
+	atomic64_t i_compr_bytes;		/* output size of compressed clusters */
+#endif
 
 	unsigned int atomic_write_cnt;
 	loff_t original_i_size;		/* original i_size before atomic write */
@@ -1637,6 +1659,7 @@ enum compress_algorithm_type {
 
 enum compress_flag {
 	COMPRESS_CHKSUM,
+	COMPRESS_ADAPTIVE,	/* per-cluster lz4 or zstd, zstd inodes only */
 	COMPRESS_MAX_FLAG,
 };
 
@@ -1644,6 +1667,8 @@ enum compress_flag {
 #define	COMPRESS_PERCENT			20
 
 #define COMPRESS_DATA_RESERVED_SIZE		4
+/* reserved[] word holding the algorithm of an adaptive cluster */
+#define COMPRESS_DATA_ALGORITHM			0
 struct compress_data {
 	__le32 clen;			/* compressed data size */
 	__le32 chksum;			/* compressed data chksum */
@@ -1676,6 +1701,18 @@ struct compress_ctx {
 	void *private2;			/* extra payload buffer */
 };
 
+#define DEF_COMPRESS_QUEUE_DEPTH	8	/* default clusters in flight */
+#define MAX_COMPRESS_QUEUE_DEPTH	64
+
+/* clusters of one writeback being compressed by the compress workers */
+struct compress_queue {
+	struct compress_work *works;	/* ring of cluster slots */
+	unsigned int size;		/* slot count, 0 if compressing inline */
+	unsigned int head;		/* slot of the oldest queued cluster */
+	unsigned int nr;		/* queued cluster count */
+	bool need_balance;		/* f2fs_balance_fs() deferred */
+};
+
 /* compress context for write IO path */
 struct compress_io_ctx {
 	u32 magic;			/* magic number to indicate page is compressed */
@@ -1729,8 +1766,10 @@ struct decompress_io_ctx {
 
 	bool failed;			/* IO error occurred before decompression? */
 	bool need_verity;		/* need fs-verity verification after decompression? */
+	bool in_scratch;		/* decompress through per-CPU buffers? */
 	void *private;			/* payload buffer for specified decompression algorithm */
 	void *private2;			/* extra payload buffer */
+	struct work_struct decompress_work; /* work to decompress in task context */
 	struct work_struct verity_work;	/* work to verify the decompressed pages */
 	struct work_struct free_work;	/* work for late free this structure itself */
 };
@@ -1866,6 +1905,10 @@ struct f2fs_sb_info {
 	unsigned long last_time[MAX_TIME];	/* to store time in jiffies */
 	long interval_time[MAX_TIME];		/* to store thresholds */
 	struct ckpt_req_control cprc_info;	/* for checkpoint request control */
+	atomic_long_t cp_phase_hist[NR_CP_PHASE][CP_LAT_BUCKETS];
+						/* checkpoint phase durations */
+	atomic_long_t cp_wait_hist[CP_LAT_BUCKETS];
+						/* ops blocked on cp_rwsem */
 
 	struct inode_management im[MAX_INO_ENTRY];	/* manage inode cache */
 
@@ -2061,6 +2104,10 @@ struct f2fs_sb_info {
 	unsigned int compress_percent;		/* cache page percentage */
 	unsigned int compress_watermark;	/* cache page watermark */
 	atomic_t compress_page_hit;		/* cache hit count */
+
+	/* For parallel compression in writeback */
+	struct workqueue_struct *compress_wq;	/* compress workers */
+	unsigned int compress_queue_depth;	/* clusters in flight per writeback */
 #endif
 
 #ifdef CONFIG_F2FS_IOSTAT
@@ -2475,9 +2522,24 @@ static inline void f2fs_up_write(struct f2fs_rwsem *sem)
 #endif
 }
 
+static inline void f2fs_account_cp_lat(atomic_long_t *hist, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+
+	atomic_long_inc(&hist[min_t(int, fls64(us), CP_LAT_BUCKETS - 1)]);
+}
+
 static inline void f2fs_lock_op(struct f2fs_sb_info *sbi)
 {
+	u64 start;
+
+	if (f2fs_down_read_trylock(&sbi->cp_rwsem))
+		return;
+
+	/* only operations held off by a checkpoint are timed */
+	start = ktime_get_ns();
 	f2fs_down_read(&sbi->cp_rwsem);
+	f2fs_account_cp_lat(sbi->cp_wait_hist, ktime_get_ns() - start);
 }
 
 static inline int f2fs_trylock_op(struct f2fs_sb_info *sbi)
@@ -4069,6 +4131,8 @@ struct page *f2fs_get_meta_page_retry(struct f2fs_sb_info *sbi, pgoff_t index);
 struct page *f2fs_get_tmp_page(struct f2fs_sb_info *sbi, pgoff_t index);
 bool f2fs_is_valid_blkaddr(struct f2fs_sb_info *sbi,
 					block_t blkaddr, int type);
+bool f2fs_is_valid_data_blkaddr_range(struct f2fs_sb_info *sbi,
+					block_t blkaddr, unsigned int len);
 int f2fs_ra_meta_pages(struct f2fs_sb_info *sbi, block_t start, int nrpages,
 			int type, bool sync);
 void f2fs_ra_meta_pages_cond(struct f2fs_sb_info *sbi, pgoff_t index,
@@ -4574,6 +4638,17 @@ int f2fs_write_multi_pages(struct compress_ctx *cc,
 						int *submitted,
 						struct writeback_control *wbc,
 						enum iostat_type io_type);
+void f2fs_init_compress_queue(struct compress_queue *cq, struct inode *inode);
+void f2fs_destroy_compress_queue(struct compress_queue *cq);
+int f2fs_queue_multi_pages(struct compress_queue *cq, struct compress_ctx *cc,
+						int *submitted,
+						struct writeback_control *wbc,
+						enum iostat_type io_type);
+int f2fs_flush_compress_queue(struct compress_queue *cq, int *submitted,
+						struct writeback_control *wbc,
+						enum iostat_type io_type);
+int f2fs_init_compress_wq(struct f2fs_sb_info *sbi);
+void f2fs_destroy_compress_wq(struct f2fs_sb_info *sbi);
 int f2fs_is_compressed_cluster(struct inode *inode, pgoff_t index);
 void f2fs_update_extent_tree_range_compressed(struct inode *inode,
 				pgoff_t fofs, block_t blkaddr, unsigned int llen,
@@ -4645,6 +4720,8 @@ static inline unsigned int f2fs_cluster_blocks_are_contiguous(struct dnode_of_da
 static inline bool f2fs_sanity_check_cluster(struct dnode_of_data *dn) { return false; }
 static inline int f2fs_init_compress_inode(struct f2fs_sb_info *sbi) { return 0; }
 static inline void f2fs_destroy_compress_inode(struct f2fs_sb_info *sbi) { }
+static inline int f2fs_init_compress_wq(struct f2fs_sb_info *sbi) { return 0; }
+static inline void f2fs_destroy_compress_wq(struct f2fs_sb_info *sbi) { }
 static inline int f2fs_init_page_array_cache(struct f2fs_sb_info *sbi) { return 0; }
 static inline void f2fs_destroy_page_array_cache(struct f2fs_sb_info *sbi) { }
 static inline int __init f2fs_init_compress_cache(void) { return 0; }
@@ -4675,6 +4752,9 @@ static inline int set_compress_context(struct inode *inode)
 	F2FS_I(inode)->i_compress_flag =
 			F2FS_OPTION(sbi).compress_chksum ?
 				1 << COMPRESS_CHKSUM : 0;
+	if (F2FS_I(inode)->i_compress_algorithm == COMPRESS_ZSTD &&
+			F2FS_OPTION(sbi).compress_adaptive)
+		F2FS_I(inode)->i_compress_flag |= 1 << COMPRESS_ADAPTIVE;
 	F2FS_I(inode)->i_cluster_size =
 			1 << F2FS_I(inode)->i_log_cluster_size;
 	if ((F2FS_I(inode)->i_compress_algorithm == COMPRESS_LZ4 ||
@@ -4730,6 +4810,7 @@ F2FS_FEATURE_FUNCS(sb_chksum, SB_CHKSUM);
 F2FS_FEATURE_FUNCS(casefold, CASEFOLD);
 F2FS_FEATURE_FUNCS(compression, COMPRESSION);
 F2FS_FEATURE_FUNCS(readonly, RO);
+F2FS_FEATURE_FUNCS(adaptive_compress, ADAPTIVE_COMPRESS);
 
 static inline bool f2fs_may_extent_tree(struct inode *inode)
 {
@@ -4125,6 +4125,35 @@ static int f2fs_ioc_get_compress_option(struct file *filp, unsigned long arg)
 	return 0;
 }
 
+static int f2fs_ioc_get_compress_stats(struct file *filp, unsigned long arg)
+{
+	struct inode *inode = file_inode(filp);
+	struct f2fs_comp_stats stats;
+
+	if (!f2fs_sb_has_compression(F2FS_I_SB(inode)))
+		return -EOPNOTSUPP;
+
+	if (!f2fs_compressed_file(inode))
+		return -ENODATA;
+
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	stats.compr_clusters = atomic64_read(&F2FS_I(inode)->i_compr_clusters);
+	stats.raw_clusters = atomic64_read(&F2FS_I(inode)->i_raw_clusters);
+	stats.escalated_clusters =
+			atomic64_read(&F2FS_I(inode)->i_escalated_clusters);
+	stats.raw_bytes = atomic64_read(&F2FS_I(inode)->i_compr_raw_bytes);
+	stats.compr_bytes = atomic64_read(&F2FS_I(inode)->i_compr_bytes);
+#else
+	memset(&stats, 0, sizeof(stats));
+#endif
+
+	if (copy_to_user((struct f2fs_comp_stats __user *)arg, &stats,
+				sizeof(stats)))
+		return -EFAULT;
+
+	return 0;
+}
+
 static int f2fs_ioc_set_compress_option(struct file *filp, unsigned long arg)
 {
 	struct inode *inode = file_inode(filp);
@@ -4162,6 +4191,8 @@ static int f2fs_ioc_set_compress_option(struct file *filp, unsigned long arg)
 	}
 
 	F2FS_I(inode)->i_compress_algorithm = option.algorithm;
+	if (option.algorithm != COMPRESS_ZSTD)
+		F2FS_I(inode)->i_compress_flag &= ~(1 << COMPRESS_ADAPTIVE);
 	F2FS_I(inode)->i_log_cluster_size = option.log_cluster_size;
 	F2FS_I(inode)->i_cluster_size = 1 << option.log_cluster_size;
 	f2fs_mark_inode_dirty_sync(inode, true);
@@ -4483,6 +4514,8 @@ static long __f2fs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		return f2fs_sec_trim_file(filp, arg);
 	case F2FS_IOC_GET_COMPRESS_OPTION:
 		return f2fs_ioc_get_compress_option(filp, arg);
+	case F2FS_IOC_GET_COMPRESS_STATS:
+		return f2fs_ioc_get_compress_stats(filp, arg);
 	case F2FS_IOC_SET_COMPRESS_OPTION:
 		return f2fs_ioc_set_compress_option(filp, arg);
 	case F2FS_IOC_DECOMPRESS_FILE:
@@ -5218,6 +5251,7 @@ long f2fs_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case F2FS_IOC_RESERVE_COMPRESS_BLOCKS:
 	case F2FS_IOC_SEC_TRIM_FILE:
 	case F2FS_IOC_GET_COMPRESS_OPTION:
+	case F2FS_IOC_GET_COMPRESS_STATS:
 	case F2FS_IOC_SET_COMPRESS_OPTION:
 	case F2FS_IOC_DECOMPRESS_FILE:
 	case F2FS_IOC_COMPRESS_FILE:
@@ -331,6 +331,13 @@ static bool sanity_check_inode(struct inode *inode, struct page *node_page)
 				  ri->i_log_cluster_size);
 			return false;
 		}
+		if (le16_to_cpu(ri->i_compress_flag) & 1 << COMPRESS_ADAPTIVE &&
+				!f2fs_sb_has_adaptive_compress(sbi)) {
+			set_sbi_flag(sbi, SBI_NEED_FSCK);
+			f2fs_warn(sbi, "%s: inode (ino=%lx) has adaptive compress flag, but adaptive_compress feature is off",
+				  __func__, inode->i_ino);
+			return false;
+		}
 	}
 
 	return true;
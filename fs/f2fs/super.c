@@ -165,6 +165,7 @@ enum {
 	Opt_compress_extension,
 	Opt_nocompress_extension,
 	Opt_compress_chksum,
+	Opt_compress_adaptive,
 	Opt_compress_mode,
 	Opt_compress_cache,
 	Opt_atgc,
@@ -244,6 +245,7 @@ static match_table_t f2fs_tokens = {
 	{Opt_compress_extension, "compress_extension=%s"},
 	{Opt_nocompress_extension, "nocompress_extension=%s"},
 	{Opt_compress_chksum, "compress_chksum"},
+	{Opt_compress_adaptive, "compress_adaptive"},
 	{Opt_compress_mode, "compress_mode=%s"},
 	{Opt_compress_cache, "compress_cache"},
 	{Opt_atgc, "atgc"},
@@ -1305,6 +1307,13 @@ static int parse_options(struct super_block *sb, char *options, bool is_remount)
 		case Opt_compress_chksum:
 			F2FS_OPTION(sbi).compress_chksum = true;
 			break;
+		case Opt_compress_adaptive:
+			if (!f2fs_sb_has_adaptive_compress(sbi)) {
+				f2fs_info(sbi, "Image doesn't support adaptive compression");
+				break;
+			}
+			F2FS_OPTION(sbi).compress_adaptive = true;
+			break;
 		case Opt_compress_mode:
 			name = match_strdup(&args[0]);
 			if (!name)
@@ -1328,6 +1337,7 @@ static int parse_options(struct super_block *sb, char *options, bool is_remount)
 		case Opt_compress_extension:
 		case Opt_nocompress_extension:
 		case Opt_compress_chksum:
+		case Opt_compress_adaptive:
 		case Opt_compress_mode:
 		case Opt_compress_cache:
 			f2fs_info(sbi, "compression options not supported");
@@ -1404,6 +1414,11 @@ default_check:
 		return -EINVAL;
 	}
 #endif
+	if (f2fs_sb_has_adaptive_compress(sbi) &&
+			!f2fs_sb_has_compression(sbi)) {
+		f2fs_err(sbi, "Adaptive compression feature requires compression feature");
+		return -EINVAL;
+	}
 	/*
 	 * The BLKZONED feature indicates that the drive was formatted with
 	 * zone alignment optimization. This is optional for host-aware
@@ -1734,6 +1749,7 @@ static void f2fs_put_super(struct super_block *sb)
 	f2fs_destroy_node_manager(sbi);
 	f2fs_destroy_segment_manager(sbi);
 
+	f2fs_destroy_compress_wq(sbi);
 	f2fs_destroy_post_read_wq(sbi);
 
 	kvfree(sbi->ckpt);
@@ -1991,6 +2007,8 @@ static inline void f2fs_show_compress_options(struct seq_file *seq,
 
 	if (F2FS_OPTION(sbi).compress_chksum)
 		seq_puts(seq, ",compress_chksum");
+	if (F2FS_OPTION(sbi).compress_adaptive)
+		seq_puts(seq, ",compress_adaptive");
 
 	if (F2FS_OPTION(sbi).compress_mode == COMPR_MODE_FS)
 		seq_printf(seq, ",compress_mode=%s", "fs");
@@ -4406,6 +4424,12 @@ try_onemore:
 		goto free_devices;
 	}
 
+	err = f2fs_init_compress_wq(sbi);
+	if (err) {
+		f2fs_err(sbi, "Failed to initialize compress workqueue");
+		goto free_post_read_wq;
+	}
+
 	sbi->total_valid_node_count =
 				le32_to_cpu(sbi->ckpt->valid_node_count);
 	percpu_counter_set(&sbi->total_valid_inode_count,
@@ -4676,6 +4700,8 @@ free_sm:
 	f2fs_destroy_segment_manager(sbi);
 stop_ckpt_thread:
 	f2fs_stop_ckpt_thread(sbi);
+	f2fs_destroy_compress_wq(sbi);
+free_post_read_wq:
 	f2fs_destroy_post_read_wq(sbi);
 free_devices:
 	destroy_device_list(sbi);
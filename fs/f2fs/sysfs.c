@@ -242,6 +242,9 @@ static ssize_t features_show(struct f2fs_attr *a,
 	if (f2fs_sb_has_compression(sbi))
 		len += scnprintf(buf + len, PAGE_SIZE - len, "%s%s",
 				len ? ", " : "", "compression");
+	if (f2fs_sb_has_adaptive_compress(sbi))
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s%s",
+				len ? ", " : "", "adaptive_compress");
 	len += scnprintf(buf + len, PAGE_SIZE - len, "%s%s",
 				len ? ", " : "", "pin_file");
 	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
@@ -960,6 +963,13 @@ out:
 		sbi->compr_new_inode = 0;
 		return count;
 	}
+
+	if (!strcmp(a->attr.name, "compress_queue_depth")) {
+		if (t < 1 || t > MAX_COMPRESS_QUEUE_DEPTH)
+			return -EINVAL;
+		sbi->compress_queue_depth = t;
+		return count;
+	}
 #endif
 
 	if (!strcmp(a->attr.name, "atgc_candidate_ratio")) {
@@ -1328,9 +1338,11 @@ F2FS_FEATURE_RO_ATTR(casefold);
 F2FS_FEATURE_RO_ATTR(readonly);
 #ifdef CONFIG_F2FS_FS_COMPRESSION
 F2FS_FEATURE_RO_ATTR(compression);
+F2FS_FEATURE_RO_ATTR(adaptive_compress);
 F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, compr_written_block, compr_written_block);
 F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, compr_saved_block, compr_saved_block);
 F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, compr_new_inode, compr_new_inode);
+F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, compress_queue_depth, compress_queue_depth);
 #endif
 F2FS_FEATURE_RO_ATTR(pin_file);
 
@@ -1459,6 +1471,7 @@ static struct attribute *f2fs_attrs[] = {
 	ATTR_LIST(compr_written_block),
 	ATTR_LIST(compr_saved_block),
 	ATTR_LIST(compr_new_inode),
+	ATTR_LIST(compress_queue_depth),
 #endif
 	/* For ATGC */
 	ATTR_LIST(atgc_candidate_ratio),
@@ -1507,6 +1520,7 @@ static struct attribute *f2fs_feat_attrs[] = {
 	ATTR_LIST(readonly),
 #ifdef CONFIG_F2FS_FS_COMPRESSION
 	ATTR_LIST(compression),
+	ATTR_LIST(adaptive_compress),
 #endif
 	ATTR_LIST(pin_file),
 #ifdef CONFIG_F2FS_SEC_SUPPORT_DNODE_RELOCATION
@@ -1537,6 +1551,7 @@ F2FS_SB_FEATURE_RO_ATTR(sb_checksum, SB_CHKSUM);
 F2FS_SB_FEATURE_RO_ATTR(casefold, CASEFOLD);
 F2FS_SB_FEATURE_RO_ATTR(compression, COMPRESSION);
 F2FS_SB_FEATURE_RO_ATTR(readonly, RO);
+F2FS_SB_FEATURE_RO_ATTR(adaptive_compress, ADAPTIVE_COMPRESS);
 
 static struct attribute *f2fs_sb_feat_attrs[] = {
 	ATTR_LIST(sb_encryption),
@@ -1553,6 +1568,7 @@ static struct attribute *f2fs_sb_feat_attrs[] = {
 	ATTR_LIST(sb_casefold),
 	ATTR_LIST(sb_compression),
 	ATTR_LIST(sb_readonly),
+	ATTR_LIST(sb_adaptive_compress),
 	NULL,
 };
 ATTRIBUTE_GROUPS(f2fs_sb_feat);
@@ -1723,6 +1739,28 @@ static int __maybe_unused victim_bits_seq_show(struct seq_file *seq,
 	return 0;
 }
 
+static int __maybe_unused cp_latency_info_seq_show(struct seq_file *seq,
+						void *offset)
+{
+	struct super_block *sb = seq->private;
+	struct f2fs_sb_info *sbi = F2FS_SB(sb);
+	int i, j;
+
+	seq_puts(seq, "format: bucket(us)|prepare|block_ops|blocked|total|cp_rwsem_wait\n");
+
+	for (i = 0; i < CP_LAT_BUCKETS; i++) {
+		if (i == CP_LAT_BUCKETS - 1)
+			seq_printf(seq, ">=%-10lu", 1UL << (i - 1));
+		else
+			seq_printf(seq, "<%-11lu", 1UL << i);
+		for (j = 0; j < NR_CP_PHASE; j++)
+			seq_printf(seq, " %ld",
+				atomic_long_read(&sbi->cp_phase_hist[j][i]));
+		seq_printf(seq, " %ld\n", atomic_long_read(&sbi->cp_wait_hist[i]));
+	}
+	return 0;
+}
+
 int __init f2fs_init_sysfs(void)
 {
 	int ret;
@@ -1816,6 +1854,8 @@ int f2fs_register_sysfs(struct f2fs_sb_info *sbi)
 #endif
 		proc_create_single_data("victim_bits", 0444, sbi->s_proc,
 				victim_bits_seq_show, sb);
+		proc_create_single_data("cp_latency_info", 0444, sbi->s_proc,
+				cp_latency_info_seq_show, sb);
 	}
 	return 0;
 put_feature_list_kobj:
@@ -1839,6 +1879,7 @@ void f2fs_unregister_sysfs(struct f2fs_sb_info *sbi)
 		remove_proc_entry("segment_info", sbi->s_proc);
 		remove_proc_entry("segment_bits", sbi->s_proc);
 		remove_proc_entry("victim_bits", sbi->s_proc);
+		remove_proc_entry("cp_latency_info", sbi->s_proc);
 		remove_proc_entry(sbi->sb->s_id, f2fs_proc_root);
 	}
 
@@ -17,6 +17,7 @@
 #include <linux/xattr.h>
 
 #include <linux/kernfs.h>
+#include <uapi/linux/kernfs.h>
 #include <linux/fs_context.h>
 
 struct kernfs_iattrs {
@@ -140,6 +141,8 @@ struct kernfs_node *kernfs_new_node(struct kernfs_node *parent,
  */
 extern const struct file_operations kernfs_file_fops;
 
+long kernfs_batch_read(struct file *file, struct kernfs_batch_read __user *uarg);
+
 void kernfs_drain_open_files(struct kernfs_node *kn);
 
 /*
@@ -853,6 +853,16 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 	if (dentry->d_name.len > ofs->namelen)
 		return ERR_PTR(-ENAMETOOLONG);
 
+	/* Names missing from a listed merge dir need no lookup in the layers */
+	if (ovl_dir_cache_negative(dentry->d_parent, &dentry->d_name)) {
+		oe = ovl_alloc_entry(0);
+		if (!oe)
+			return ERR_PTR(-ENOMEM);
+		dentry->d_fsdata = oe;
+		ovl_dentry_init_reval(dentry, NULL);
+		return d_splice_alias(NULL, dentry);
+	}
+
 	old_cred = ovl_override_creds(dentry->d_sb);
 	upperdir = ovl_dentry_upper(dentry->d_parent);
 	if (upperdir) {
@@ -13,6 +13,7 @@
 #include <linux/security.h>
 #include <linux/cred.h>
 #include <linux/ratelimit.h>
+#include <linux/hash.h>
 #include "overlayfs.h"
 
 struct ovl_cache_entry {
@@ -28,9 +29,17 @@ struct ovl_cache_entry {
 	char name[];
 };
 
+/*
+ * A merged dir cache is referenced by the inode and by every file iterating
+ * it, so that it is kept across opens until the dir or one of its layers
+ * changes.  Its rb-tree holds the names from all layers, which lets
+ * ovl_dir_cache_negative() answer failed lookups.  An impure cache is
+ * not refcounted.
+ */
 struct ovl_dir_cache {
 	long refcount;
 	u64 version;
+	u64 stamp;
 	struct list_head entries;
 	struct rb_root root;
 };
@@ -198,17 +207,22 @@ static int ovl_fill_lowest(struct ovl_readdir_data *rdd,
 			   const char *name, int namelen,
 			   loff_t offset, u64 ino, unsigned int d_type)
 {
+	struct rb_node **newp = &rdd->root->rb_node;
+	struct rb_node *parent = NULL;
 	struct ovl_cache_entry *p;
 
-	p = ovl_cache_entry_find(rdd->root, name, namelen);
-	if (p) {
+	if (ovl_cache_entry_find_link(name, namelen, &newp, &parent)) {
+		p = ovl_cache_entry_from_node(*newp);
 		list_move_tail(&p->l_node, &rdd->middle);
 	} else {
 		p = ovl_cache_entry_new(rdd, name, namelen, ino, d_type);
-		if (p == NULL)
+		if (p == NULL) {
 			rdd->err = -ENOMEM;
-		else
+		} else {
 			list_add_tail(&p->l_node, &rdd->middle);
+			rb_link_node(&p->node, parent, newp);
+			rb_insert_color(&p->node, rdd->root);
+		}
 	}
 
 	return rdd->err;
@@ -235,6 +249,52 @@ void ovl_dir_cache_free(struct inode *inode)
 	}
 }
 
+/*
+ * Combined change time of the real dirs, so that a merged cache kept
+ * across opens is not used after a layer was changed under the overlay.
+ */
+static u64 ovl_dir_layers_stamp(struct dentry *dentry)
+{
+	struct path realpath;
+	u64 stamp = 0;
+	int idx, next;
+
+	for (idx = 0; idx != -1; idx = next) {
+		next = ovl_path_next(idx, dentry, &realpath);
+		stamp = hash_64(stamp ^ timespec64_to_ns(
+				&d_inode(realpath.dentry)->i_ctime), 64);
+	}
+	return stamp;
+}
+
+static bool ovl_dir_cache_valid(struct dentry *dentry,
+				struct ovl_dir_cache *cache)
+{
+	return ovl_dentry_version_get(dentry) == cache->version &&
+	       ovl_dir_layers_stamp(dentry) == cache->stamp;
+}
+
+/*
+ * Tell from the merged cache of @dir, if it has a valid one, that @name
+ * exists in none of its layers, without looking it up in each of them.
+ * Called with @dir locked.
+ */
+bool ovl_dir_cache_negative(struct dentry *dir, const struct qstr *name)
+{
+	struct ovl_dir_cache *cache = ovl_dir_cache(d_inode(dir));
+	struct ovl_cache_entry *p;
+
+	/* Remote layers can change without their dir ctime being updated */
+	if (dir->d_flags & (DCACHE_OP_REVALIDATE | DCACHE_OP_WEAK_REVALIDATE))
+		return false;
+
+	if (!cache || ovl_dir_is_real(dir) || !ovl_dir_cache_valid(dir, cache))
+		return false;
+
+	p = ovl_cache_entry_find(&cache->root, name->name, name->len);
+	return !p || p->is_whiteout;
+}
+
 static void ovl_cache_put(struct ovl_dir_file *od, struct dentry *dentry)
 {
 	struct ovl_dir_cache *cache = od->cache;
@@ -326,7 +386,7 @@ static void ovl_dir_reset(struct file *file)
 	struct dentry *dentry = file->f_path.dentry;
 	bool is_real;
 
-	if (cache && ovl_dentry_version_get(dentry) != cache->version) {
+	if (cache && !ovl_dir_cache_valid(dentry, cache)) {
 		ovl_cache_put(od, dentry);
 		od->cache = NULL;
 		od->cursor = NULL;
@@ -396,20 +456,27 @@ static struct ovl_dir_cache *ovl_cache_get(struct dentry *dentry)
 	struct ovl_dir_cache *cache;
 
 	cache = ovl_dir_cache(d_inode(dentry));
-	if (cache && ovl_dentry_version_get(dentry) == cache->version) {
+	if (cache && ovl_dir_cache_valid(dentry, cache)) {
 		WARN_ON(!cache->refcount);
 		cache->refcount++;
 		return cache;
 	}
 	ovl_set_dir_cache(d_inode(dentry), NULL);
+	/* Drop the reference of the inode, files using it keep theirs */
+	if (cache && --cache->refcount <= 0) {
+		ovl_cache_free(&cache->entries);
+		kfree(cache);
+	}
 
 	cache = kzalloc(sizeof(struct ovl_dir_cache), GFP_KERNEL);
 	if (!cache)
 		return ERR_PTR(-ENOMEM);
 
-	cache->refcount = 1;
+	/* One reference for the caller and one for the inode */
+	cache->refcount = 2;
 	INIT_LIST_HEAD(&cache->entries);
 	cache->root = RB_ROOT;
+	cache->stamp = ovl_dir_layers_stamp(dentry);
 
 	res = ovl_dir_read_merged(dentry, &cache->entries, &cache->root);
 	if (res) {
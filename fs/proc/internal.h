@@ -157,6 +157,8 @@ extern int proc_pid_status(struct seq_file *, struct pid_namespace *,
 			   struct pid *, struct task_struct *);
 extern int proc_pid_statm(struct seq_file *, struct pid_namespace *,
 			  struct pid *, struct task_struct *);
+extern int proc_pid_mem_summary(struct seq_file *, struct pid_namespace *,
+				struct pid *, struct task_struct *);
 
 /*
  * base.c
@@ -279,6 +279,12 @@ struct cpuidle_governor {
 extern int cpuidle_register_governor(struct cpuidle_governor *gov);
 extern s64 cpuidle_governor_latency_req(unsigned int cpu);
 
+#ifdef CONFIG_CPU_IDLE_GOV_WAKEUP
+extern void cpuidle_wakeup_hint(int cpu, u64 delay_ns);
+#else
+static inline void cpuidle_wakeup_hint(int cpu, u64 delay_ns) { }
+#endif
+
 #define __CPU_PM_CPU_IDLE_ENTER(low_level_idle_enter,			\
 				idx,					\
 				state,					\
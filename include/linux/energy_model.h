@@ -26,7 +26,8 @@ struct em_perf_state {
 
 /**
  * struct em_perf_domain - Performance domain
- * @table:		List of performance states, in ascending order
+ * @table:		List of performance states, in ascending order. RCU
+ *			protected, use em_perf_state_table() to access it.
  * @nr_perf_states:	Number of performance states
  * @milliwatts:		Flag indicating the power values are in milli-Watts
  *			or some other scale.
@@ -42,7 +43,7 @@ struct em_perf_state {
  * field is unused.
  */
 struct em_perf_domain {
-	struct em_perf_state *table;
+	struct em_perf_state __rcu *table;
 	int nr_perf_states;
 	int milliwatts;
 	unsigned long cpus[];
@@ -50,6 +51,20 @@ struct em_perf_domain {
 
 #define em_span_cpus(em) (to_cpumask((em)->cpus))
 
+/**
+ * em_perf_state_table() - Get the current performance states of a domain
+ * @pd		: performance domain
+ *
+ * The table can be replaced at runtime by em_dev_update_perf_domain(), so
+ * the caller must hold rcu_read_lock() for as long as it uses the result.
+ * The number of states and their frequencies never change.
+ */
+static inline struct em_perf_state *
+em_perf_state_table(struct em_perf_domain *pd)
+{
+	return rcu_dereference(pd->table);
+}
+
 #ifdef CONFIG_ENERGY_MODEL
 #define EM_MAX_POWER 0xFFFF
 
@@ -100,6 +115,8 @@ int em_dev_register_perf_domain(struct device *dev, unsigned int nr_states,
 				struct em_data_callback *cb, cpumask_t *span,
 				bool milliwatts);
 void em_dev_unregister_perf_domain(struct device *dev);
+int em_dev_update_perf_domain(struct device *dev,
+			      struct em_data_callback *cb);
 
 /**
  * em_cpu_energy() - Estimates the energy consumed by the CPUs of a
@@ -113,6 +130,7 @@ void em_dev_unregister_perf_domain(struct device *dev);
  * This function must be used only for CPU devices. There is no validation,
  * i.e. if the EM is a CPU type and has cpumask allocated. It is called from
  * the scheduler code quite frequently and that is why there is not checks.
+ * The caller must hold rcu_read_lock().
  *
  * Return: the sum of the energy consumed by the CPUs of the domain assuming
  * a capacity state satisfying the max utilization of the domain.
@@ -122,7 +140,7 @@ static inline unsigned long em_cpu_energy(struct em_perf_domain *pd,
 				unsigned long allowed_cpu_cap)
 {
 	unsigned long freq, scale_cpu;
-	struct em_perf_state *ps;
+	struct em_perf_state *ps, *table;
 	int i, cpu;
 
 	if (!sum_util)
@@ -138,7 +156,8 @@ static inline unsigned long em_cpu_energy(struct em_perf_domain *pd,
 	 */
 	cpu = cpumask_first(to_cpumask(pd->cpus));
 	scale_cpu = arch_scale_cpu_capacity(cpu);
-	ps = &pd->table[pd->nr_perf_states - 1];
+	table = em_perf_state_table(pd);
+	ps = &table[pd->nr_perf_states - 1];
 
 	max_util = map_util_perf(max_util);
 	max_util = min(max_util, allowed_cpu_cap);
@@ -149,7 +168,7 @@ static inline unsigned long em_cpu_energy(struct em_perf_domain *pd,
 	 * requested frequency.
 	 */
 	for (i = 0; i < pd->nr_perf_states; i++) {
-		ps = &pd->table[i];
+		ps = &table[i];
 		if (ps->frequency >= freq)
 			break;
 	}
@@ -225,6 +244,11 @@ int em_dev_register_perf_domain(struct device *dev, unsigned int nr_states,
 static inline void em_dev_unregister_perf_domain(struct device *dev)
 {
 }
+static inline int em_dev_update_perf_domain(struct device *dev,
+					    struct em_data_callback *cb)
+{
+	return -EINVAL;
+}
 static inline struct em_perf_domain *em_cpu_get(int cpu)
 {
 	return NULL;
@@ -245,4 +269,14 @@ static inline int em_pd_nr_perf_states(struct em_perf_domain *pd)
 }
 #endif
 
+#ifdef CONFIG_ENERGY_MODEL_TASK_ENERGY
+struct pid_namespace;
+struct seq_file;
+void em_task_account(struct task_struct *p, u64 cputime);
+int proc_em_energy_show(struct seq_file *m, struct pid_namespace *ns,
+			struct pid *pid, struct task_struct *p);
+#else
+static inline void em_task_account(struct task_struct *p, u64 cputime) {}
+#endif
+
 #endif
@@ -51,6 +51,7 @@ static inline bool freezing(struct task_struct *p)
 extern void __thaw_task(struct task_struct *t);
 
 extern bool __refrigerator(bool check_kthr_stop);
+extern void freezer_task_frozen(void);
 extern int freeze_processes(void);
 extern int freeze_kernel_threads(void);
 extern void thaw_processes(void);
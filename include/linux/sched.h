@@ -1020,6 +1020,10 @@ struct task_struct {
 #ifdef CONFIG_CPU_FREQ_TIMES
 	u64				*time_in_state;
 	unsigned int			max_state;
+#endif
+#ifdef CONFIG_ENERGY_MODEL_TASK_ENERGY
+	/* Estimated energy from the Energy Model, see em_task_account() */
+	u64				em_energy;
 #endif
 	struct prev_cputime		prev_cputime;
 #ifdef CONFIG_VIRT_CPU_ACCOUNTING_GEN
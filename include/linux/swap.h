@@ -417,6 +417,16 @@ extern void check_move_unevictable_pages(struct pagevec *pvec);
 extern void kswapd_run(int nid);
 extern void kswapd_stop(int nid);
 
+/*
+ * In-memory swap backends (zram) register their stored page and compressed
+ * byte counters, so per-process swap can be reported at its real cost.
+ */
+struct swap_compressed_stat {
+	struct list_head list;
+	atomic64_t *pages_stored;
+	atomic64_t *compr_size;
+};
+
 #ifdef CONFIG_SWAP
 
 #include <linux/blk_types.h> /* for bio_end_io_t */
@@ -528,6 +538,10 @@ static inline void put_swap_device(struct swap_info_struct *si)
 	percpu_ref_put(&si->users);
 }
 
+extern void swap_register_compressed_stat(struct swap_compressed_stat *stat);
+extern void swap_unregister_compressed_stat(struct swap_compressed_stat *stat);
+extern unsigned long swap_compressed_bytes(unsigned long nr_pages);
+
 #else /* CONFIG_SWAP */
 
 static inline int swap_readpage(struct page *page, bool do_poll)
@@ -549,6 +563,19 @@ static inline void put_swap_device(struct swap_info_struct *si)
 {
 }
 
+static inline void swap_register_compressed_stat(struct swap_compressed_stat *stat)
+{
+}
+
+static inline void swap_unregister_compressed_stat(struct swap_compressed_stat *stat)
+{
+}
+
+static inline unsigned long swap_compressed_bytes(unsigned long nr_pages)
+{
+	return 0;
+}
+
 static inline struct address_space *swap_address_space(swp_entry_t entry)
 {
 	return NULL;
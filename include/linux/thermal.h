@@ -296,7 +296,12 @@ struct thermal_zone_params {
 	 */
 	int offset;
 
-	ANDROID_KABI_RESERVE(1);
+	/*
+	 * Horizon in ms over which the power allocator forecasts the
+	 * temperature and throttles ahead of it, 0 to act on the current
+	 * temperature only
+	 */
+	ANDROID_KABI_USE(1, struct { s32 forecast_ms; s32 padding; });
 };
 
 /**
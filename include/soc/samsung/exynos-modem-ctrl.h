@@ -24,6 +24,7 @@
 struct vnet {
 	void *iod;
 	bool hiprio_ack_only;
+	bool fq_codel_attached;
 };
 
 #if IS_ENABLED(CONFIG_CP_UART_NOTI)
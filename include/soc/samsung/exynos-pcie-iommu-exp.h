@@ -12,10 +12,20 @@
 
 #include <linux/types.h>
 
+struct pcie_iommu_map_req {
+	unsigned long iova;
+	phys_addr_t paddr;
+	size_t size;
+};
+
 #if IS_ENABLED(CONFIG_EXYNOS_PCIE_IOMMU)
 int pcie_iommu_map(unsigned long iova, phys_addr_t paddr, size_t size,
 		   int prot, int ch_num);
+int pcie_iommu_map_batch(const struct pcie_iommu_map_req *req, int nr,
+			 int prot, int ch_num);
 size_t pcie_iommu_unmap(unsigned long iova, size_t size, int ch_num);
+size_t pcie_iommu_unmap_deferred(unsigned long iova, size_t size, int ch_num);
+bool pcie_iommu_tlb_sync(int ch_num);
 void pcie_sysmmu_enable(int ch_num);
 void pcie_sysmmu_disable(int ch_num);
 void pcie_sysmmu_set_use_iocc(int ch_num);
@@ -37,6 +47,13 @@ static size_t __maybe_unused pcie_iommu_map(unsigned long iova, phys_addr_t padd
 
 	return -ENODEV;
 }
+static int __maybe_unused pcie_iommu_map_batch(const struct pcie_iommu_map_req *req,
+		int nr, int prot, int ch_num)
+{
+	pr_err("PCIe SysMMU is NOT Enabled!!!\n");
+
+	return -ENODEV;
+}
 static size_t __maybe_unused pcie_iommu_unmap(unsigned long iova, size_t size,
 		int ch_num)
 {
@@ -44,6 +61,17 @@ static size_t __maybe_unused pcie_iommu_unmap(unsigned long iova, size_t size,
 
 	return -ENODEV;
 }
+static size_t __maybe_unused pcie_iommu_unmap_deferred(unsigned long iova, size_t size,
+		int ch_num)
+{
+	pr_err("PCIe SysMMU is NOT Enabled!!!\n");
+
+	return -ENODEV;
+}
+static bool __maybe_unused pcie_iommu_tlb_sync(int ch_num)
+{
+	return false;
+}
 static void __maybe_unused pcie_sysmmu_set_use_iocc(int ch_num)
 {
 	pr_err("PCIe SysMMU is NOT Enabled!!!\n");
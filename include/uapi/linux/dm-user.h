@@ -7,13 +7,15 @@
 #ifndef _LINUX_DM_USER_H
 #define _LINUX_DM_USER_H
 
+#include <linux/ioctl.h>
 #include <linux/types.h>
 
 /*
  * dm-user proxies device mapper ops between the kernel and userspace.  It's
  * essentially just an RPC mechanism: all kernel calls create a request,
  * userspace handles that with a response.  Userspace obtains requests via
- * read() and provides responses via write().
+ * read() and provides responses via write(), or in batches through a ring
+ * shared with the kernel, see below.
  *
  * See Documentation/block/dm-user.rst for more information.
  */
@@ -65,4 +67,71 @@ struct dm_user_message {
 	__u8 buf[];
 };
 
+/*
+ * Ring mode.  A channel (an open file of the misc device) can switch from
+ * read()/write() to a ring mapped into the daemon with mmap():
+ *
+ *  - DM_USER_IOC_RING_SETUP sizes the ring and returns the layout of the
+ *    area to mmap() at offset 0 of the channel's file.
+ *  - The kernel posts requests to the submission queue (sq) and the daemon
+ *    posts responses to the completion queue (cq).  The producer of a
+ *    queue advances its tail and the consumer its head; both are free
+ *    running and wrap at 2^32, entries are at index & (entries - 1).
+ *  - Each request owns one data slot of slot_size bytes in the data area
+ *    until its response is posted.  Write data is in the slot when the
+ *    request is posted, read data must be in the slot when the response
+ *    is posted.
+ *  - DM_USER_IOC_RING_ENTER consumes all posted responses, then posts as
+ *    many new requests as there are free slots and returns how many it
+ *    posted.  With DM_USER_RING_ENTER_WAIT it sleeps until there is at
+ *    least one.  poll() reports EPOLLIN while requests are pending.
+ */
+
+#define DM_USER_RING_MAX_ENTRIES 128
+
+struct dm_user_ring_setup {
+	__u32 entries;		/* in: power of two */
+	__u32 slot_size;	/* out */
+	__u64 size;		/* out: length to mmap() */
+	__u64 sq_off;		/* out: offset of the request array */
+	__u64 cq_off;		/* out: offset of the response array */
+	__u64 data_off;		/* out: offset of slot 0 */
+};
+
+struct dm_user_ring_queue {
+	__u32 head;
+	__u32 tail;
+};
+
+/* At offset 0 of the mapping, each queue on its own cache line */
+struct dm_user_ring_header {
+	struct dm_user_ring_queue sq;
+	__u32 reserved0[14];
+	struct dm_user_ring_queue cq;
+	__u32 reserved1[14];
+};
+
+struct dm_user_ring_req {
+	__u64 seq;
+	__u64 type;
+	__u64 flags;
+	__u64 sector;
+	__u64 len;
+	__u32 slot;
+	__u32 reserved;
+};
+
+struct dm_user_ring_resp {
+	__u64 seq;
+	__u32 slot;
+	__u32 type;		/* DM_USER_RESP_* */
+};
+
+#define DM_USER_RING_ENTER_WAIT 0x1
+
+#define DM_USER_IOC_MAGIC 0xfd
+#define DM_USER_IOC_RING_SETUP _IOWR(DM_USER_IOC_MAGIC, 0x40, \
+				     struct dm_user_ring_setup)
+#define DM_USER_IOC_RING_ENTER _IO(DM_USER_IOC_MAGIC, 0x41)
+
 #endif
@@ -95,4 +95,38 @@ struct dma_buf_sync {
 #define DMA_BUF_SET_NAME_A	_IOW(DMA_BUF_BASE, 1, __u32)
 #define DMA_BUF_SET_NAME_B	_IOW(DMA_BUF_BASE, 1, __u64)
 
+/*
+ * Binary snapshot of all live dma-bufs read from /proc/dmabuf_stats.
+ * The file starts with a struct dma_buf_stats_header followed by
+ * nr_records records of record_size bytes each.
+ */
+#define DMA_BUF_STATS_VERSION	1
+#define DMA_BUF_STATS_MAX_PIDS	8
+
+struct dma_buf_stats_header {
+	__u32 version;
+	__u32 record_size;
+	__u32 nr_records;
+	__u32 reserved;
+};
+
+/**
+ * struct dma_buf_stats_record - statistics of one dma-buf
+ * @inode: inode number of the dma-buf file
+ * @size: size of the buffer in bytes
+ * @attach_count: number of devices attached to the buffer
+ * @nr_pids: number of processes holding an fd of the buffer. Only the
+ *	first DMA_BUF_STATS_MAX_PIDS of them are stored in @pids.
+ * @pids: tgids of the processes holding an fd of the buffer
+ * @exp_name: name of the exporter
+ */
+struct dma_buf_stats_record {
+	__u64 inode;
+	__u64 size;
+	__u32 attach_count;
+	__u32 nr_pids;
+	__s32 pids[DMA_BUF_STATS_MAX_PIDS];
+	char exp_name[DMA_BUF_NAME_LEN];
+};
+
 #endif
@@ -48,6 +48,8 @@
 #define F2FS_IOC_STAT_COMPRESS_FILE	_IOWR(F2FS_IOCTL_MAGIC, 33, \
 						struct f2fs_sec_stat_compfile)
 #define F2FS_IOC_SET_RELIABLE_WRITE	_IO(F2FS_IOCTL_MAGIC, 34)
+#define F2FS_IOC_GET_COMPRESS_STATS	_IOR(F2FS_IOCTL_MAGIC, 35,	\
+						struct f2fs_comp_stats)
 
 /*
  * should be same as XFS_IOC_GOINGDOWN.
@@ -101,6 +103,15 @@ struct f2fs_comp_option {
 	__u8 log_cluster_size;
 };
 
+/* counted since the inode was last loaded in memory */
+struct f2fs_comp_stats {
+	__u64 compr_clusters;		/* clusters written compressed */
+	__u64 raw_clusters;		/* clusters written uncompressed */
+	__u64 escalated_clusters;	/* adaptive clusters written with zstd */
+	__u64 raw_bytes;		/* size of compressed clusters */
+	__u64 compr_bytes;		/* compressed size of them */
+};
+
 struct f2fs_sec_stat_compfile {
 	union {
 		struct {
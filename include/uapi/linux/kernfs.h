@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _UAPI_LINUX_KERNFS_H
+#define _UAPI_LINUX_KERNFS_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define KERNFS_IOC_MAGIC	0xba
+
+/*
+ * Read several attributes of a kernfs directory (sysfs, cgroup) at once.
+ *
+ * @names points to @names_len bytes of NUL separated attribute names that
+ * live directly in the directory the ioctl is issued on.  For each name, a
+ * struct kernfs_batch_entry followed by @len bytes of attribute content is
+ * stored in @buf, padded to 8 bytes.  On return @nr_entries and @buf_used
+ * tell how much of @buf was filled; -ENOSPC means @buf ran out before all
+ * names were processed.
+ */
+struct kernfs_batch_read {
+	__u64 names;
+	__u64 buf;
+	__u32 names_len;
+	__u32 buf_len;
+	__u32 nr_entries;
+	__u32 buf_used;
+};
+
+struct kernfs_batch_entry {
+	__s32 error;	/* 0 or negative errno of this attribute */
+	__u32 len;	/* bytes of content following this entry */
+};
+
+#define KERNFS_IOC_BATCH_READ	_IOWR(KERNFS_IOC_MAGIC, 0x1, struct kernfs_batch_read)
+
+#endif /* _UAPI_LINUX_KERNFS_H */
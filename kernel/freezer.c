@@ -79,6 +79,8 @@ bool __refrigerator(bool check_kthr_stop)
 
 		if (!(current->flags & PF_FROZEN))
 			break;
+		if (!was_frozen)
+			freezer_task_frozen();
 		was_frozen = true;
 		schedule();
 	}
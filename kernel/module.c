@@ -56,6 +56,7 @@
 #include <linux/pfn.h>
 #include <linux/bsearch.h>
 #include <linux/dynamic_debug.h>
+#include <linux/stringhash.h>
 #include <linux/audit.h>
 #include <uapi/linux/module.h>
 #include "module-internal.h"
@@ -518,26 +519,115 @@ static bool find_exported_symbol_in_section(const struct symsearch *syms,
 	return false;
 }
 
+static const struct symsearch core_ksymtab[] = {
+	{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
+	  NOT_GPL_ONLY },
+	{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
+	  __start___kcrctab_gpl,
+	  GPL_ONLY },
+};
+
+#ifdef CONFIG_MODULE_KSYMTAB_INDEX
+/*
+ * Hash index of the symbols exported by the core kernel, which vendor
+ * modules resolve most of their undefined symbols against. A slot holds the
+ * position of a symbol in core_ksymtab[0] plus one, or in core_ksymtab[1]
+ * with KSYMTAB_INDEX_GPL set, and 0 if it is empty. Collisions are resolved
+ * by linear probing. The index is never modified once published.
+ */
+#define KSYMTAB_INDEX_GPL	BIT(31)
+
+static u32 *ksymtab_index;
+static unsigned int ksymtab_index_mask;
+
+static unsigned int ksymtab_index_hash(const char *name)
+{
+	return full_name_hash(NULL, name, strlen(name)) & ksymtab_index_mask;
+}
+
+static int __init ksymtab_index_init(void)
+{
+	unsigned int nr, size, i, j, slot;
+	u32 *index;
+
+	nr = (__stop___ksymtab - __start___ksymtab) +
+	     (__stop___ksymtab_gpl - __start___ksymtab_gpl);
+	if (!nr)
+		return 0;
+
+	size = roundup_pow_of_two(nr * 2);
+	index = vzalloc(array_size(size, sizeof(*index)));
+	if (!index)
+		return 0;
+
+	ksymtab_index_mask = size - 1;
+	for (i = 0; i < ARRAY_SIZE(core_ksymtab); i++) {
+		const struct symsearch *syms = &core_ksymtab[i];
+
+		for (j = 0; j < syms->stop - syms->start; j++) {
+			slot = ksymtab_index_hash(kernel_symbol_name(&syms->start[j]));
+			while (index[slot])
+				slot = (slot + 1) & ksymtab_index_mask;
+			index[slot] = (j + 1) | (i ? KSYMTAB_INDEX_GPL : 0);
+		}
+	}
+
+	smp_store_release(&ksymtab_index, index);
+	pr_debug("indexed %u kernel symbols in %u slots\n", nr, size);
+
+	return 0;
+}
+core_initcall(ksymtab_index_init);
+
+/*
+ * Returns 1 if the symbol was found in the core kernel and accepted, 0 if
+ * the core kernel does not provide it and -ENOENT if there is no index.
+ */
+static int find_core_symbol_indexed(struct find_symbol_arg *fsa)
+{
+	u32 *index = smp_load_acquire(&ksymtab_index);
+	const struct symsearch *syms;
+	unsigned int slot, pos;
+
+	if (!index)
+		return -ENOENT;
+
+	for (slot = ksymtab_index_hash(fsa->name); index[slot];
+	     slot = (slot + 1) & ksymtab_index_mask) {
+		syms = &core_ksymtab[index[slot] & KSYMTAB_INDEX_GPL ? 1 : 0];
+		pos = (index[slot] & ~KSYMTAB_INDEX_GPL) - 1;
+
+		if (!strcmp(fsa->name, kernel_symbol_name(&syms->start[pos])))
+			return check_exported_symbol(syms, NULL, pos, fsa);
+	}
+
+	return 0;
+}
+#else
+static inline int find_core_symbol_indexed(struct find_symbol_arg *fsa)
+{
+	return -ENOENT;
+}
+#endif
+
 /*
  * Find an exported symbol and return it, along with, (optional) crc and
  * (optional) module which owns it.  Needs preempt disabled or module_mutex.
  */
 static bool find_symbol(struct find_symbol_arg *fsa)
 {
-	static const struct symsearch arr[] = {
-		{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
-		  NOT_GPL_ONLY },
-		{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
-		  __start___kcrctab_gpl,
-		  GPL_ONLY },
-	};
 	struct module *mod;
 	unsigned int i;
+	int ret;
 
 	module_assert_mutex_or_preempt();
 
-	for (i = 0; i < ARRAY_SIZE(arr); i++)
-		if (find_exported_symbol_in_section(&arr[i], NULL, fsa))
+	ret = find_core_symbol_indexed(fsa);
+	if (ret > 0)
+		return true;
+
+	for (i = 0; ret < 0 && i < ARRAY_SIZE(core_ksymtab); i++)
+		if (find_exported_symbol_in_section(&core_ksymtab[i], NULL, fsa))
 			return true;
 
 	list_for_each_entry_rcu(mod, &modules, list,
@@ -1437,17 +1527,31 @@ static const struct kernel_symbol *resolve_symbol(struct module *mod,
 		.gplok	= !(mod->taints & (1 << TAINT_PROPRIETARY_MODULE)),
 		.warn	= true,
 	};
+	bool core, locked = false;
 	int err;
 
 	/*
-	 * The module_mutex should not be a heavily contended lock;
-	 * if we get the occasional sleep here, we'll go an extra iteration
-	 * in the wait_event_interruptible(), which is harmless.
+	 * Symbols exported by the core kernel need no reference on their
+	 * owner, so look them up without module_mutex first. Modules loaded
+	 * in parallel then only contend for symbols exported by modules.
 	 */
-	sched_annotate_sleep();
-	mutex_lock(&module_mutex);
-	if (!find_symbol(&fsa))
-		goto unlock;
+	preempt_disable();
+	core = find_symbol(&fsa) && !fsa.owner;
+	preempt_enable();
+
+	if (!core) {
+		/*
+		 * The module_mutex should not be a heavily contended lock;
+		 * if we get the occasional sleep here, we'll go an extra
+		 * iteration in the wait_event_interruptible(), which is
+		 * harmless.
+		 */
+		sched_annotate_sleep();
+		mutex_lock(&module_mutex);
+		locked = true;
+		if (!find_symbol(&fsa))
+			goto unlock;
+	}
 
 	if (fsa.license == GPL_ONLY)
 		mod->using_gplonly_symbols = true;
@@ -1478,7 +1582,8 @@ getname:
 	/* We must make copy under the lock if we failed to get ref. */
 	strncpy(ownername, module_name(fsa.owner), MODULE_NAME_LEN);
 unlock:
-	mutex_unlock(&module_mutex);
+	if (locked)
+		mutex_unlock(&module_mutex);
 	return fsa.sym;
 }
 
@@ -4066,6 +4171,51 @@ static int unknown_module_param_cb(char *param, char *val, const char *modname,
 
 static void cfi_init(struct module *mod);
 
+/*
+ * Cost of each module load, kept for /proc/module_load_stats so that the
+ * modules which slow down boot can be found.  Failed loads are kept too,
+ * with the times of the steps they got through.
+ */
+struct module_load_stat {
+	struct list_head list;
+	char name[MODULE_NAME_LEN];
+	unsigned int size;
+	int ret;
+	ktime_t start;		/* since boot */
+	ktime_t symbols;	/* resolving undefined symbols */
+	ktime_t relocs;		/* applying relocations */
+	ktime_t load;		/* from load_module() to the init call */
+	ktime_t init;		/* do_init_module() */
+};
+
+#define MODULE_LOAD_STATS_MAX	1024
+
+static LIST_HEAD(module_load_stats);
+static DEFINE_SPINLOCK(module_load_stats_lock);
+static unsigned int nr_module_load_stats;
+
+static void module_load_stat_add(const struct module_load_stat *stat)
+{
+	struct module_load_stat *s;
+
+	if (READ_ONCE(nr_module_load_stats) >= MODULE_LOAD_STATS_MAX)
+		return;
+
+	s = kmemdup(stat, sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return;
+
+	spin_lock(&module_load_stats_lock);
+	if (nr_module_load_stats < MODULE_LOAD_STATS_MAX) {
+		list_add_tail(&s->list, &module_load_stats);
+		nr_module_load_stats++;
+		s = NULL;
+	}
+	spin_unlock(&module_load_stats_lock);
+
+	kfree(s);
+}
+
 /*
  * Allocate and load the module: note that size of section 0 is always
  * zero, and we rely on this for optional sections.
@@ -4076,10 +4226,16 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	struct module *mod;
 	long err = 0;
 	char *after_dashes;
+	struct module_load_stat stat = { };
+	ktime_t t0, t1;
 #ifdef CONFIG_RKP
 	struct module_info rkp_mod_info;
 #endif
 
+	strscpy(stat.name, "-", sizeof(stat.name));
+	stat.start = ktime_get_boottime();
+	t0 = ktime_get();
+
 	/*
 	 * Do the signature check (if any) first. All that
 	 * the signature check needs is info->len, it does
@@ -4186,10 +4342,13 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	setup_modinfo(mod, info);
 
 	/* Fix up syms, so that st_value is a pointer to location. */
+	t1 = ktime_get();
 	err = simplify_symbols(mod, info);
 	if (err < 0)
 		goto free_modinfo;
+	stat.symbols = ktime_sub(ktime_get(), t1);
 
+	t1 = ktime_get();
 	err = apply_relocations(mod, info);
 	if (err < 0)
 		goto free_modinfo;
@@ -4197,6 +4356,7 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	err = post_relocation(mod, info);
 	if (err < 0)
 		goto free_modinfo;
+	stat.relocs = ktime_sub(ktime_get(), t1);
 
 	flush_module_icache(mod);
 
@@ -4254,7 +4414,19 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	/* Done! */
 	trace_module_load(mod);
 
-	return do_init_module(mod);
+	/* mod may be freed by a failing init, so copy what we report first */
+	strscpy(stat.name, mod->name, sizeof(stat.name));
+	stat.size = mod->init_layout.size + mod->core_layout.size;
+	t1 = ktime_get();
+	stat.load = ktime_sub(t1, t0);
+
+	err = do_init_module(mod);
+
+	stat.init = ktime_sub(ktime_get(), t1);
+	stat.ret = err;
+	module_load_stat_add(&stat);
+
+	return err;
 
  sysfs_cleanup:
 	mod_sysfs_teardown(mod);
@@ -4309,6 +4481,13 @@ static int load_module(struct load_info *info, const char __user *uargs,
 
 	module_deallocate(mod, info);
  free_copy:
+	/* info->name is in the copy, and is only set once it was parsed */
+	if (info->name)
+		strscpy(stat.name, info->name, sizeof(stat.name));
+	stat.load = ktime_sub(ktime_get(), t0);
+	stat.ret = err;
+	module_load_stat_add(&stat);
+
 	free_copy(info);
 	return err;
 }
@@ -4793,9 +4972,38 @@ static const struct proc_ops modules_proc_ops = {
 	.proc_release	= seq_release,
 };
 
+/*
+ * Format: modulename size start_ms symbols_us relocs_us load_us init_us ret
+ *
+ * start_ms is the time since boot at which loading began, load_us the time
+ * spent from then until the init call, including symbols_us and relocs_us.
+ * For a load that failed before the init call, ret is the error, load_us
+ * the time until it failed and the steps not reached are 0.  size is 0,
+ * and the name is "-" if the load failed before it was known.
+ */
+static int module_load_stats_show(struct seq_file *m, void *v)
+{
+	struct module_load_stat *s;
+
+	seq_puts(m, "module size start_ms symbols_us relocs_us load_us init_us ret\n");
+
+	spin_lock(&module_load_stats_lock);
+	list_for_each_entry(s, &module_load_stats, list) {
+		seq_printf(m, "%s %u %lld %lld %lld %lld %lld %d\n",
+			   s->name, s->size, ktime_to_ms(s->start),
+			   ktime_to_us(s->symbols), ktime_to_us(s->relocs),
+			   ktime_to_us(s->load), ktime_to_us(s->init), s->ret);
+	}
+	spin_unlock(&module_load_stats_lock);
+
+	return 0;
+}
+
 static int __init proc_modules_init(void)
 {
 	proc_create("modules", 0, NULL, &modules_proc_ops);
+	proc_create_single("module_load_stats", 0400, NULL,
+			   module_load_stats_show);
 	return 0;
 }
 module_init(proc_modules_init);
@@ -10,9 +10,13 @@
 #define pr_fmt(fmt) "energy_model: " fmt
 
 #include <linux/cpu.h>
+#include <linux/cpufreq.h>
 #include <linux/cpumask.h>
+#include <linux/cred.h>
 #include <linux/debugfs.h>
 #include <linux/energy_model.h>
+#include <linux/hashtable.h>
+#include <linux/proc_fs.h>
 #include <linux/sched/topology.h>
 #include <linux/slab.h>
 #include <trace/hooks/sched.h>
@@ -66,6 +70,7 @@ DEFINE_SHOW_ATTRIBUTE(em_debug_units);
 
 static void em_debug_create_pd(struct device *dev)
 {
+	struct em_perf_state *table;
 	struct dentry *d;
 	int i;
 
@@ -79,8 +84,10 @@ static void em_debug_create_pd(struct device *dev)
 	debugfs_create_file("units", 0444, d, dev->em_pd, &em_debug_units_fops);
 
 	/* Create a sub-directory for each performance state */
+	table = rcu_dereference_protected(dev->em_pd->table,
+					  lockdep_is_held(&em_pd_mutex));
 	for (i = 0; i < dev->em_pd->nr_perf_states; i++)
-		em_debug_create_ps(&dev->em_pd->table[i], d);
+		em_debug_create_ps(&table[i], d);
 
 }
 
@@ -89,6 +96,42 @@ static void em_debug_remove_pd(struct device *dev)
 	debugfs_lookup_and_remove(dev_name(dev), rootdir);
 }
 
+/*
+ * The per-state files point into the table, so they have to be recreated
+ * once a new table is installed. The domain directory is named after the
+ * device used at registration, which for CPUs can be any CPU of the span.
+ */
+static void em_debug_update_pd(struct device *dev)
+{
+	struct em_perf_domain *pd = dev->em_pd;
+	struct em_perf_state *table;
+	struct dentry *d = NULL;
+	char name[24];
+	int cpu, i;
+
+	if (_is_cpu_device(dev)) {
+		for_each_cpu(cpu, em_span_cpus(pd)) {
+			d = debugfs_lookup(dev_name(get_cpu_device(cpu)),
+					   rootdir);
+			if (d)
+				break;
+		}
+	} else {
+		d = debugfs_lookup(dev_name(dev), rootdir);
+	}
+	if (!d)
+		return;
+
+	table = rcu_dereference_protected(pd->table,
+					  lockdep_is_held(&em_pd_mutex));
+	for (i = 0; i < pd->nr_perf_states; i++) {
+		snprintf(name, sizeof(name), "ps:%lu", table[i].frequency);
+		debugfs_lookup_and_remove(name, d);
+		em_debug_create_ps(&table[i], d);
+	}
+	dput(d);
+}
+
 static int __init em_debug_init(void)
 {
 	/* Create /sys/kernel/debug/energy_model directory */
@@ -100,10 +143,12 @@ fs_initcall(em_debug_init);
 #else /* CONFIG_DEBUG_FS */
 static void em_debug_create_pd(struct device *dev) {}
 static void em_debug_remove_pd(struct device *dev) {}
+static void em_debug_update_pd(struct device *dev) {}
 #endif
 
-static int em_create_perf_table(struct device *dev, struct em_perf_domain *pd,
-				int nr_states, struct em_data_callback *cb)
+static struct em_perf_state *em_compute_table(struct device *dev,
+					      int nr_states,
+					      struct em_data_callback *cb)
 {
 	unsigned long power, freq, prev_freq = 0, prev_cost = ULONG_MAX;
 	struct em_perf_state *table;
@@ -112,7 +157,7 @@ static int em_create_perf_table(struct device *dev, struct em_perf_domain *pd,
 
 	table = kcalloc(nr_states, sizeof(*table), GFP_KERNEL);
 	if (!table)
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 
 	/* Build the list of performance states for this performance domain */
 	for (i = 0, freq = 0; i < nr_states; i++, freq++) {
@@ -167,14 +212,26 @@ static int em_create_perf_table(struct device *dev, struct em_perf_domain *pd,
 		}
 	}
 
-	pd->table = table;
-	pd->nr_perf_states = nr_states;
-
-	return 0;
+	return table;
 
 free_ps_table:
 	kfree(table);
-	return -EINVAL;
+	return ERR_PTR(-EINVAL);
+}
+
+static int em_create_perf_table(struct device *dev, struct em_perf_domain *pd,
+				int nr_states, struct em_data_callback *cb)
+{
+	struct em_perf_state *table;
+
+	table = em_compute_table(dev, nr_states, cb);
+	if (IS_ERR(table))
+		return PTR_ERR(table);
+
+	RCU_INIT_POINTER(pd->table, table);
+	pd->nr_perf_states = nr_states;
+
+	return 0;
 }
 
 static int em_create_pd(struct device *dev, int nr_states,
@@ -364,9 +421,186 @@ void em_dev_unregister_perf_domain(struct device *dev)
 	mutex_lock(&em_pd_mutex);
 	em_debug_remove_pd(dev);
 
-	kfree(dev->em_pd->table);
+	kfree(rcu_dereference_protected(dev->em_pd->table,
+					lockdep_is_held(&em_pd_mutex)));
 	kfree(dev->em_pd);
 	dev->em_pd = NULL;
 	mutex_unlock(&em_pd_mutex);
 }
 EXPORT_SYMBOL_GPL(em_dev_unregister_perf_domain);
+
+/**
+ * em_dev_update_perf_domain() - Update the Energy Model (EM) of a device
+ * @dev		: Device for which the EM is registered
+ * @cb		: Callback functions providing the new data of the Energy Model
+ *
+ * Rebuild the performance state table of @dev from @cb, e.g. after the
+ * power of the states changed with temperature or silicon aging. The
+ * frequencies have to stay the same as the ones registered, only power
+ * and cost are updated. The new table is published with RCU, so readers
+ * using em_perf_state_table() under rcu_read_lock() see either the old
+ * or the new table. This function may sleep.
+ *
+ * Return 0 on success
+ */
+int em_dev_update_perf_domain(struct device *dev, struct em_data_callback *cb)
+{
+	struct em_perf_state *table, *old;
+	struct em_perf_domain *pd;
+	int i, ret = 0;
+
+	if (IS_ERR_OR_NULL(dev) || !cb)
+		return -EINVAL;
+
+	mutex_lock(&em_pd_mutex);
+
+	pd = dev->em_pd;
+	if (!pd) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	table = em_compute_table(dev, pd->nr_perf_states, cb);
+	if (IS_ERR(table)) {
+		ret = PTR_ERR(table);
+		goto unlock;
+	}
+
+	old = rcu_dereference_protected(pd->table,
+					lockdep_is_held(&em_pd_mutex));
+	for (i = 0; i < pd->nr_perf_states; i++) {
+		if (table[i].frequency != old[i].frequency) {
+			dev_err(dev, "EM: frequency changed: %lu\n",
+				table[i].frequency);
+			kfree(table);
+			ret = -EINVAL;
+			goto unlock;
+		}
+	}
+
+	rcu_assign_pointer(pd->table, table);
+	synchronize_rcu();
+	/* Drop the debugfs files pointing into the old states first */
+	em_debug_update_pd(dev);
+	kfree(old);
+
+	dev_dbg(dev, "EM: updated perf domain\n");
+
+unlock:
+	mutex_unlock(&em_pd_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(em_dev_update_perf_domain);
+
+#ifdef CONFIG_ENERGY_MODEL_TASK_ENERGY
+/*
+ * Estimated energy per uid, in the units of the EM power times
+ * microseconds (i.e. nJ for milliwatt models). Entries are never freed.
+ */
+struct em_uid_entry {
+	struct hlist_node hash;
+	uid_t uid;
+	atomic64_t energy;
+};
+
+static DEFINE_HASHTABLE(em_uid_hash, 7);
+static DEFINE_SPINLOCK(em_uid_lock);
+
+/* Must be called under rcu_read_lock() */
+static struct em_uid_entry *em_find_or_add_uid(uid_t uid)
+{
+	struct em_uid_entry *e;
+	unsigned long flags;
+
+	hash_for_each_possible_rcu(em_uid_hash, e, hash, uid) {
+		if (e->uid == uid)
+			return e;
+	}
+
+	spin_lock_irqsave(&em_uid_lock, flags);
+	hash_for_each_possible(em_uid_hash, e, hash, uid) {
+		if (e->uid == uid)
+			goto unlock;
+	}
+	e = kzalloc(sizeof(*e), GFP_ATOMIC);
+	if (e) {
+		e->uid = uid;
+		hash_add_rcu(em_uid_hash, &e->hash, uid);
+	}
+unlock:
+	spin_unlock_irqrestore(&em_uid_lock, flags);
+
+	return e;
+}
+
+/**
+ * em_task_account() - Charge the energy of a CPU time slice to a task
+ * @p		: Task the CPU time gets accounted to
+ * @cputime	: CPU time in ns spent by @p since the last update
+ *
+ * Called from the cputime accounting paths. The power of the performance
+ * state matching the current frequency of the CPU is charged for
+ * @cputime to @p and to its uid.
+ */
+void em_task_account(struct task_struct *p, u64 cputime)
+{
+	struct cpufreq_policy *policy;
+	struct em_perf_domain *pd;
+	struct em_perf_state *table;
+	struct em_uid_entry *e;
+	unsigned long freq;
+	int cpu = task_cpu(p);
+	u64 energy;
+	int i;
+
+	pd = em_cpu_get(cpu);
+	policy = cpufreq_cpu_get_raw(cpu);
+	if (!pd || !policy)
+		return;
+
+	freq = READ_ONCE(policy->cur);
+
+	rcu_read_lock();
+	table = em_perf_state_table(pd);
+	for (i = 0; i < pd->nr_perf_states - 1; i++) {
+		if (table[i].frequency >= freq)
+			break;
+	}
+	energy = div_u64(table[i].power * cputime, NSEC_PER_USEC);
+
+	p->em_energy += energy;
+	e = em_find_or_add_uid(from_kuid_munged(&init_user_ns, task_uid(p)));
+	if (e)
+		atomic64_add(energy, &e->energy);
+	rcu_read_unlock();
+}
+
+int proc_em_energy_show(struct seq_file *m, struct pid_namespace *ns,
+			struct pid *pid, struct task_struct *p)
+{
+	seq_printf(m, "%llu\n", READ_ONCE(p->em_energy));
+
+	return 0;
+}
+
+static int uid_energy_show(struct seq_file *m, void *v)
+{
+	struct em_uid_entry *e;
+	int bkt;
+
+	rcu_read_lock();
+	hash_for_each_rcu(em_uid_hash, bkt, e, hash)
+		seq_printf(m, "%u %lld\n", e->uid, atomic64_read(&e->energy));
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int __init em_task_energy_init(void)
+{
+	proc_create_single("uid_energy", 0444, NULL, uid_energy_show);
+
+	return 0;
+}
+late_initcall(em_task_energy_init);
+#endif /* CONFIG_ENERGY_MODEL_TASK_ENERGY */
@@ -26,8 +26,10 @@
 #include <linux/cpu.h>
 #include <linux/freezer.h>
 #include <linux/gfp.h>
+#include <linux/moduleparam.h>
 #include <linux/syscore_ops.h>
 #include <linux/ctype.h>
+#include <linux/crypto.h>
 #include <linux/genhd.h>
 #include <linux/ktime.h>
 #include <linux/security.h>
@@ -38,6 +40,7 @@
 
 
 static int nocompress;
+static char hibernate_compressor[CRYPTO_MAX_ALG_NAME] = CONFIG_HIBERNATION_DEF_COMP;
 static int noresume;
 static int nohibernate;
 static int resume_wait;
@@ -724,6 +727,13 @@ int hibernate(void)
 		goto Unlock;
 	}
 
+	if (!nocompress && crypto_has_comp(hibernate_compressor, 0, 0) != 1) {
+		pr_err("%s compression is not available\n", hibernate_compressor);
+		hibernate_release();
+		error = -EOPNOTSUPP;
+		goto Unlock;
+	}
+
 	pr_info("hibernation entry\n");
 	pm_prepare_console();
 	error = pm_notifier_call_chain_robust(PM_HIBERNATION_PREPARE, PM_POST_HIBERNATION);
@@ -755,6 +765,9 @@ int hibernate(void)
 			flags |= SF_NOCOMPRESS_MODE;
 		else
 		        flags |= SF_CRC32_MODE;
+		if (!nocompress &&
+		    !strcmp(hibernate_compressor, COMPRESSION_ALGO_LZ4))
+			flags |= SF_COMPRESSION_ALG_LZ4;
 
 		pm_pr_dbg("Writing hibernation image.\n");
 		error = swsusp_write(flags);
@@ -1337,6 +1350,52 @@ static int __init nohibernate_setup(char *str)
 	return 1;
 }
 
+static const char * const comp_alg_enabled[] = {
+#if IS_ENABLED(CONFIG_CRYPTO_LZO)
+	COMPRESSION_ALGO_LZO,
+#endif
+#if IS_ENABLED(CONFIG_CRYPTO_LZ4)
+	COMPRESSION_ALGO_LZ4,
+#endif
+};
+
+static int hibernate_compressor_param_set(const char *compressor,
+		const struct kernel_param *kp)
+{
+	int index, ret;
+
+	lock_system_sleep();
+	index = sysfs_match_string(comp_alg_enabled, compressor);
+	if (index >= 0) {
+		strscpy(hibernate_compressor, comp_alg_enabled[index],
+			sizeof(hibernate_compressor));
+		ret = 0;
+	} else {
+		ret = index;
+	}
+	unlock_system_sleep();
+
+	if (ret)
+		pr_debug("Cannot set specified compressor %s\n", compressor);
+
+	return ret;
+}
+
+static const struct kernel_param_ops hibernate_compressor_param_ops = {
+	.set    = hibernate_compressor_param_set,
+	.get    = param_get_string,
+};
+
+static struct kparam_string hibernate_compressor_param_string = {
+	.maxlen = sizeof(hibernate_compressor),
+	.string = hibernate_compressor,
+};
+
+module_param_cb(compressor, &hibernate_compressor_param_ops,
+		&hibernate_compressor_param_string, 0644);
+MODULE_PARM_DESC(compressor,
+		 "Compression algorithm to be used with hibernation");
+
 __setup("noresume", noresume_setup);
 __setup("resume_offset=", resume_offset_setup);
 __setup("resume=", resume_setup);
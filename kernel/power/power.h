@@ -168,6 +168,11 @@ extern int swsusp_swap_in_use(void);
 #define SF_PLATFORM_MODE	1
 #define SF_NOCOMPRESS_MODE	2
 #define SF_CRC32_MODE	        4
+#define SF_COMPRESSION_ALG_LZ4	8
+
+/* Compression algorithms of the image, in the crypto API naming */
+#define COMPRESSION_ALGO_LZO	"lzo"
+#define COMPRESSION_ALGO_LZ4	"lz4"
 
 /* kernel/power/hibernate.c */
 extern int swsusp_check(void);
@@ -9,6 +9,8 @@
 
 #undef DEBUG
 
+#include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/interrupt.h>
 #include <linux/oom.h>
 #include <linux/suspend.h>
@@ -22,6 +24,7 @@
 #include <linux/kmod.h>
 #include <trace/events/power.h>
 #include <linux/cpuset.h>
+#include <linux/seq_file.h>
 #include <linux/sec_debug.h>
 
 #include <trace/hooks/power.h>
@@ -31,6 +34,173 @@
  */
 unsigned int __read_mostly freeze_timeout_msecs = 20 * MSEC_PER_SEC;
 
+/*
+ * Tasks that did not freeze on the first pass. Retries only check these
+ * instead of walking every thread again. If there are more of them, the
+ * retries fall back to walking all threads.
+ */
+#define FREEZE_PENDING_MAX	512
+
+static struct task_struct *freeze_pending[FREEZE_PENDING_MAX];
+static unsigned int nr_freeze_pending;
+
+/*
+ * Tasks entering the refrigerator count down freeze_remaining and the last
+ * one completes freeze_done, so the freezer does not have to sleep for a
+ * fixed time before checking again.
+ */
+static atomic_t freeze_remaining = ATOMIC_INIT(0);
+static DECLARE_COMPLETION(freeze_done);
+
+/* The slowest tasks to freeze since user space freezing began */
+#define FREEZE_SLOWEST_NR	8
+
+struct freeze_slow_task {
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	s64 latency_us;
+};
+
+static bool freeze_tracking;
+static ktime_t freeze_start;
+static struct freeze_slow_task freeze_slowest[FREEZE_SLOWEST_NR];
+static DEFINE_SPINLOCK(freeze_slowest_lock);
+
+/* Called by a task when it enters the refrigerator */
+void freezer_task_frozen(void)
+{
+	struct freeze_slow_task *slot;
+	s64 latency_us;
+	int i;
+
+	if (!READ_ONCE(freeze_tracking))
+		return;
+
+	latency_us = ktime_us_delta(ktime_get_boottime(), freeze_start);
+
+	spin_lock(&freeze_slowest_lock);
+	slot = &freeze_slowest[0];
+	for (i = 1; i < FREEZE_SLOWEST_NR; i++) {
+		if (freeze_slowest[i].latency_us < slot->latency_us)
+			slot = &freeze_slowest[i];
+	}
+	if (latency_us > slot->latency_us) {
+		slot->pid = task_pid_nr(current);
+		get_task_comm(slot->comm, current);
+		slot->latency_us = latency_us;
+	}
+	spin_unlock(&freeze_slowest_lock);
+
+	if (atomic_dec_and_test(&freeze_remaining))
+		complete(&freeze_done);
+}
+
+static void freeze_pending_release(void)
+{
+	while (nr_freeze_pending)
+		put_task_struct(freeze_pending[--nr_freeze_pending]);
+}
+
+/*
+ * Send a freeze request to every thread and remember the ones that did not
+ * freeze yet. Tasks already frozen, e.g. by the cgroup freezer, are not
+ * signalled again. Returns the number of tasks left, and sets *overflow if
+ * not all of them could be remembered.
+ */
+static unsigned int freeze_all_tasks(bool *overflow)
+{
+	struct task_struct *g, *p;
+	unsigned int todo = 0;
+
+	freeze_pending_release();
+	*overflow = false;
+
+	read_lock(&tasklist_lock);
+	for_each_process_thread(g, p) {
+		if (p == current || !freeze_task(p))
+			continue;
+
+		if (!freezer_should_skip(p)) {
+			todo++;
+			secdbg_base_built_set_unfrozen_task(p, (uint64_t)todo);
+
+			if (nr_freeze_pending < FREEZE_PENDING_MAX) {
+				get_task_struct(p);
+				freeze_pending[nr_freeze_pending++] = p;
+			} else {
+				*overflow = true;
+			}
+		}
+	}
+	read_unlock(&tasklist_lock);
+
+	return todo;
+}
+
+/* Send the freeze request again only to the tasks left by freeze_all_tasks() */
+static unsigned int freeze_pending_tasks(void)
+{
+	unsigned int i, todo = 0;
+
+	for (i = 0; i < nr_freeze_pending; i++) {
+		struct task_struct *p = freeze_pending[i];
+
+		if (!freeze_task(p) || freezer_should_skip(p)) {
+			put_task_struct(p);
+			continue;
+		}
+
+		freeze_pending[todo++] = p;
+		secdbg_base_built_set_unfrozen_task(p, (uint64_t)todo);
+	}
+	nr_freeze_pending = todo;
+
+	return todo;
+}
+
+static void freeze_wait(unsigned int tasks, int timeout_usecs)
+{
+	reinit_completion(&freeze_done);
+	atomic_set(&freeze_remaining, tasks);
+
+	/* Tasks which froze before the counter was armed only cost a timeout */
+	if (tasks)
+		wait_for_completion_timeout(&freeze_done,
+					    usecs_to_jiffies(timeout_usecs));
+	else
+		usleep_range(timeout_usecs / 2, timeout_usecs);
+
+	atomic_set(&freeze_remaining, 0);
+}
+
+static void freeze_tracking_start(bool user_only)
+{
+	if (user_only) {
+		spin_lock(&freeze_slowest_lock);
+		memset(freeze_slowest, 0, sizeof(freeze_slowest));
+		spin_unlock(&freeze_slowest_lock);
+	}
+
+	freeze_start = ktime_get_boottime();
+	WRITE_ONCE(freeze_tracking, true);
+}
+
+static void freeze_tracking_stop(void)
+{
+	int i;
+
+	WRITE_ONCE(freeze_tracking, false);
+
+	spin_lock(&freeze_slowest_lock);
+	for (i = 0; i < FREEZE_SLOWEST_NR; i++) {
+		if (freeze_slowest[i].latency_us)
+			pm_pr_dbg("slow to freeze: %s(%d) %lld us\n",
+				  freeze_slowest[i].comm, freeze_slowest[i].pid,
+				  freeze_slowest[i].latency_us);
+	}
+	spin_unlock(&freeze_slowest_lock);
+}
+
 static int try_to_freeze_tasks(bool user_only)
 {
 	struct task_struct *g, *p;
@@ -42,6 +212,7 @@ static int try_to_freeze_tasks(bool user_only)
 	bool wakeup = false;
 	int sleep_usecs = USEC_PER_MSEC;
 	bool todo_logging_on = false;
+	bool rescan = true, overflow = false;
 
 	start = ktime_get_boottime();
 
@@ -51,20 +222,23 @@ static int try_to_freeze_tasks(bool user_only)
 		freeze_workqueues_begin();
 
 	secdbg_base_built_set_unfrozen_task(NULL, 0);
+	freeze_tracking_start(user_only);
 
 	while (true) {
-		todo = 0;
-		read_lock(&tasklist_lock);
-		for_each_process_thread(g, p) {
-			if (p == current || !freeze_task(p))
-				continue;
-
-			if (!freezer_should_skip(p)) {
-				todo++;
-				secdbg_base_built_set_unfrozen_task(p, (uint64_t)todo);
-			}
+		if (rescan || overflow)
+			todo = freeze_all_tasks(&overflow);
+		else
+			todo = freeze_pending_tasks();
+
+		/*
+		 * Tasks forked since the last walk are only found by walking
+		 * all threads, so do that once more before reporting success.
+		 */
+		if (!todo && !rescan) {
+			rescan = true;
+			continue;
 		}
-		read_unlock(&tasklist_lock);
+		rescan = false;
 
 		if (!user_only) {
 			wq_busy = freeze_workqueues_busy();
@@ -81,14 +255,18 @@ static int try_to_freeze_tasks(bool user_only)
 
 		/*
 		 * We need to retry, but first give the freezing tasks some
-		 * time to enter the refrigerator.  Start with an initial
-		 * 1 ms sleep followed by exponential backoff until 8 ms.
+		 * time to enter the refrigerator.  Wait until they all did,
+		 * or at most 1 ms at first followed by exponential backoff
+		 * until 8 ms.
 		 */
-		usleep_range(sleep_usecs / 2, sleep_usecs);
+		freeze_wait(todo - wq_busy, sleep_usecs);
 		if (sleep_usecs < 8 * USEC_PER_MSEC)
 			sleep_usecs *= 2;
 	}
 
+	freeze_pending_release();
+	freeze_tracking_stop();
+
 	end = ktime_get_boottime();
 	elapsed = ktime_sub(end, start);
 	elapsed_msecs = ktime_to_ms(elapsed);
@@ -265,3 +443,28 @@ void thaw_kernel_threads(void)
 	schedule();
 	pr_cont("done.\n");
 }
+
+static int freeze_latency_show(struct seq_file *s, void *unused)
+{
+	int i;
+
+	spin_lock(&freeze_slowest_lock);
+	for (i = 0; i < FREEZE_SLOWEST_NR; i++) {
+		if (freeze_slowest[i].latency_us)
+			seq_printf(s, "%-16s %8d %10lld us\n",
+				   freeze_slowest[i].comm, freeze_slowest[i].pid,
+				   freeze_slowest[i].latency_us);
+	}
+	spin_unlock(&freeze_slowest_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(freeze_latency);
+
+static int __init freeze_latency_debugfs_init(void)
+{
+	debugfs_create_file("freeze_latency", 0444, NULL, NULL,
+			    &freeze_latency_fops);
+	return 0;
+}
+late_initcall(freeze_latency_debugfs_init);
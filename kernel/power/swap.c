@@ -25,6 +25,7 @@
 #include <linux/pm.h>
 #include <linux/slab.h>
 #include <linux/lzo.h>
+#include <linux/crypto.h>
 #include <linux/vmalloc.h>
 #include <linux/cpumask.h>
 #include <linux/atomic.h>
@@ -518,23 +519,38 @@ static int swap_writer_finish(struct swap_map_handle *handle,
 }
 
 /* We need to remember how much compressed data we need to read. */
-#define LZO_HEADER	sizeof(size_t)
+#define CMP_HEADER	sizeof(size_t)
+
+/*
+ * Set in the header of a chunk which did not compress and is stored as is,
+ * e.g. pages holding zram's compressed objects or media data.
+ */
+#define CMP_STORED	((size_t)1 << (BITS_PER_LONG - 1))
 
 /* Number of pages/bytes we'll compress at one time. */
-#define LZO_UNC_PAGES	32
-#define LZO_UNC_SIZE	(LZO_UNC_PAGES * PAGE_SIZE)
+#define UNC_PAGES	32
+#define UNC_SIZE	(UNC_PAGES * PAGE_SIZE)
 
-/* Number of pages/bytes we need for compressed data (worst case). */
-#define LZO_CMP_PAGES	DIV_ROUND_UP(lzo1x_worst_compress(LZO_UNC_SIZE) + \
-			             LZO_HEADER, PAGE_SIZE)
-#define LZO_CMP_SIZE	(LZO_CMP_PAGES * PAGE_SIZE)
+/*
+ * Number of pages/bytes we need for compressed data (worst case). The LZO
+ * bound also covers LZ4.
+ */
+#define CMP_PAGES	DIV_ROUND_UP(lzo1x_worst_compress(UNC_SIZE) + \
+			             CMP_HEADER, PAGE_SIZE)
+#define CMP_SIZE	(CMP_PAGES * PAGE_SIZE)
 
 /* Maximum number of threads for compression/decompression. */
-#define LZO_THREADS	3
+#define CMP_THREADS	3
 
 /* Minimum/maximum number of pages for read buffering. */
-#define LZO_MIN_RD_PAGES	1024
-#define LZO_MAX_RD_PAGES	8192
+#define CMP_MIN_RD_PAGES	1024
+#define CMP_MAX_RD_PAGES	8192
+
+static const char *swsusp_comp_algo(unsigned int flags)
+{
+	return flags & SF_COMPRESSION_ALG_LZ4 ?
+		COMPRESSION_ALGO_LZ4 : COMPRESSION_ALGO_LZO;
+}
 
 
 /**
@@ -598,8 +614,8 @@ struct crc_data {
 	wait_queue_head_t go;                     /* start crc update */
 	wait_queue_head_t done;                   /* crc update done */
 	u32 *crc32;                               /* points to handle's crc32 */
-	size_t *unc_len[LZO_THREADS];             /* uncompressed lengths */
-	unsigned char *unc[LZO_THREADS];          /* uncompressed data */
+	size_t *unc_len[CMP_THREADS];             /* uncompressed lengths */
+	unsigned char *unc[CMP_THREADS];          /* uncompressed data */
 };
 
 /**
@@ -630,28 +646,33 @@ static int crc32_threadfn(void *data)
 	return 0;
 }
 /**
- * Structure used for LZO data compression.
+ * Structure used for data compression.
  */
 struct cmp_data {
 	struct task_struct *thr;                  /* thread */
+	struct crypto_comp *cc;                   /* crypto compressor stream */
 	atomic_t ready;                           /* ready to start flag */
 	atomic_t stop;                            /* ready to stop flag */
 	int ret;                                  /* return code */
+	bool busy;                                /* chunk not written yet */
+	bool stored;                              /* chunk did not compress */
+	u32 crc32;                                /* CRC32 of the chunk */
 	wait_queue_head_t go;                     /* start compression */
 	wait_queue_head_t done;                   /* compression done */
 	size_t unc_len;                           /* uncompressed length */
 	size_t cmp_len;                           /* compressed length */
-	unsigned char unc[LZO_UNC_SIZE];          /* uncompressed buffer */
-	unsigned char cmp[LZO_CMP_SIZE];          /* compressed buffer */
-	unsigned char wrk[LZO1X_1_MEM_COMPRESS];  /* compression workspace */
+	unsigned char unc[UNC_SIZE];              /* uncompressed buffer */
+	unsigned char cmp[CMP_SIZE];              /* compressed buffer */
 };
 
 /**
- * Compression function that runs in its own thread.
+ * Compression function that runs in its own thread. The CRC32 of the chunk
+ * is computed here too and combined in image order by the writer.
  */
-static int lzo_compress_threadfn(void *data)
+static int compress_threadfn(void *data)
 {
 	struct cmp_data *d = data;
+	unsigned int cmp_len;
 
 	while (1) {
 		wait_event(d->go, atomic_read(&d->ready) ||
@@ -665,24 +686,89 @@ static int lzo_compress_threadfn(void *data)
 		}
 		atomic_set(&d->ready, 0);
 
-		d->ret = lzo1x_1_compress(d->unc, d->unc_len,
-		                          d->cmp + LZO_HEADER, &d->cmp_len,
-		                          d->wrk);
+		d->crc32 = crc32_le(0, d->unc, d->unc_len);
+
+		cmp_len = CMP_SIZE - CMP_HEADER;
+		d->ret = crypto_comp_compress(d->cc, d->unc, d->unc_len,
+					      d->cmp + CMP_HEADER, &cmp_len);
+		d->cmp_len = cmp_len;
+		d->stored = false;
+		if (!d->ret && d->cmp_len >= d->unc_len) {
+			memcpy(d->cmp + CMP_HEADER, d->unc, d->unc_len);
+			d->cmp_len = d->unc_len;
+			d->stored = true;
+		}
+
 		atomic_set(&d->stop, 1);
 		wake_up(&d->done);
 	}
 	return 0;
 }
 
+/*
+ * Wait for the compression of one chunk and queue it for writing.
+ */
+static int write_compressed_chunk(struct swap_map_handle *handle,
+				  struct cmp_data *d, unsigned char *page,
+				  struct hib_bio_batch *hb, unsigned int *nr_stored)
+{
+	size_t off;
+	int ret;
+
+	wait_event(d->done, atomic_read(&d->stop));
+	atomic_set(&d->stop, 0);
+	d->busy = false;
+
+	if (d->ret < 0) {
+		pr_err("Compression failed\n");
+		return d->ret;
+	}
+
+	if (unlikely(!d->cmp_len ||
+		     d->cmp_len > lzo1x_worst_compress(d->unc_len))) {
+		pr_err("Invalid compressed length\n");
+		return -1;
+	}
+
+	handle->crc32 = crc32_le_combine(handle->crc32, d->crc32, d->unc_len);
+
+	*(size_t *)d->cmp = d->cmp_len;
+	if (d->stored) {
+		*(size_t *)d->cmp |= CMP_STORED;
+		(*nr_stored)++;
+	}
+
+	/*
+	 * Given we are writing one page at a time to disk, we copy that much
+	 * from the buffer, although the last bit will likely be smaller than
+	 * full page. This is OK - we saved the length of the compressed data,
+	 * so any garbage at the end will be discarded when we read it.
+	 */
+	for (off = 0; off < CMP_HEADER + d->cmp_len; off += PAGE_SIZE) {
+		memcpy(page, d->cmp + off, PAGE_SIZE);
+
+		ret = swap_write_page(handle, page, hb);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
 /**
- * save_image_lzo - Save the suspend image data compressed with LZO.
+ * save_compressed_image - Save the suspend image data after compression.
  * @handle: Swap map handle to use for saving the image.
  * @snapshot: Image to read data from.
  * @nr_to_write: Number of pages to save.
+ * @algo: Name of the crypto API compression algorithm.
+ *
+ * The threads are used as a ring: while a thread compresses its chunk, the
+ * chunks of the others are written out and refilled, so that compression
+ * and I/O overlap instead of alternating.
  */
-static int save_image_lzo(struct swap_map_handle *handle,
-                          struct snapshot_handle *snapshot,
-                          unsigned int nr_to_write)
+static int save_compressed_image(struct swap_map_handle *handle,
+                                 struct snapshot_handle *snapshot,
+                                 unsigned int nr_to_write, const char *algo)
 {
 	unsigned int m;
 	int ret = 0;
@@ -692,10 +778,10 @@ static int save_image_lzo(struct swap_map_handle *handle,
 	ktime_t start;
 	ktime_t stop;
 	size_t off;
-	unsigned thr, run_threads, nr_threads;
+	unsigned thr, nr_threads, nr_busy = 0, nr_stored = 0, nr_chunks = 0;
+	bool eof = false;
 	unsigned char *page = NULL;
 	struct cmp_data *data = NULL;
-	struct crc_data *crc = NULL;
 
 	hib_init_batch(&hb);
 
@@ -704,31 +790,21 @@ static int save_image_lzo(struct swap_map_handle *handle,
 	 * footprint.
 	 */
 	nr_threads = num_online_cpus() - 1;
-	nr_threads = clamp_val(nr_threads, 1, LZO_THREADS);
+	nr_threads = clamp_val(nr_threads, 1, CMP_THREADS);
 
 	page = (void *)__get_free_page(GFP_NOIO | __GFP_HIGH);
 	if (!page) {
-		pr_err("Failed to allocate LZO page\n");
+		pr_err("Failed to allocate %s page\n", algo);
 		ret = -ENOMEM;
 		goto out_clean;
 	}
 
-	data = vmalloc(array_size(nr_threads, sizeof(*data)));
+	data = vzalloc(array_size(nr_threads, sizeof(*data)));
 	if (!data) {
-		pr_err("Failed to allocate LZO data\n");
-		ret = -ENOMEM;
-		goto out_clean;
-	}
-	for (thr = 0; thr < nr_threads; thr++)
-		memset(&data[thr], 0, offsetof(struct cmp_data, go));
-
-	crc = kmalloc(sizeof(*crc), GFP_KERNEL);
-	if (!crc) {
-		pr_err("Failed to allocate crc\n");
+		pr_err("Failed to allocate %s data\n", algo);
 		ret = -ENOMEM;
 		goto out_clean;
 	}
-	memset(crc, 0, offsetof(struct crc_data, go));
 
 	/*
 	 * Start the compression threads.
@@ -737,7 +813,16 @@ static int save_image_lzo(struct swap_map_handle *handle,
 		init_waitqueue_head(&data[thr].go);
 		init_waitqueue_head(&data[thr].done);
 
-		data[thr].thr = kthread_run(lzo_compress_threadfn,
+		data[thr].cc = crypto_alloc_comp(algo, 0, 0);
+		if (IS_ERR_OR_NULL(data[thr].cc)) {
+			pr_err("Could not allocate comp stream %ld\n",
+			       PTR_ERR(data[thr].cc));
+			data[thr].cc = NULL;
+			ret = -EFAULT;
+			goto out_clean;
+		}
+
+		data[thr].thr = kthread_run(compress_threadfn,
 		                            &data[thr],
 		                            "image_compress/%u", thr);
 		if (IS_ERR(data[thr].thr)) {
@@ -748,26 +833,7 @@ static int save_image_lzo(struct swap_map_handle *handle,
 		}
 	}
 
-	/*
-	 * Start the CRC32 thread.
-	 */
-	init_waitqueue_head(&crc->go);
-	init_waitqueue_head(&crc->done);
-
 	handle->crc32 = 0;
-	crc->crc32 = &handle->crc32;
-	for (thr = 0; thr < nr_threads; thr++) {
-		crc->unc[thr] = data[thr].unc;
-		crc->unc_len[thr] = &data[thr].unc_len;
-	}
-
-	crc->thr = kthread_run(crc32_threadfn, crc, "image_crc32");
-	if (IS_ERR(crc->thr)) {
-		crc->thr = NULL;
-		pr_err("Cannot start CRC32 thread\n");
-		ret = -ENOMEM;
-		goto out_clean;
-	}
 
 	/*
 	 * Adjust the number of required free pages after all allocations have
@@ -775,7 +841,7 @@ static int save_image_lzo(struct swap_map_handle *handle,
 	 */
 	handle->reqd_free_pages = reqd_free_pages();
 
-	pr_info("Using %u thread(s) for compression\n", nr_threads);
+	pr_info("Using %u thread(s) for %s compression\n", nr_threads, algo);
 	pr_info("Compressing and saving image data (%u pages)...\n",
 		nr_to_write);
 	m = nr_to_write / 10;
@@ -783,83 +849,48 @@ static int save_image_lzo(struct swap_map_handle *handle,
 		m = 1;
 	nr_pages = 0;
 	start = ktime_get();
-	for (;;) {
-		for (thr = 0; thr < nr_threads; thr++) {
-			for (off = 0; off < LZO_UNC_SIZE; off += PAGE_SIZE) {
-				ret = snapshot_read_next(snapshot);
-				if (ret < 0)
-					goto out_finish;
-
-				if (!ret)
-					break;
-
-				memcpy(data[thr].unc + off,
-				       data_of(*snapshot), PAGE_SIZE);
-
-				if (!(nr_pages % m))
-					pr_info("Image saving progress: %3d%%\n",
-						nr_pages / m * 10);
-				nr_pages++;
-			}
-			if (!off)
-				break;
-
-			data[thr].unc_len = off;
-
-			atomic_set(&data[thr].ready, 1);
-			wake_up(&data[thr].go);
+	for (thr = 0; !eof || nr_busy; thr = (thr + 1) % nr_threads) {
+		struct cmp_data *d = &data[thr];
+
+		/* Chunks are written in the order they were read */
+		if (d->busy) {
+			nr_busy--;
+			ret = write_compressed_chunk(handle, d, page, &hb,
+						     &nr_stored);
+			if (ret)
+				goto out_finish;
 		}
 
-		if (!thr)
-			break;
-
-		crc->run_threads = thr;
-		atomic_set(&crc->ready, 1);
-		wake_up(&crc->go);
-
-		for (run_threads = thr, thr = 0; thr < run_threads; thr++) {
-			wait_event(data[thr].done,
-			           atomic_read(&data[thr].stop));
-			atomic_set(&data[thr].stop, 0);
-
-			ret = data[thr].ret;
-
-			if (ret < 0) {
-				pr_err("LZO compression failed\n");
-				goto out_finish;
-			}
+		if (eof)
+			continue;
 
-			if (unlikely(!data[thr].cmp_len ||
-			             data[thr].cmp_len >
-			             lzo1x_worst_compress(data[thr].unc_len))) {
-				pr_err("Invalid LZO compressed length\n");
-				ret = -1;
+		for (off = 0; off < UNC_SIZE; off += PAGE_SIZE) {
+			ret = snapshot_read_next(snapshot);
+			if (ret < 0)
 				goto out_finish;
-			}
 
-			*(size_t *)data[thr].cmp = data[thr].cmp_len;
+			if (!ret)
+				break;
 
-			/*
-			 * Given we are writing one page at a time to disk, we
-			 * copy that much from the buffer, although the last
-			 * bit will likely be smaller than full page. This is
-			 * OK - we saved the length of the compressed data, so
-			 * any garbage at the end will be discarded when we
-			 * read it.
-			 */
-			for (off = 0;
-			     off < LZO_HEADER + data[thr].cmp_len;
-			     off += PAGE_SIZE) {
-				memcpy(page, data[thr].cmp + off, PAGE_SIZE);
+			memcpy(d->unc + off, data_of(*snapshot), PAGE_SIZE);
 
-				ret = swap_write_page(handle, page, &hb);
-				if (ret)
-					goto out_finish;
-			}
+			if (!(nr_pages % m))
+				pr_info("Image saving progress: %3d%%\n",
+					nr_pages / m * 10);
+			nr_pages++;
 		}
-
-		wait_event(crc->done, atomic_read(&crc->stop));
-		atomic_set(&crc->stop, 0);
+		if (off < UNC_SIZE)
+			eof = true;
+		if (!off)
+			continue;
+
+		d->unc_len = off;
+		d->busy = true;
+		nr_busy++;
+		nr_chunks++;
+
+		atomic_set(&d->ready, 1);
+		wake_up(&d->go);
 	}
 
 out_finish:
@@ -868,19 +899,18 @@ out_finish:
 	if (!ret)
 		ret = err2;
 	if (!ret)
-		pr_info("Image saving done\n");
+		pr_info("Image saving done (%u of %u chunks stored uncompressed)\n",
+			nr_stored, nr_chunks);
 	swsusp_show_speed(start, stop, nr_to_write, "Wrote");
 out_clean:
 	hib_finish_batch(&hb);
-	if (crc) {
-		if (crc->thr)
-			kthread_stop(crc->thr);
-		kfree(crc);
-	}
 	if (data) {
-		for (thr = 0; thr < nr_threads; thr++)
+		for (thr = 0; thr < nr_threads; thr++) {
 			if (data[thr].thr)
 				kthread_stop(data[thr].thr);
+			if (data[thr].cc)
+				crypto_free_comp(data[thr].cc);
+		}
 		vfree(data);
 	}
 	if (page) free_page((unsigned long)page);
@@ -951,7 +981,8 @@ int swsusp_write(unsigned int flags)
 	if (!error) {
 		error = (flags & SF_NOCOMPRESS_MODE) ?
 			save_image(&handle, &snapshot, pages - 1) :
-			save_image_lzo(&handle, &snapshot, pages - 1);
+			save_compressed_image(&handle, &snapshot, pages - 1,
+					      swsusp_comp_algo(flags));
 	}
 out_finish:
 	error = swap_writer_finish(&handle, flags, error);
@@ -1118,27 +1149,30 @@ static int load_image(struct swap_map_handle *handle,
 }
 
 /**
- * Structure used for LZO data decompression.
+ * Structure used for data decompression.
  */
 struct dec_data {
 	struct task_struct *thr;                  /* thread */
+	struct crypto_comp *cc;                   /* crypto compressor stream */
 	atomic_t ready;                           /* ready to start flag */
 	atomic_t stop;                            /* ready to stop flag */
 	int ret;                                  /* return code */
+	bool stored;                              /* chunk is not compressed */
 	wait_queue_head_t go;                     /* start decompression */
 	wait_queue_head_t done;                   /* decompression done */
 	size_t unc_len;                           /* uncompressed length */
 	size_t cmp_len;                           /* compressed length */
-	unsigned char unc[LZO_UNC_SIZE];          /* uncompressed buffer */
-	unsigned char cmp[LZO_CMP_SIZE];          /* compressed buffer */
+	unsigned char unc[UNC_SIZE];              /* uncompressed buffer */
+	unsigned char cmp[CMP_SIZE];              /* compressed buffer */
 };
 
 /**
  * Decompression function that runs in its own thread.
  */
-static int lzo_decompress_threadfn(void *data)
+static int decompress_threadfn(void *data)
 {
 	struct dec_data *d = data;
+	unsigned int unc_len;
 
 	while (1) {
 		wait_event(d->go, atomic_read(&d->ready) ||
@@ -1152,9 +1186,16 @@ static int lzo_decompress_threadfn(void *data)
 		}
 		atomic_set(&d->ready, 0);
 
-		d->unc_len = LZO_UNC_SIZE;
-		d->ret = lzo1x_decompress_safe(d->cmp + LZO_HEADER, d->cmp_len,
-		                               d->unc, &d->unc_len);
+		if (d->stored) {
+			memcpy(d->unc, d->cmp + CMP_HEADER, d->cmp_len);
+			d->unc_len = d->cmp_len;
+			d->ret = 0;
+		} else {
+			unc_len = UNC_SIZE;
+			d->ret = crypto_comp_decompress(d->cc, d->cmp + CMP_HEADER,
+							d->cmp_len, d->unc, &unc_len);
+			d->unc_len = unc_len;
+		}
 		if (clean_pages_on_decompress)
 			flush_icache_range((unsigned long)d->unc,
 					   (unsigned long)d->unc + d->unc_len);
@@ -1166,14 +1207,15 @@ static int lzo_decompress_threadfn(void *data)
 }
 
 /**
- * load_image_lzo - Load compressed image data and decompress them with LZO.
+ * load_compressed_image - Load compressed image data and decompress it.
  * @handle: Swap map handle to use for loading data.
  * @snapshot: Image to copy uncompressed data into.
  * @nr_to_read: Number of pages to load.
+ * @algo: Name of the crypto API compression algorithm.
  */
-static int load_image_lzo(struct swap_map_handle *handle,
-                          struct snapshot_handle *snapshot,
-                          unsigned int nr_to_read)
+static int load_compressed_image(struct swap_map_handle *handle,
+                                 struct snapshot_handle *snapshot,
+                                 unsigned int nr_to_read, const char *algo)
 {
 	unsigned int m;
 	int ret = 0;
@@ -1198,18 +1240,18 @@ static int load_image_lzo(struct swap_map_handle *handle,
 	 * footprint.
 	 */
 	nr_threads = num_online_cpus() - 1;
-	nr_threads = clamp_val(nr_threads, 1, LZO_THREADS);
+	nr_threads = clamp_val(nr_threads, 1, CMP_THREADS);
 
-	page = vmalloc(array_size(LZO_MAX_RD_PAGES, sizeof(*page)));
+	page = vmalloc(array_size(CMP_MAX_RD_PAGES, sizeof(*page)));
 	if (!page) {
-		pr_err("Failed to allocate LZO page\n");
+		pr_err("Failed to allocate %s page\n", algo);
 		ret = -ENOMEM;
 		goto out_clean;
 	}
 
 	data = vmalloc(array_size(nr_threads, sizeof(*data)));
 	if (!data) {
-		pr_err("Failed to allocate LZO data\n");
+		pr_err("Failed to allocate %s data\n", algo);
 		ret = -ENOMEM;
 		goto out_clean;
 	}
@@ -1233,7 +1275,16 @@ static int load_image_lzo(struct swap_map_handle *handle,
 		init_waitqueue_head(&data[thr].go);
 		init_waitqueue_head(&data[thr].done);
 
-		data[thr].thr = kthread_run(lzo_decompress_threadfn,
+		data[thr].cc = crypto_alloc_comp(algo, 0, 0);
+		if (IS_ERR_OR_NULL(data[thr].cc)) {
+			pr_err("Could not allocate comp stream %ld\n",
+			       PTR_ERR(data[thr].cc));
+			data[thr].cc = NULL;
+			ret = -EFAULT;
+			goto out_clean;
+		}
+
+		data[thr].thr = kthread_run(decompress_threadfn,
 		                            &data[thr],
 		                            "image_decompress/%u", thr);
 		if (IS_ERR(data[thr].thr)) {
@@ -1274,18 +1325,18 @@ static int load_image_lzo(struct swap_map_handle *handle,
 	 */
 	if (low_free_pages() > snapshot_get_image_size())
 		read_pages = (low_free_pages() - snapshot_get_image_size()) / 2;
-	read_pages = clamp_val(read_pages, LZO_MIN_RD_PAGES, LZO_MAX_RD_PAGES);
+	read_pages = clamp_val(read_pages, CMP_MIN_RD_PAGES, CMP_MAX_RD_PAGES);
 
 	for (i = 0; i < read_pages; i++) {
-		page[i] = (void *)__get_free_page(i < LZO_CMP_PAGES ?
+		page[i] = (void *)__get_free_page(i < CMP_PAGES ?
 						  GFP_NOIO | __GFP_HIGH :
 						  GFP_NOIO | __GFP_NOWARN |
 						  __GFP_NORETRY);
 
 		if (!page[i]) {
-			if (i < LZO_CMP_PAGES) {
+			if (i < CMP_PAGES) {
 				ring_size = i;
-				pr_err("Failed to allocate LZO pages\n");
+				pr_err("Failed to allocate %s pages\n", algo);
 				ret = -ENOMEM;
 				goto out_clean;
 			} else {
@@ -1295,7 +1346,7 @@ static int load_image_lzo(struct swap_map_handle *handle,
 	}
 	want = ring_size = i;
 
-	pr_info("Using %u thread(s) for decompression\n", nr_threads);
+	pr_info("Using %u thread(s) for %s decompression\n", nr_threads, algo);
 	pr_info("Loading and decompressing image data (%u pages)...\n",
 		nr_to_read);
 	m = nr_to_read / 10;
@@ -1353,16 +1404,19 @@ static int load_image_lzo(struct swap_map_handle *handle,
 		}
 
 		for (thr = 0; have && thr < nr_threads; thr++) {
-			data[thr].cmp_len = *(size_t *)page[pg];
+			data[thr].cmp_len = *(size_t *)page[pg] & ~CMP_STORED;
+			data[thr].stored = *(size_t *)page[pg] & CMP_STORED;
 			if (unlikely(!data[thr].cmp_len ||
 			             data[thr].cmp_len >
-			             lzo1x_worst_compress(LZO_UNC_SIZE))) {
-				pr_err("Invalid LZO compressed length\n");
+			             lzo1x_worst_compress(UNC_SIZE) ||
+			             (data[thr].stored &&
+			              data[thr].cmp_len > UNC_SIZE))) {
+				pr_err("Invalid compressed length\n");
 				ret = -1;
 				goto out_finish;
 			}
 
-			need = DIV_ROUND_UP(data[thr].cmp_len + LZO_HEADER,
+			need = DIV_ROUND_UP(data[thr].cmp_len + CMP_HEADER,
 			                    PAGE_SIZE);
 			if (need > have) {
 				if (eof > 1) {
@@ -1373,7 +1427,7 @@ static int load_image_lzo(struct swap_map_handle *handle,
 			}
 
 			for (off = 0;
-			     off < LZO_HEADER + data[thr].cmp_len;
+			     off < CMP_HEADER + data[thr].cmp_len;
 			     off += PAGE_SIZE) {
 				memcpy(data[thr].cmp + off,
 				       page[pg], PAGE_SIZE);
@@ -1390,7 +1444,7 @@ static int load_image_lzo(struct swap_map_handle *handle,
 		/*
 		 * Wait for more data while we are decompressing.
 		 */
-		if (have < LZO_CMP_PAGES && asked) {
+		if (have < CMP_PAGES && asked) {
 			ret = hib_wait_io(&hb);
 			if (ret)
 				goto out_finish;
@@ -1408,14 +1462,14 @@ static int load_image_lzo(struct swap_map_handle *handle,
 			ret = data[thr].ret;
 
 			if (ret < 0) {
-				pr_err("LZO decompression failed\n");
+				pr_err("%s decompression failed\n", algo);
 				goto out_finish;
 			}
 
 			if (unlikely(!data[thr].unc_len ||
-			             data[thr].unc_len > LZO_UNC_SIZE ||
+			             data[thr].unc_len > UNC_SIZE ||
 			             data[thr].unc_len & (PAGE_SIZE - 1))) {
-				pr_err("Invalid LZO uncompressed length\n");
+				pr_err("Invalid uncompressed length\n");
 				ret = -1;
 				goto out_finish;
 			}
@@ -1476,9 +1530,12 @@ out_clean:
 		kfree(crc);
 	}
 	if (data) {
-		for (thr = 0; thr < nr_threads; thr++)
+		for (thr = 0; thr < nr_threads; thr++) {
 			if (data[thr].thr)
 				kthread_stop(data[thr].thr);
+			if (data[thr].cc)
+				crypto_free_comp(data[thr].cc);
+		}
 		vfree(data);
 	}
 	vfree(page);
@@ -1512,7 +1569,8 @@ int swsusp_read(unsigned int *flags_p)
 	if (!error) {
 		error = (*flags_p & SF_NOCOMPRESS_MODE) ?
 			load_image(&handle, &snapshot, header->pages - 1) :
-			load_image_lzo(&handle, &snapshot, header->pages - 1);
+			load_compressed_image(&handle, &snapshot, header->pages - 1,
+					      swsusp_comp_algo(*flags_p));
 	}
 	swap_reader_finish(&handle);
 end:
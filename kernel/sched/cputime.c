@@ -3,6 +3,7 @@
  * Simple CPU accounting cgroup controller
  */
 #include <linux/cpufreq_times.h>
+#include <linux/energy_model.h>
 #include "sched.h"
 #include <trace/hooks/sched.h>
 
@@ -147,6 +148,7 @@ void account_user_time(struct task_struct *p, u64 cputime)
 
 	/* Account power usage for user time */
 	cpufreq_acct_update_power(p, cputime);
+	em_task_account(p, cputime);
 }
 
 /*
@@ -194,6 +196,7 @@ void account_system_index_time(struct task_struct *p,
 
 	/* Account power usage for system time */
 	cpufreq_acct_update_power(p, cputime);
+	em_task_account(p, cputime);
 }
 
 /*
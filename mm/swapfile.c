@@ -3440,6 +3440,51 @@ void si_swapinfo(struct sysinfo *val)
 }
 EXPORT_SYMBOL_NS_GPL(si_swapinfo, MINIDUMP);
 
+static LIST_HEAD(swap_compressed_stats);
+static DEFINE_SPINLOCK(swap_compressed_lock);
+
+void swap_register_compressed_stat(struct swap_compressed_stat *stat)
+{
+	spin_lock(&swap_compressed_lock);
+	list_add_tail(&stat->list, &swap_compressed_stats);
+	spin_unlock(&swap_compressed_lock);
+}
+EXPORT_SYMBOL_GPL(swap_register_compressed_stat);
+
+void swap_unregister_compressed_stat(struct swap_compressed_stat *stat)
+{
+	spin_lock(&swap_compressed_lock);
+	list_del(&stat->list);
+	spin_unlock(&swap_compressed_lock);
+}
+EXPORT_SYMBOL_GPL(swap_unregister_compressed_stat);
+
+/*
+ * Estimate the memory used by @nr_pages swapped out pages from the average
+ * compression ratio of the registered in-memory backends.  Without any,
+ * swapped out pages do not use memory at all.
+ */
+unsigned long swap_compressed_bytes(unsigned long nr_pages)
+{
+	struct swap_compressed_stat *stat;
+	u64 pages = 0, bytes = 0;
+
+	if (!nr_pages)
+		return 0;
+
+	spin_lock(&swap_compressed_lock);
+	list_for_each_entry(stat, &swap_compressed_stats, list) {
+		pages += atomic64_read(stat->pages_stored);
+		bytes += atomic64_read(stat->compr_size);
+	}
+	spin_unlock(&swap_compressed_lock);
+
+	if (!pages)
+		return 0;
+
+	return div64_u64(bytes * nr_pages, pages);
+}
+
 /*
  * Verify that a swap entry is valid and increment its swap map count.
  *
@@ -242,6 +242,21 @@ int qdisc_set_default(const char *name)
 	return ops ? 0 : -ENOENT;
 }
 
+/* Look up a registered qdisc by name. On success a reference is held on
+ * the owning module, the caller releases it with module_put(ops->owner).
+ */
+const struct Qdisc_ops *qdisc_get_ops(const char *name)
+{
+	const struct Qdisc_ops *ops;
+
+	read_lock(&qdisc_mod_lock);
+	ops = qdisc_lookup_default(name);
+	read_unlock(&qdisc_mod_lock);
+
+	return ops;
+}
+EXPORT_SYMBOL(qdisc_get_ops);
+
 #ifdef CONFIG_NET_SCH_DEFAULT
 /* Set default value from kernel config */
 static int __init sch_default_qdisc(void)
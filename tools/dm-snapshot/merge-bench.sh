@@ -0,0 +1,90 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Time the merge of a dm-snapshot back into its origin.
+#
+# The origin and the COW device are sparse files on loop devices, and the
+# snapshot is filled with scattered chunk writes, the pattern an OTA
+# update leaves behind.  The snapshot is then merged with a snapshot-merge
+# target while the merge progress in its status is sampled.
+#
+# Usage: merge-bench.sh [origin_mb] [cow_mb] [chunk_sectors] [writes]
+#
+# Needs root, dmsetup and losetup.
+
+set -e
+
+ORIGIN_MB=${1:-1024}
+COW_MB=${2:-512}
+CHUNK=${3:-8}
+WRITES=${4:-8192}
+
+NAME=merge-bench-$$
+TMP=$(mktemp -d)
+ORIGIN_LOOP=
+COW_LOOP=
+
+cleanup()
+{
+	dmsetup remove $NAME-snap 2>/dev/null || true
+	dmsetup remove $NAME 2>/dev/null || true
+	[ -n "$COW_LOOP" ] && losetup -d $COW_LOOP
+	[ -n "$ORIGIN_LOOP" ] && losetup -d $ORIGIN_LOOP
+	rm -rf $TMP
+}
+trap cleanup EXIT
+
+now_ms()
+{
+	echo $(($(date +%s%N) / 1000000))
+}
+
+truncate -s ${ORIGIN_MB}M $TMP/origin
+truncate -s ${COW_MB}M $TMP/cow
+ORIGIN_LOOP=$(losetup -f --show $TMP/origin)
+COW_LOOP=$(losetup -f --show $TMP/cow)
+SECTORS=$(blockdev --getsz $ORIGIN_LOOP)
+
+dmsetup create $NAME --table "0 $SECTORS snapshot-origin $ORIGIN_LOOP"
+dmsetup create $NAME-snap \
+	--table "0 $SECTORS snapshot $ORIGIN_LOOP $COW_LOOP P $CHUNK"
+
+# Every other chunk in a random order, so that runs stay short
+CHUNKS=$((SECTORS / CHUNK))
+echo "writing $WRITES chunks of $((CHUNK * 512)) bytes to the snapshot"
+for i in $(seq 0 2 $((CHUNKS - 1)) | shuf -n $WRITES); do
+	dd if=/dev/urandom of=/dev/mapper/$NAME-snap bs=$((CHUNK * 512)) \
+	   seek=$i count=1 oflag=direct status=none
+done
+sync
+
+dmsetup status $NAME-snap
+dmsetup remove $NAME-snap
+
+dmsetup suspend $NAME
+dmsetup reload $NAME \
+	--table "0 $SECTORS snapshot-merge $ORIGIN_LOOP $COW_LOOP P $CHUNK"
+START=$(now_ms)
+dmsetup resume $NAME
+
+# Status is "allocated/total metadata merged_chunks commits merge_ms"
+while :; do
+	STATUS=$(dmsetup status $NAME | cut -d' ' -f4-)
+	set -- $STATUS
+	ALLOCATED=${1%/*}
+	[ "$ALLOCATED" = "$2" ] && break
+	case "$1" in
+	*/*) ;;
+	*) echo "merge stopped: $STATUS"; exit 1 ;;
+	esac
+	sleep 0.1
+done
+END=$(now_ms)
+
+set -- $STATUS
+echo "merged $3 chunks with $4 metadata commits in $((END - START)) ms" \
+     "($5 ms in the merge thread)"
+if [ "$5" -gt 0 ]; then
+	echo "$(($3 * 1000 / $5)) chunks/s," \
+	     "$(($3 * CHUNK * 512 / 1024 * 1000 / $5)) KiB/s"
+fi
@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * dm-user-loop - serve a dm-user target from a file
+ *
+ * A minimal dm-user daemon that maps the target one to one onto a backing
+ * file or block device, using either the read()/write() protocol or the
+ * shared ring (-r).  It keeps no state besides the backing file, so the
+ * time it spends is close to the cost of the transport itself, which makes
+ * it a benchmark for the two protocols:
+ *
+ *	dmsetup create loop0 --table "0 $SECTORS user 0 $SECTORS loop0"
+ *	dm-user-loop [-r entries] /dev/dm-user/loop0 backing.img &
+ *	fio --filename=/dev/mapper/loop0 ...
+ *
+ * Throughput is printed every interval (-i) and when the target goes away.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/dm-user.h>
+
+#define SECTOR_SHIFT	9
+#define MAX_IO		(1 << 20)
+
+struct stats {
+	uint64_t reqs;
+	uint64_t bytes;
+	uint64_t calls;
+};
+
+static struct stats total, last;
+static double last_time, start_time;
+static int interval = 1;
+static int backing_fd;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, const struct stats *s,
+		   const struct stats *base, double secs)
+{
+	uint64_t reqs = s->reqs - base->reqs;
+	uint64_t calls = s->calls - base->calls;
+
+	if (secs <= 0)
+		return;
+	printf("%s: %.0f req/s %.1f MB/s %.2f req/syscall\n", what,
+	       reqs / secs, (s->bytes - base->bytes) / secs / (1 << 20),
+	       calls ? (double)reqs / calls : 0);
+	fflush(stdout);
+}
+
+static void tick(void)
+{
+	double t = now();
+
+	if (interval && t - last_time >= interval) {
+		report("interval", &total, &last, t - last_time);
+		last = total;
+		last_time = t;
+	}
+}
+
+/* Returns a DM_USER_RESP_* code, read data is left in buf */
+static uint32_t serve(uint64_t type, uint64_t sector, uint64_t len, void *buf)
+{
+	off_t off = (off_t)sector << SECTOR_SHIFT;
+	ssize_t ret;
+
+	total.reqs++;
+
+	switch (type) {
+	case DM_USER_REQ_MAP_READ:
+		ret = pread(backing_fd, buf, len, off);
+		break;
+	case DM_USER_REQ_MAP_WRITE:
+		ret = pwrite(backing_fd, buf, len, off);
+		break;
+	case DM_USER_REQ_MAP_FLUSH:
+		return fdatasync(backing_fd) ? DM_USER_RESP_ERROR :
+					       DM_USER_RESP_SUCCESS;
+	case DM_USER_REQ_MAP_DISCARD:
+		return DM_USER_RESP_SUCCESS;
+	default:
+		return DM_USER_RESP_UNSUPPORTED;
+	}
+
+	if (ret != (ssize_t)len)
+		return DM_USER_RESP_ERROR;
+	total.bytes += len;
+	return DM_USER_RESP_SUCCESS;
+}
+
+static ssize_t read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t ret = read(fd, (char *)buf + done, len - done);
+
+		total.calls++;
+		if (ret <= 0)
+			return ret ? ret : -1;
+		done += ret;
+	}
+	return done;
+}
+
+static int run_rw(int fd)
+{
+	struct dm_user_message *msg = malloc(sizeof(*msg) + MAX_IO);
+
+	if (!msg)
+		return -ENOMEM;
+
+	for (;;) {
+		uint64_t len, type;
+
+		if (read_full(fd, msg, sizeof(*msg)) < 0)
+			break;
+
+		len = msg->len;
+		if (len > MAX_IO) {
+			free(msg);
+			return -E2BIG;
+		}
+		if (msg->type == DM_USER_REQ_MAP_WRITE &&
+		    read_full(fd, msg->buf, len) < 0)
+			break;
+
+		type = msg->type;
+		msg->type = serve(type, msg->sector, len, msg->buf);
+		if (type != DM_USER_REQ_MAP_READ ||
+		    msg->type != DM_USER_RESP_SUCCESS)
+			len = 0;
+
+		total.calls++;
+		if (write(fd, msg, sizeof(*msg) + len) < 0)
+			break;
+		tick();
+	}
+
+	free(msg);
+	return errno == ENOTBLK ? 0 : -errno;
+}
+
+static int run_ring(int fd, uint32_t entries)
+{
+	struct dm_user_ring_setup setup = { .entries = entries };
+	struct dm_user_ring_header *hdr;
+	struct dm_user_ring_req *sq;
+	struct dm_user_ring_resp *cq;
+	uint32_t mask = entries - 1;
+	char *ring, *data;
+
+	if (ioctl(fd, DM_USER_IOC_RING_SETUP, &setup))
+		return -errno;
+
+	ring = mmap(NULL, setup.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED)
+		return -errno;
+	hdr = (void *)ring;
+	sq = (void *)(ring + setup.sq_off);
+	cq = (void *)(ring + setup.cq_off);
+	data = ring + setup.data_off;
+
+	for (;;) {
+		uint32_t head, tail, cq_tail;
+
+		total.calls++;
+		if (ioctl(fd, DM_USER_IOC_RING_ENTER, DM_USER_RING_ENTER_WAIT) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		head = hdr->sq.head;
+		tail = __atomic_load_n(&hdr->sq.tail, __ATOMIC_ACQUIRE);
+		cq_tail = hdr->cq.tail;
+
+		for (; head != tail; head++) {
+			struct dm_user_ring_req *req = &sq[head & mask];
+			struct dm_user_ring_resp *resp = &cq[cq_tail++ & mask];
+
+			/*
+			 * Every request holds a slot until it is answered and
+			 * there are as many completion entries as slots, so
+			 * the completion queue can't be full here.
+			 */
+			resp->seq = req->seq;
+			resp->slot = req->slot;
+			resp->type = serve(req->type, req->sector, req->len,
+					   data + (size_t)req->slot *
+						  setup.slot_size);
+		}
+
+		__atomic_store_n(&hdr->sq.head, head, __ATOMIC_RELEASE);
+		__atomic_store_n(&hdr->cq.tail, cq_tail, __ATOMIC_RELEASE);
+		tick();
+	}
+
+	munmap(ring, setup.size);
+	return errno == ENOTBLK ? 0 : -errno;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-r entries] [-i interval_s] /dev/dm-user/<name> <backing>\n"
+		"  -r  use the shared ring with this many entries (power of two)\n"
+		"  -i  seconds between throughput reports, 0 for none (default 1)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t entries = 0;
+	int fd, opt, ret;
+
+	while ((opt = getopt(argc, argv, "r:i:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			entries = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDWR);
+	if (fd < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	backing_fd = open(argv[optind + 1], O_RDWR);
+	if (backing_fd < 0) {
+		perror(argv[optind + 1]);
+		return 1;
+	}
+
+	start_time = last_time = now();
+	ret = entries ? run_ring(fd, entries) : run_rw(fd);
+	report("total", &total, &(struct stats){ 0 }, now() - start_time);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+
+	return 0;
+}
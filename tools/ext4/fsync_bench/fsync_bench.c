@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * fsync_bench - replay SQLite-like fsync patterns and report fsync latency
+ *
+ * Each thread owns a database file and its journal, so concurrent fsyncs
+ * are on different inodes, which is what ext4 fast commit batching is
+ * meant for. Two journal modes are replayed:
+ *
+ *  wal	   every transaction appends its pages as frames to the -wal file
+ *	   and fsyncs it; every -c transactions the frames are checkpointed
+ *	   into the database, which is fsynced, and the wal is rewound.
+ *  delete the pages are first written to a fresh rollback journal that
+ *	   is fsynced, then to the database that is fsynced, then the
+ *	   journal is unlinked.
+ *
+ * The latency of every fsync is recorded and percentiles are reported.
+ * Compare /proc/fs/ext4/<dev>/fc_info before and after a run to see how
+ * many fsyncs shared a fast commit.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WAL_HDR_SIZE	32
+#define FRAME_HDR_SIZE	24
+#define JOURNAL_HDR_SIZE 512
+
+enum mode { MODE_WAL, MODE_DELETE };
+
+static enum mode mode = MODE_WAL;
+static const char *dir;
+static int nr_threads = 4;
+static int nr_txns = 1000;
+static int pages_per_txn = 2;
+static int ckpt_interval = 100;
+static int db_pages = 256;
+static int page_size = 4096;
+
+struct thread {
+	pthread_t tid;
+	int idx;
+	uint32_t *lat_us;
+	int nr_lat;
+	int err;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int timed_fsync(struct thread *t, int fd)
+{
+	uint64_t start = now_ns();
+
+	if (fsync(fd))
+		return -errno;
+	t->lat_us[t->nr_lat++] = (now_ns() - start) / 1000;
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t off)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = pwrite(fd, buf, len, off);
+		if (ret < 0)
+			return -errno;
+		buf = (const char *)buf + ret;
+		len -= ret;
+		off += ret;
+	}
+	return 0;
+}
+
+static int run_wal(struct thread *t, int db, char *page, unsigned int *seed)
+{
+	char path[4096];
+	size_t frame = FRAME_HDR_SIZE + page_size;
+	off_t off = WAL_HDR_SIZE;
+	int wal, i, j, err = 0;
+
+	snprintf(path, sizeof(path), "%s/db%d-wal", dir, t->idx);
+	wal = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (wal < 0)
+		return -errno;
+
+	err = write_all(wal, page, WAL_HDR_SIZE, 0);
+
+	for (i = 0; !err && i < nr_txns; i++) {
+		for (j = 0; !err && j < pages_per_txn; j++) {
+			err = write_all(wal, page, frame, off);
+			off += frame;
+		}
+		if (!err)
+			err = timed_fsync(t, wal);
+
+		if (err || (i + 1) % ckpt_interval)
+			continue;
+
+		/* checkpoint: copy the frames back and rewind the wal */
+		for (j = 0; !err && j < ckpt_interval * pages_per_txn; j++)
+			err = write_all(db, page, page_size,
+					(off_t)(rand_r(seed) % db_pages) *
+					page_size);
+		if (!err)
+			err = timed_fsync(t, db);
+		if (!err)
+			err = write_all(wal, page, WAL_HDR_SIZE, 0);
+		if (!err)
+			err = timed_fsync(t, wal);
+		off = WAL_HDR_SIZE;
+	}
+
+	close(wal);
+	unlink(path);
+	return err;
+}
+
+static int run_delete(struct thread *t, int db, char *page, unsigned int *seed)
+{
+	char path[4096];
+	int journal, i, j, err = 0;
+
+	snprintf(path, sizeof(path), "%s/db%d-journal", dir, t->idx);
+
+	for (i = 0; !err && i < nr_txns; i++) {
+		off_t off = JOURNAL_HDR_SIZE;
+
+		journal = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (journal < 0)
+			return -errno;
+
+		err = write_all(journal, page, JOURNAL_HDR_SIZE, 0);
+		for (j = 0; !err && j < pages_per_txn; j++) {
+			err = write_all(journal, page, page_size + 8, off);
+			off += page_size + 8;
+		}
+		if (!err)
+			err = timed_fsync(t, journal);
+		close(journal);
+
+		for (j = 0; !err && j < pages_per_txn; j++)
+			err = write_all(db, page, page_size,
+					(off_t)(rand_r(seed) % db_pages) *
+					page_size);
+		if (!err)
+			err = timed_fsync(t, db);
+		if (unlink(path) && !err)
+			err = -errno;
+	}
+	return err;
+}
+
+static void *thread_fn(void *arg)
+{
+	struct thread *t = arg;
+	unsigned int seed = t->idx + 1;
+	char path[4096];
+	char *page;
+	int db;
+
+	page = malloc(FRAME_HDR_SIZE + page_size + 8);
+	if (!page) {
+		t->err = -ENOMEM;
+		return NULL;
+	}
+	memset(page, 0xa5 + t->idx, FRAME_HDR_SIZE + page_size + 8);
+
+	snprintf(path, sizeof(path), "%s/db%d", dir, t->idx);
+	db = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (db < 0) {
+		t->err = -errno;
+		goto out;
+	}
+	t->err = write_all(db, page, page_size, (off_t)(db_pages - 1) *
+			   page_size);
+	if (!t->err)
+		t->err = fsync(db) ? -errno : 0;
+
+	if (!t->err)
+		t->err = mode == MODE_WAL ? run_wal(t, db, page, &seed) :
+			 run_delete(t, db, page, &seed);
+
+	close(db);
+	unlink(path);
+out:
+	free(page);
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint32_t pct(const uint32_t *lat, int n, double p)
+{
+	int i = (int)(n * p / 100);
+
+	return lat[i < n ? i : n - 1];
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-m wal|delete] [-t threads] [-n txns] [-p pages]\n"
+		"          [-c ckpt_interval] [-s db_pages] dir\n"
+		"\n"
+		"  -m  journal mode to replay (default wal)\n"
+		"  -t  threads, each with its own database (default 4)\n"
+		"  -n  transactions per thread (default 1000)\n"
+		"  -p  pages written per transaction (default 2)\n"
+		"  -c  wal mode: transactions between checkpoints (default 100)\n"
+		"  -s  database size in pages (default 256)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct thread *threads;
+	uint64_t start, elapsed;
+	uint32_t *lat;
+	double sum = 0;
+	int opt, i, n = 0, max_lat;
+
+	while ((opt = getopt(argc, argv, "m:t:n:p:c:s:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "wal")) {
+				mode = MODE_WAL;
+			} else if (!strcmp(optarg, "delete")) {
+				mode = MODE_DELETE;
+			} else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'n':
+			nr_txns = atoi(optarg);
+			break;
+		case 'p':
+			pages_per_txn = atoi(optarg);
+			break;
+		case 'c':
+			ckpt_interval = atoi(optarg);
+			break;
+		case 's':
+			db_pages = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind >= argc || nr_threads <= 0 || nr_txns <= 0 ||
+	    pages_per_txn <= 0 || ckpt_interval <= 0 || db_pages <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	dir = argv[optind];
+
+	/* at most two fsyncs per transaction plus two per checkpoint */
+	max_lat = 2 * nr_txns + 2 * (nr_txns / ckpt_interval + 1);
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		return 1;
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].idx = i;
+		threads[i].lat_us = malloc(max_lat * sizeof(uint32_t));
+		if (!threads[i].lat_us)
+			return 1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i].tid, NULL, thread_fn,
+				   &threads[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i].tid, NULL);
+	elapsed = now_ns() - start;
+
+	lat = malloc((size_t)nr_threads * max_lat * sizeof(uint32_t));
+	if (!lat)
+		return 1;
+	for (i = 0; i < nr_threads; i++) {
+		if (threads[i].err) {
+			fprintf(stderr, "thread %d: %s\n", i,
+				strerror(-threads[i].err));
+			return 1;
+		}
+		memcpy(lat + n, threads[i].lat_us,
+		       threads[i].nr_lat * sizeof(uint32_t));
+		n += threads[i].nr_lat;
+	}
+	if (!n)
+		return 1;
+
+	qsort(lat, n, sizeof(*lat), cmp_u32);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+
+	printf("mode=%s threads=%d txns=%d pages=%d\n",
+	       mode == MODE_WAL ? "wal" : "delete", nr_threads,
+	       nr_threads * nr_txns, pages_per_txn);
+	printf("%.0f txn/s, %d fsyncs\n",
+	       nr_threads * nr_txns * 1e9 / elapsed, n);
+	printf("fsync us: avg=%.0f p50=%u p90=%u p99=%u p99.9=%u max=%u\n",
+	       sum / n, pct(lat, n, 50), pct(lat, n, 90), pct(lat, n, 99),
+	       pct(lat, n, 99.9), lat[n - 1]);
+
+	return 0;
+}
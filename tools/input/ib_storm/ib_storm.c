@@ -0,0 +1,346 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * ib_storm - drive a touch storm through evdev and measure input booster cost
+ *
+ * A multitouch screen is created with uinput and its event node is kept
+ * open, so that evdev delivers every frame both to a client and to the
+ * input booster path. Fingers are moved across the screen at the frame
+ * rate of a touch controller, and every -t frames each finger lifts and
+ * touches down again, which is what the booster has to react to.
+ *
+ * At the end the CPU time spent by the whole system per frame is printed
+ * together with the booster statistics from debugfs: how many state
+ * changes were seen, how many were dropped before delivery, how many
+ * notifier calls delivered them and how long it took from the event time
+ * to the call.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uinput.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FINGERS	10
+#define SCREEN_X	1080
+#define SCREEN_Y	2400
+#define IB_STATS	"/sys/kernel/debug/evdev/input_booster"
+
+struct ib_stats {
+	long long edges;
+	long long overflows;
+	long long signals;
+	long long latency_sum_us;
+	long long max_latency_us;
+	bool valid;
+};
+
+static int rate = 240;
+static int duration = 10;
+static int nr_fingers = 2;
+static int tap_interval = 30;
+
+static int emit(int fd, int type, int code, int value)
+{
+	struct input_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	return write(fd, &ev, sizeof(ev)) == sizeof(ev) ? 0 : -errno;
+}
+
+static int abs_setup(int fd, int code, int max)
+{
+	struct uinput_abs_setup abs;
+
+	memset(&abs, 0, sizeof(abs));
+	abs.code = code;
+	abs.absinfo.maximum = max;
+	return ioctl(fd, UI_ABS_SETUP, &abs);
+}
+
+static int create_touchscreen(void)
+{
+	struct uinput_setup setup;
+	int fd;
+
+	fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	if (fd < 0)
+		return -errno;
+
+	if (ioctl(fd, UI_SET_EVBIT, EV_KEY) ||
+	    ioctl(fd, UI_SET_EVBIT, EV_ABS) ||
+	    ioctl(fd, UI_SET_EVBIT, EV_SYN) ||
+	    ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH) ||
+	    ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT) ||
+	    ioctl(fd, UI_SET_ABSBIT, ABS_MT_SLOT) ||
+	    ioctl(fd, UI_SET_ABSBIT, ABS_MT_TRACKING_ID) ||
+	    ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_X) ||
+	    ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_Y) ||
+	    abs_setup(fd, ABS_MT_SLOT, MAX_FINGERS - 1) ||
+	    abs_setup(fd, ABS_MT_TRACKING_ID, 65535) ||
+	    abs_setup(fd, ABS_MT_POSITION_X, SCREEN_X - 1) ||
+	    abs_setup(fd, ABS_MT_POSITION_Y, SCREEN_Y - 1))
+		goto err;
+
+	memset(&setup, 0, sizeof(setup));
+	setup.id.bustype = BUS_VIRTUAL;
+	setup.id.vendor = 0x1;
+	setup.id.product = 0x1;
+	strcpy(setup.name, "ib_storm touchscreen");
+	if (ioctl(fd, UI_DEV_SETUP, &setup) || ioctl(fd, UI_DEV_CREATE))
+		goto err;
+
+	return fd;
+err:
+	close(fd);
+	return -errno;
+}
+
+/* Open the evdev node of the uinput device so that evdev sees a client */
+static int open_event_node(int ufd)
+{
+	char sysname[64], path[512];
+	struct dirent *de;
+	int fd = -ENOENT;
+	DIR *d;
+
+	if (ioctl(ufd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0)
+		return -errno;
+
+	snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+	d = opendir(path);
+	if (!d)
+		return -errno;
+	while ((de = readdir(d))) {
+		if (strncmp(de->d_name, "event", 5))
+			continue;
+		snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+		fd = open(path, O_RDONLY | O_NONBLOCK);
+		if (fd < 0)
+			fd = -errno;
+		break;
+	}
+	closedir(d);
+	return fd;
+}
+
+static void read_ib_stats(struct ib_stats *st)
+{
+	char key[64];
+	long long val;
+	FILE *f;
+
+	memset(st, 0, sizeof(*st));
+	f = fopen(IB_STATS, "r");
+	if (!f)
+		return;
+	while (fscanf(f, "%63[^:]: %lld\n", key, &val) == 2) {
+		if (!strcmp(key, "edges"))
+			st->edges = val;
+		else if (!strcmp(key, "overflows"))
+			st->overflows = val;
+		else if (!strcmp(key, "signals"))
+			st->signals = val;
+		else if (!strcmp(key, "latency_sum_us"))
+			st->latency_sum_us = val;
+		else if (!strcmp(key, "max_latency_us"))
+			st->max_latency_us = val;
+	}
+	st->valid = true;
+	fclose(f);
+}
+
+/* Busy and total jiffies of all CPUs */
+static void read_cpu_ticks(unsigned long long *busy, unsigned long long *total)
+{
+	unsigned long long v[8] = { 0 };
+	FILE *f;
+	int i;
+
+	*busy = *total = 0;
+	f = fopen("/proc/stat", "r");
+	if (!f)
+		return;
+	if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0],
+		   &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8) {
+		for (i = 0; i < 8; i++)
+			*total += v[i];
+		/* idle and iowait are not busy */
+		*busy = *total - v[3] - v[4];
+	}
+	fclose(f);
+}
+
+static void timespec_add_ns(struct timespec *ts, long ns)
+{
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= 1000000000L) {
+		ts->tv_nsec -= 1000000000L;
+		ts->tv_sec++;
+	}
+}
+
+static double tv_us(const struct timeval *tv)
+{
+	return tv->tv_sec * 1e6 + tv->tv_usec;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-r rate] [-d duration] [-f fingers] [-t interval]\n"
+		"\n"
+		"  -r  frames per second (default 240)\n"
+		"  -d  duration in seconds (default 10)\n"
+		"  -f  fingers on the screen (default 2, max %d)\n"
+		"  -t  frames between lifting and touching again (default 30,\n"
+		"      at least 2, 0 keeps the fingers down)\n",
+		prog, MAX_FINGERS);
+}
+
+int main(int argc, char **argv)
+{
+	struct input_event drain[64];
+	unsigned long long busy0, total0, busy1, total1;
+	struct ib_stats st0, st1;
+	struct rusage ru;
+	struct timespec next;
+	long long frames, nr_frames, touches = 0;
+	int ufd, efd, opt, i, err = 0;
+	int tracking_id = 0;
+	long tick;
+
+	while ((opt = getopt(argc, argv, "r:d:f:t:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'f':
+			nr_fingers = atoi(optarg);
+			break;
+		case 't':
+			tap_interval = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (rate <= 0 || duration <= 0 || nr_fingers <= 0 ||
+	    nr_fingers > MAX_FINGERS || tap_interval == 1 || tap_interval < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ufd = create_touchscreen();
+	if (ufd < 0) {
+		fprintf(stderr, "uinput: %s\n", strerror(-ufd));
+		return 1;
+	}
+	/* Give udev a moment to create the node */
+	usleep(200000);
+	efd = open_event_node(ufd);
+	if (efd < 0) {
+		fprintf(stderr, "event node: %s\n", strerror(-efd));
+		ioctl(ufd, UI_DEV_DESTROY);
+		return 1;
+	}
+
+	nr_frames = (long long)rate * duration;
+	tick = 1000000000L / rate;
+
+	read_ib_stats(&st0);
+	read_cpu_ticks(&busy0, &total0);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (frames = 0; !err && frames < nr_frames; frames++) {
+		bool lift = tap_interval && frames && !(frames % tap_interval);
+		bool down = !frames ||
+			    (tap_interval && frames % tap_interval == 1);
+
+		for (i = 0; !err && i < nr_fingers; i++) {
+			int x = (SCREEN_X / (nr_fingers + 1)) * (i + 1);
+			int y = (frames * 7 + i * 200) % SCREEN_Y;
+
+			err = emit(ufd, EV_ABS, ABS_MT_SLOT, i);
+			if (!err && lift) {
+				err = emit(ufd, EV_ABS, ABS_MT_TRACKING_ID, -1);
+				continue;
+			}
+			if (!err && down) {
+				err = emit(ufd, EV_ABS, ABS_MT_TRACKING_ID,
+					   tracking_id++ & 0xffff);
+				touches++;
+			}
+			if (!err)
+				err = emit(ufd, EV_ABS, ABS_MT_POSITION_X, x);
+			if (!err)
+				err = emit(ufd, EV_ABS, ABS_MT_POSITION_Y, y);
+		}
+		if (!err && (lift || down))
+			err = emit(ufd, EV_KEY, BTN_TOUCH, down);
+		if (!err)
+			err = emit(ufd, EV_SYN, SYN_REPORT, 0);
+
+		while (read(efd, drain, sizeof(drain)) > 0)
+			;
+
+		timespec_add_ns(&next, tick);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	/* Let the booster work run before sampling */
+	usleep(100000);
+	while (read(efd, drain, sizeof(drain)) > 0)
+		;
+	read_cpu_ticks(&busy1, &total1);
+	read_ib_stats(&st1);
+	getrusage(RUSAGE_SELF, &ru);
+
+	close(efd);
+	ioctl(ufd, UI_DEV_DESTROY);
+	close(ufd);
+
+	if (err) {
+		fprintf(stderr, "uinput write: %s\n", strerror(-err));
+		return 1;
+	}
+
+	printf("frames=%lld rate=%d fingers=%d touches=%lld\n", frames, rate,
+	       nr_fingers, touches);
+	printf("injector: user %.1f us/frame, sys %.1f us/frame\n",
+	       tv_us(&ru.ru_utime) / frames, tv_us(&ru.ru_stime) / frames);
+	if (total1 > total0)
+		printf("system: %.2f%% busy, %.1f us/frame\n",
+		       100.0 * (busy1 - busy0) / (total1 - total0),
+		       (busy1 - busy0) * 1e6 / sysconf(_SC_CLK_TCK) / frames);
+
+	if (!st0.valid || !st1.valid) {
+		printf("booster: %s not readable\n", IB_STATS);
+		return 0;
+	}
+	printf("booster: edges=%lld overflows=%lld signals=%lld (%.2f edges/signal)\n",
+	       st1.edges - st0.edges, st1.overflows - st0.overflows,
+	       st1.signals - st0.signals,
+	       st1.signals > st0.signals ?
+	       (double)(st1.edges - st0.edges) / (st1.signals - st0.signals) : 0);
+	if (st1.signals > st0.signals)
+		printf("event to boost: avg %lld us, max %lld us (since boot)\n",
+		       (st1.latency_sum_us - st0.latency_sum_us) /
+		       (st1.signals - st0.signals), st1.max_latency_us);
+	return 0;
+}
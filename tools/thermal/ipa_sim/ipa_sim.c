@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * ipa_sim - replay thermal traces through the power allocator forecast
+ *
+ * Reads a trace of "time_ms temp_mC power_mW" samples, e.g. collected from
+ * the thermal_power_allocator trace event, and feeds it to the same online
+ * thermal model the power_allocator governor uses when forecast_ms is set.
+ * It reports how well the model forecasts the temperature, and with -c
+ * runs the governor's PID loop against the learned model, once reacting
+ * to the current temperature and once to the forecast one, so the two
+ * modes can be compared before enabling forecasting on a device.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef int64_t s64;
+typedef int32_t s32;
+typedef uint32_t u32;
+
+static inline s64 div64_s64(s64 dividend, s64 divisor)
+{
+	return dividend / divisor;
+}
+
+#include "gov_power_allocator_forecast.h"
+
+#define FRAC_BITS 10
+#define int_to_frac(x) ((s64)(x) << FRAC_BITS)
+#define frac_to_int(x) ((x) >> FRAC_BITS)
+
+struct sample {
+	s64 time_ms;
+	int temp;
+	u32 power;
+};
+
+struct sim_result {
+	int max_temp;
+	s64 ms_above;
+	double mean_power;
+	double stddev_power;
+};
+
+static struct sample *samples;
+static int nr_samples;
+
+static int read_trace(FILE *f)
+{
+	char line[256];
+	int alloc = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		struct sample s;
+		long long t;
+
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%lld%*[ ,\t]%d%*[ ,\t]%u", &t, &s.temp,
+			   &s.power) != 3)
+			continue;
+		s.time_ms = t;
+
+		if (nr_samples == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			samples = realloc(samples, alloc * sizeof(*samples));
+			if (!samples)
+				return -ENOMEM;
+		}
+		samples[nr_samples++] = s;
+	}
+
+	return nr_samples ? 0 : -EINVAL;
+}
+
+/* Learn from the trace and check forecasts against what really happened */
+static void replay(struct pa_forecast *fc, s64 horizon_ms)
+{
+	double err_sum = 0;
+	int i, j = 0, checked = 0, max_err = 0;
+
+	memset(fc, 0, sizeof(*fc));
+
+	for (i = 1; i < nr_samples; i++) {
+		struct sample *prev = &samples[i - 1], *cur = &samples[i];
+		int fcast, err;
+
+		pa_forecast_learn(fc, cur->power, prev->temp, cur->temp,
+				  cur->time_ms - prev->time_ms);
+		if (!pa_forecast_ready(fc) || !horizon_ms)
+			continue;
+
+		fcast = pa_forecast_temp(fc, cur->temp, cur->power, horizon_ms);
+
+		if (j < i)
+			j = i;
+		while (j < nr_samples &&
+		       samples[j].time_ms < cur->time_ms + horizon_ms)
+			j++;
+		if (j == nr_samples)
+			break;
+
+		err = abs(fcast - samples[j].temp);
+		err_sum += err;
+		if (err > max_err)
+			max_err = err;
+		checked++;
+	}
+
+	printf("samples: %d\n", nr_samples);
+	printf("model: a=%.6f b=%.6f c=%.0f err_avg=%lld mC/s%s\n",
+	       (double)fc->w[0] / (1 << PA_FC_FRAC_BITS),
+	       (double)fc->w[1] / (1 << PA_FC_FRAC_BITS),
+	       (double)fc->w[2],
+	       (long long)fc->err_avg,
+	       pa_forecast_ready(fc) ? "" : " (not converged)");
+	if (checked)
+		printf("forecast %lld ms: checked=%d mean_err=%.0f mC max_err=%d mC\n",
+		       (long long)horizon_ms, checked, err_sum / checked,
+		       max_err);
+}
+
+/*
+ * Run the governor's PID loop, with the constants it estimates by
+ * default, against the learned model. The trace power is what the
+ * workload asks for, the model is heated by the granted part of it.
+ */
+static void simulate(const struct pa_forecast *plant, s64 horizon_ms,
+		     int control_temp, int switch_on_temp,
+		     u32 sustainable_power, u32 max_power, s64 period_ms,
+		     struct sim_result *res)
+{
+	struct pa_forecast fc = *plant;
+	s64 k_po, k_pu, k_i, err_integral = 0;
+	s64 t, end, temp;
+	double sum = 0, sum_sq = 0;
+	u32 power = 0;
+	int i = 0, n = 0;
+
+	k_po = int_to_frac(sustainable_power) / (control_temp - switch_on_temp);
+	k_pu = int_to_frac(2 * sustainable_power) /
+		(control_temp - switch_on_temp);
+	k_i = k_pu / 10 ? k_pu / 10 : 1;
+
+	memset(res, 0, sizeof(*res));
+	temp = samples[0].temp;
+	res->max_temp = temp;
+	end = samples[nr_samples - 1].time_ms;
+
+	for (t = samples[0].time_ms; t < end; t += period_ms) {
+		s64 p, in, err, budget, ctl_temp = temp;
+		u32 demand;
+
+		while (i < nr_samples - 1 && samples[i + 1].time_ms <= t)
+			i++;
+		demand = samples[i].power;
+
+		if (temp < switch_on_temp) {
+			err_integral = 0;
+			budget = max_power;
+		} else {
+			if (horizon_ms) {
+				ctl_temp = pa_forecast_temp(&fc, temp, power,
+							    horizon_ms);
+				if (temp > control_temp && ctl_temp < temp)
+					ctl_temp = temp;
+			}
+			err = int_to_frac(control_temp - ctl_temp);
+			p = (err < 0 ? k_po : k_pu) * err >> FRAC_BITS;
+			in = k_i * err_integral >> FRAC_BITS;
+			if (llabs(in + (k_i * err >> FRAC_BITS)) <
+			    int_to_frac(max_power)) {
+				in += k_i * err >> FRAC_BITS;
+				err_integral += err;
+			}
+			budget = sustainable_power + frac_to_int(p + in);
+			if (budget < 0)
+				budget = 0;
+			if (budget > max_power)
+				budget = max_power;
+		}
+
+		power = demand < budget ? demand : budget;
+		temp += pa_forecast_rate(plant, power, temp) * period_ms / 1000;
+
+		if (temp > res->max_temp)
+			res->max_temp = temp;
+		if (temp > control_temp)
+			res->ms_above += period_ms;
+		if (temp >= switch_on_temp) {
+			sum += budget;
+			sum_sq += (double)budget * budget;
+			n++;
+		}
+	}
+
+	if (n) {
+		res->mean_power = sum / n;
+		res->stddev_power = sqrt(sum_sq / n -
+					 res->mean_power * res->mean_power);
+	}
+}
+
+static void print_result(const char *name, const struct sim_result *res)
+{
+	printf("%-10s max_temp=%d mC above_control=%lld ms budget_mean=%.0f mW budget_stddev=%.0f mW\n",
+	       name, res->max_temp, (long long)res->ms_above, res->mean_power,
+	       res->stddev_power);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-H horizon_ms] [-c] [-t control_mC] [-s switch_on_mC]\n"
+		"          [-p sustainable_mW] [-m max_mW] [-d period_ms] [trace]\n"
+		"\n"
+		"Trace lines are \"time_ms temp_mC power_mW\", '#' starts a comment.\n"
+		"  -H  forecast horizon, as in the zone's forecast_ms (default 3000)\n"
+		"  -c  also run the governor loop against the learned model\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	int control_temp = 75000, switch_on_temp = 65000;
+	u32 sustainable_power = 2500, max_power = 8000;
+	s64 horizon_ms = 3000, period_ms = 100;
+	struct sim_result reactive, predictive;
+	struct pa_forecast fc;
+	bool closed_loop = false;
+	FILE *f = stdin;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "H:ct:s:p:m:d:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			horizon_ms = atoll(optarg);
+			break;
+		case 'c':
+			closed_loop = true;
+			break;
+		case 't':
+			control_temp = atoi(optarg);
+			break;
+		case 's':
+			switch_on_temp = atoi(optarg);
+			break;
+		case 'p':
+			sustainable_power = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_power = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			period_ms = atoll(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	if (read_trace(f)) {
+		fprintf(stderr, "no samples in trace\n");
+		return 1;
+	}
+
+	replay(&fc, horizon_ms);
+
+	if (!closed_loop)
+		return 0;
+
+	if (!pa_forecast_ready(&fc) || control_temp <= switch_on_temp ||
+	    period_ms <= 0) {
+		fprintf(stderr, "cannot simulate: model not converged or bad parameters\n");
+		return 1;
+	}
+
+	simulate(&fc, 0, control_temp, switch_on_temp, sustainable_power,
+		 max_power, period_ms, &reactive);
+	simulate(&fc, horizon_ms, control_temp, switch_on_temp,
+		 sustainable_power, max_power, period_ms, &predictive);
+	print_result("reactive", &reactive);
+	print_result("predictive", &predictive);
+
+	return 0;
+}